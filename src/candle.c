@@ -20,10 +20,16 @@
 */
 
 #include "candle.h"
+#include "candle_cache.h"
+#include "candle_txq.h"
+#include "candle_timing.h"
+#include "candle_recorder.h"
+#include "candle_gateway.h"
 #include <stdlib.h>
 
 #include "candle_defs.h"
 #include "candle_ctrl_req.h"
+#include "candle_rx.h"
 #include "ch_9.h"
 
 static bool candle_read_di(HDEVINFO hdi, SP_DEVICE_INTERFACE_DATA interfaceData, candle_device_t *dev)
@@ -201,6 +207,17 @@ static bool candle_dev_interal_open(candle_handle hdev)
 
     memset(dev->rxevents, 0, sizeof(dev->rxevents));
     memset(dev->rxurbs, 0, sizeof(dev->rxurbs));
+    dev->rx_borrowed = 0;
+    dev->num_borrowed = 0;
+    dev->rx_failed = 0;
+    for (unsigned ch=0; ch<CANDLE_MAX_CHANNELS; ch++) {
+        /* whatever is configured on the device is unknown until set again */
+        dev->channels[ch].timing_valid = false;
+        dev->channels[ch].mode_valid = false;
+    }
+    if (dev->max_borrows == 0) {
+        dev->max_borrows = CANDLE_DEFAULT_MAX_BORROWS;
+    }
 
     dev->deviceHandle = CreateFile(
         dev->path,
@@ -292,7 +309,7 @@ close_handle:
 
 }
 
-static bool candle_prepare_read(candle_device_t *dev, unsigned urb_num)
+bool candle_prepare_read(candle_device_t *dev, unsigned urb_num)
 {
     bool rc = WinUsb_ReadPipe(
         dev->winUSBHandle,
@@ -354,6 +371,10 @@ DLL bool __stdcall candle_dev_close(candle_handle hdev)
 {
     candle_device_t *dev = (candle_device_t*)hdev;
 
+    if (dev->txq != NULL) {
+        candle_txq_reset(dev);
+    }
+
     candle_close_rxurbs(dev);
 
     WinUsb_Free(dev->winUSBHandle);
@@ -367,6 +388,28 @@ DLL bool __stdcall candle_dev_close(candle_handle hdev)
 
 DLL bool __stdcall candle_dev_free(candle_handle hdev)
 {
+    candle_device_t *dev = (candle_device_t*)hdev;
+
+    if (dev->cache != NULL) {
+        candle_cache_disable(dev);
+    }
+
+    if (dev->txq != NULL) {
+        candle_txq_disable(dev);
+    }
+
+    if (dev->recorder != NULL) {
+        candle_recorder_disable(dev);
+    }
+
+    if (dev->isotp != NULL) {
+        candle_isotp_free(dev);
+    }
+
+    if (dev->gateway != NULL) {
+        candle_gateway_clear(dev);
+    }
+
     free(hdev);
     return true;
 }
@@ -397,7 +440,19 @@ DLL bool __stdcall candle_channel_set_timing(candle_handle hdev, uint8_t ch, can
 {
     // TODO ensure device is open, check channel count..
     candle_device_t *dev = (candle_device_t*)hdev;
-    return candle_ctrl_set_bittiming(dev, ch, data);
+
+    if (!candle_ctrl_set_bittiming(dev, ch, data)) {
+        if (ch < CANDLE_MAX_CHANNELS) {
+            dev->channels[ch].timing_valid = false;
+        }
+        return false;
+    }
+
+    if (ch < CANDLE_MAX_CHANNELS) {
+        dev->channels[ch].timing = *data;
+        dev->channels[ch].timing_valid = true;
+    }
+    return true;
 }
 
 DLL bool __stdcall candle_channel_set_bitrate(candle_handle hdev, uint8_t ch, uint32_t bitrate)
@@ -405,81 +460,63 @@ DLL bool __stdcall candle_channel_set_bitrate(candle_handle hdev, uint8_t ch, ui
     // TODO ensure device is open, check channel count..
     candle_device_t *dev = (candle_device_t*)hdev;
 
-    if (dev->bt_const.fclk_can != 48000000) {
-        /* this function only works for the candleLight base clock of 48MHz */
-        dev->last_error = CANDLE_ERR_BITRATE_FCLK;
+    candle_bittiming_t t;
+    if (!candle_timing_from_bitrate(dev, bitrate, &t)) {
         return false;
     }
 
-    candle_bittiming_t t;
-    t.prop_seg = 1;
-    t.sjw = 1;
-    t.phase_seg1 = 13 - t.prop_seg;
-    t.phase_seg2 = 2;
-
-    switch (bitrate) {
-        case 10000:
-            t.brp = 300;
-            break;
-
-        case 20000:
-            t.brp = 150;
-            break;
-
-        case 50000:
-            t.brp = 60;
-            break;
-
-        case 83333:
-            t.brp = 36;
-            break;
-
-        case 100000:
-            t.brp = 30;
-            break;
-
-        case 125000:
-            t.brp = 24;
-            break;
+    return candle_channel_set_timing(dev, ch, &t);
+}
 
-        case 250000:
-            t.brp = 12;
-            break;
+DLL bool __stdcall candle_channel_calc_timing(candle_handle hdev, uint8_t ch, uint32_t bitrate, uint16_t sample_point, candle_bittiming_t *timing)
+{
+    candle_device_t *dev = (candle_device_t*)hdev;
 
-        case 500000:
-            t.brp = 6;
-            break;
+    if (ch > dev->dconf.icount) {
+        dev->last_error = CANDLE_ERR_CHANNEL_OUT_OF_RANGE;
+        return false;
+    }
 
-        case 800000:
-            t.brp = 4;
-            t.phase_seg1 = 12 - t.prop_seg;
-            t.phase_seg2 = 2;
-            break;
+    return candle_timing_calc(dev, bitrate, sample_point, timing);
+}
 
-        case 1000000:
-            t.brp = 3;
-            break;
+DLL bool __stdcall candle_channel_set_bitrate_sp(candle_handle hdev, uint8_t ch, uint32_t bitrate, uint16_t sample_point)
+{
+    candle_device_t *dev = (candle_device_t*)hdev;
 
-        default:
-            dev->last_error = CANDLE_ERR_BITRATE_UNSUPPORTED;
-            return false;
+    candle_bittiming_t t;
+    if (!candle_channel_calc_timing(hdev, ch, bitrate, sample_point, &t)) {
+        return false;
     }
 
-    return candle_ctrl_set_bittiming(dev, ch, &t);
+    return candle_channel_set_timing(dev, ch, &t);
 }
 
 DLL bool __stdcall candle_channel_start(candle_handle hdev, uint8_t ch, uint32_t flags)
 {
     // TODO ensure device is open, check channel count..
     candle_device_t *dev = (candle_device_t*)hdev;
-    return candle_ctrl_set_device_mode(dev, ch, CANDLE_DEVMODE_START, flags);
+    bool rc = candle_ctrl_set_device_mode(dev, ch, CANDLE_DEVMODE_START, flags);
+
+    if (ch < CANDLE_MAX_CHANNELS) {
+        dev->channels[ch].mode_valid = rc;
+        dev->channels[ch].started = true;
+        dev->channels[ch].flags = flags;
+    }
+    return rc;
 }
 
 DLL bool __stdcall candle_channel_stop(candle_handle hdev, uint8_t ch)
 {
     // TODO ensure device is open, check channel count..
     candle_device_t *dev = (candle_device_t*)hdev;
-    return candle_ctrl_set_device_mode(dev, ch, CANDLE_DEVMODE_RESET, 0);
+    bool rc = candle_ctrl_set_device_mode(dev, ch, CANDLE_DEVMODE_RESET, 0);
+
+    if (ch < CANDLE_MAX_CHANNELS) {
+        dev->channels[ch].mode_valid = rc;
+        dev->channels[ch].started = false;
+    }
+    return rc;
 }
 
 DLL bool __stdcall candle_frame_send(candle_handle hdev, uint8_t ch, candle_frame_t *frame)
@@ -506,23 +543,34 @@ DLL bool __stdcall candle_frame_send(candle_handle hdev, uint8_t ch, candle_fram
 
 }
 
-DLL bool __stdcall candle_frame_read(candle_handle hdev, candle_frame_t *frame, uint32_t timeout_ms)
+static bool candle_rx_result(candle_device_t *dev, DWORD urb_num);
+
+static bool candle_rx_wait(candle_device_t *dev, uint32_t timeout_ms, DWORD *urb)
 {
-    // TODO ensure device is open..
-    candle_device_t *dev = (candle_device_t*)hdev;
+    DWORD urb_num;
+    ULONGLONG start = GetTickCount64();
 
-    DWORD wait_result = WaitForMultipleObjects(CANDLE_URB_COUNT, dev->rxevents, false, timeout_ms);
-    if (wait_result == WAIT_TIMEOUT) {
-        dev->last_error = CANDLE_ERR_READ_TIMEOUT;
-        return false;
-    }
+    if ((dev->rx_spin_max_us == 0) || !candle_rx_spin(dev, timeout_ms, &urb_num)) {
+        DWORD wait_result = WaitForMultipleObjects(CANDLE_URB_COUNT, dev->rxevents, false, candle_rx_time_left(start, timeout_ms));
+        if (wait_result == WAIT_TIMEOUT) {
+            dev->last_error = CANDLE_ERR_READ_TIMEOUT;
+            return false;
+        }
 
-    if ( (wait_result < WAIT_OBJECT_0) || (wait_result >= WAIT_OBJECT_0 + CANDLE_URB_COUNT) ) {
-        dev->last_error = CANDLE_ERR_READ_WAIT;
-        return false;
+        if ( (wait_result < WAIT_OBJECT_0) || (wait_result >= WAIT_OBJECT_0 + CANDLE_URB_COUNT) ) {
+            dev->last_error = CANDLE_ERR_READ_WAIT;
+            return false;
+        }
+
+        urb_num = wait_result - WAIT_OBJECT_0;
     }
 
-    DWORD urb_num = wait_result - WAIT_OBJECT_0;
+    *urb = urb_num;
+    return candle_rx_result(dev, urb_num);
+}
+
+static bool candle_rx_result(candle_device_t *dev, DWORD urb_num)
+{
     DWORD bytes_transfered;
 
     if (!WinUsb_GetOverlappedResult(dev->winUSBHandle, &dev->rxurbs[urb_num].ovl, &bytes_transfered, false)) {
@@ -531,18 +579,254 @@ DLL bool __stdcall candle_frame_read(candle_handle hdev, candle_frame_t *frame,
         return false;
     }
 
-    if (bytes_transfered != sizeof(*frame)) {
+    if (bytes_transfered != sizeof(candle_frame_t)) {
         candle_prepare_read(dev, urb_num);
         dev->last_error = CANDLE_ERR_READ_SIZE;
         return false;
     }
 
-    memcpy(frame, dev->rxurbs[urb_num].buf, sizeof(*frame));
+    return true;
+}
+
+DLL bool __stdcall candle_frame_read(candle_handle hdev, candle_frame_t *frame, uint32_t timeout_ms)
+{
+    // TODO ensure device is open..
+    candle_device_t *dev = (candle_device_t*)hdev;
+    ULONGLONG start = GetTickCount64();
+
+    for (;;) {
+        DWORD urb_num;
+        if (!candle_rx_wait(dev, candle_rx_time_left(start, timeout_ms), &urb_num)) {
+            return false;
+        }
+
+        const candle_frame_t *rx = (const candle_frame_t *)dev->rxurbs[urb_num].buf;
+        bool deliver = candle_rx_dispatch(dev, rx);
+        if (deliver) {
+            memcpy(frame, rx, sizeof(*frame));
+        }
+
+        if (!candle_prepare_read(dev, urb_num)) {
+            return false;
+        }
+
+        if (deliver) {
+            return true;
+        }
+    }
+}
+
+static void candle_batch_store(candle_batch_t *batch, uint32_t i, const candle_frame_t *frame)
+{
+    if (batch->can_id != NULL) {
+        batch->can_id[i] = frame->can_id;
+    }
+    if (batch->echo_id != NULL) {
+        batch->echo_id[i] = frame->echo_id;
+    }
+    if (batch->channel != NULL) {
+        batch->channel[i] = frame->channel;
+    }
+    if (batch->dlc != NULL) {
+        batch->dlc[i] = frame->can_dlc;
+    }
+    if (batch->flags != NULL) {
+        batch->flags[i] = frame->flags;
+    }
+    if (batch->timestamp_us != NULL) {
+        batch->timestamp_us[i] = frame->timestamp_us;
+    }
+    if (batch->data != NULL) {
+        memcpy(&batch->data[i * 8], frame->data, 8);
+    }
+}
+
+DLL bool __stdcall candle_frame_read_batch(candle_handle hdev, candle_batch_t *batch, uint32_t *num_frames, uint32_t timeout_ms)
+{
+    candle_device_t *dev = (candle_device_t*)hdev;
+    ULONGLONG start = GetTickCount64();
+    uint32_t n = 0;
+    DWORD urb_num;
 
-    return candle_prepare_read(dev, urb_num);
+    *num_frames = 0;
+    if (dev->winUSBHandle == NULL) {
+        dev->last_error = CANDLE_ERR_DEV_NOT_OPEN;
+        return false;
+    }
+
+    if (batch->capacity == 0) {
+        dev->last_error = CANDLE_ERR_CONFIG_INVALID;
+        return false;
+    }
+
+    /* block for the first frame only */
+    while (n == 0) {
+        if (!candle_rx_wait(dev, candle_rx_time_left(start, timeout_ms), &urb_num)) {
+            return false;
+        }
+
+        const candle_frame_t *rx = (const candle_frame_t *)dev->rxurbs[urb_num].buf;
+        if (candle_rx_dispatch(dev, rx)) {
+            candle_batch_store(batch, n++, rx);
+        }
+
+        if (!candle_prepare_read(dev, urb_num)) {
+            *num_frames = n;
+            return n > 0;
+        }
+    }
+
+    /* then take the urbs after it that have completed as well, stopping at the
+       first pending one. Like candle_frame_read, which gets the lowest completed
+       urb, this is not necessarily the order the frames were received in */
+    for (DWORD k=1; (k<CANDLE_URB_COUNT) && (n<batch->capacity); k++) {
+        DWORD i = (urb_num + k) % CANDLE_URB_COUNT;
+        if (dev->rx_borrowed & (1L << i)) {
+            continue;
+        }
+        if (!HasOverlappedIoCompleted(&dev->rxurbs[i].ovl)) {
+            break;
+        }
+
+        if (candle_rx_result(dev, i)) {
+            const candle_frame_t *rx = (const candle_frame_t *)dev->rxurbs[i].buf;
+            if (candle_rx_dispatch(dev, rx)) {
+                candle_batch_store(batch, n++, rx);
+            }
+            if (!candle_prepare_read(dev, i)) {
+                break;
+            }
+        }
+    }
+
+    *num_frames = n;
+    dev->last_error = CANDLE_ERR_OK;
+    return true;
+}
+
+DLL bool __stdcall candle_frame_borrow(candle_handle hdev, const candle_frame_t **frame, uint32_t timeout_ms)
+{
+    candle_device_t *dev = (candle_device_t*)hdev;
+
+    if (dev->winUSBHandle == NULL) {
+        dev->last_error = CANDLE_ERR_DEV_NOT_OPEN;
+        return false;
+    }
+
+    if (dev->num_borrowed >= dev->max_borrows) {
+        dev->last_error = CANDLE_ERR_BORROW_LIMIT;
+        return false;
+    }
+
+    ULONGLONG start = GetTickCount64();
+    DWORD urb_num;
+
+    for (;;) {
+        if (!candle_rx_wait(dev, candle_rx_time_left(start, timeout_ms), &urb_num)) {
+            return false;
+        }
+
+        if (candle_rx_dispatch(dev, (const candle_frame_t *)dev->rxurbs[urb_num].buf)) {
+            break;
+        }
+
+        if (!candle_prepare_read(dev, urb_num)) {
+            return false;
+        }
+    }
+
+    /* no transfer is pending on this urb until it is released,
+       so the reset event keeps it out of the wait in candle_rx_wait */
+    ResetEvent(dev->rxevents[urb_num]);
+    InterlockedOr(&dev->rx_borrowed, 1L << urb_num);
+    InterlockedIncrement(&dev->num_borrowed);
+
+    *frame = (const candle_frame_t *)dev->rxurbs[urb_num].buf;
+    dev->last_error = CANDLE_ERR_OK;
+    return true;
+}
+
+DLL bool __stdcall candle_frame_release(candle_handle hdev, const candle_frame_t *frame)
+{
+    candle_device_t *dev = (candle_device_t*)hdev;
+
+    for (unsigned i=0; i<CANDLE_URB_COUNT; i++) {
+        if ((const uint8_t *)frame != dev->rxurbs[i].buf) {
+            continue;
+        }
+
+        LONG mask = 1L << i;
+        if ((InterlockedAnd(&dev->rx_borrowed, ~mask) & mask) == 0) {
+            break; // not borrowed
+        }
+
+        InterlockedDecrement(&dev->num_borrowed);
+        return candle_prepare_read(dev, i);
+    }
+
+    dev->last_error = CANDLE_ERR_BORROW_INVALID;
+    return false;
+}
+
+DLL bool __stdcall candle_dev_set_max_borrows(candle_handle hdev, uint8_t max_borrows)
+{
+    candle_device_t *dev = (candle_device_t*)hdev;
+
+    if ((max_borrows == 0) || (max_borrows > CANDLE_URB_COUNT - CANDLE_MIN_FREE_URBS)) {
+        dev->last_error = CANDLE_ERR_BORROW_LIMIT;
+        return false;
+    }
+
+    dev->max_borrows = max_borrows;
+    dev->last_error = CANDLE_ERR_OK;
+    return true;
+}
+
+DLL bool __stdcall candle_dev_set_rx_spin(candle_handle hdev, uint32_t min_us, uint32_t max_us)
+{
+    candle_device_t *dev = (candle_device_t*)hdev;
+
+    if (min_us > max_us) {
+        min_us = max_us;
+    }
+
+    dev->rx_spin_min_us = min_us;
+    dev->rx_spin_max_us = max_us;
+    dev->rx_spin_budget_us = max_us;
+    dev->rx_spin_hits = 0;
+    dev->rx_blocks = 0;
+
+    dev->last_error = CANDLE_ERR_OK;
+    return true;
+}
+
+DLL bool __stdcall candle_dev_get_rx_spin_stats(candle_handle hdev, candle_rx_spin_stats_t *stats)
+{
+    candle_device_t *dev = (candle_device_t*)hdev;
+
+    stats->spin_hits = dev->rx_spin_hits;
+    stats->blocks = dev->rx_blocks;
+    stats->budget_us = dev->rx_spin_budget_us;
+
+    dev->last_error = CANDLE_ERR_OK;
+    return true;
+}
+
+DLL bool __stdcall candle_dev_pin_rx_thread(candle_handle hdev, uint8_t cpu)
+{
+    candle_device_t *dev = (candle_device_t*)hdev;
+
+    /* pins the calling thread, which is expected to be the one reading from hdev */
+    if ((cpu >= 8 * sizeof(DWORD_PTR)) || (SetThreadAffinityMask(GetCurrentThread(), (DWORD_PTR)1 << cpu) == 0)) {
+        dev->last_error = CANDLE_ERR_THREAD_AFFINITY;
+        return false;
+    }
+
+    dev->last_error = CANDLE_ERR_OK;
+    return true;
 }
 
-DLL candle_frametype_t __stdcall candle_frame_type(candle_frame_t *frame)
+DLL candle_frametype_t __stdcall candle_frame_type(const candle_frame_t *frame)
 {
     if (frame->echo_id != 0xFFFFFFFF) {
         return CANDLE_FRAMETYPE_ECHO;
@@ -555,22 +839,22 @@ DLL candle_frametype_t __stdcall candle_frame_type(candle_frame_t *frame)
     return CANDLE_FRAMETYPE_RECEIVE;
 }
 
-DLL uint32_t __stdcall candle_frame_id(candle_frame_t *frame)
+DLL uint32_t __stdcall candle_frame_id(const candle_frame_t *frame)
 {
     return frame->can_id & 0x1FFFFFFF;
 }
 
-DLL bool __stdcall candle_frame_is_extended_id(candle_frame_t *frame)
+DLL bool __stdcall candle_frame_is_extended_id(const candle_frame_t *frame)
 {
     return (frame->can_id & 0x80000000) != 0;
 }
 
-DLL bool __stdcall candle_frame_is_rtr(candle_frame_t *frame)
+DLL bool __stdcall candle_frame_is_rtr(const candle_frame_t *frame)
 {
     return (frame->can_id & 0x40000000) != 0;
 }
 
-DLL uint8_t __stdcall candle_frame_dlc(candle_frame_t *frame)
+DLL uint8_t __stdcall candle_frame_dlc(const candle_frame_t *frame)
 {
     return frame->can_dlc;
 }
@@ -580,7 +864,7 @@ DLL uint8_t* __stdcall candle_frame_data(candle_frame_t *frame)
     return frame->data;
 }
 
-DLL uint32_t __stdcall candle_frame_timestamp_us(candle_frame_t *frame)
+DLL uint32_t __stdcall candle_frame_timestamp_us(const candle_frame_t *frame)
 {
     return frame->timestamp_us;
 }
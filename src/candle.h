@@ -64,7 +64,7 @@ typedef enum {
     CANDLE_ERR_PREPARE_READ        =  9,
     CANDLE_ERR_SET_DEVICE_MODE     = 10,
     CANDLE_ERR_SET_BITTIMING       = 11,
-    CANDLE_ERR_BITRATE_FCLK        = 12,
+    CANDLE_ERR_BITRATE_FCLK        = 12, /* no longer returned, every clock is supported */
     CANDLE_ERR_BITRATE_UNSUPPORTED = 13,
     CANDLE_ERR_SEND_FRAME          = 14,
     CANDLE_ERR_READ_TIMEOUT        = 15,
@@ -82,6 +82,48 @@ typedef enum {
     CANDLE_ERR_DEV_OUT_OF_RANGE    = 27,
     CANDLE_ERR_GET_TIMESTAMP       = 28,
     CANDLE_ERR_SET_PIPE_RAW_IO     = 29,
+    CANDLE_ERR_MERGE_RUNNING       = 30,
+    CANDLE_ERR_MERGE_THREAD        = 31,
+    CANDLE_ERR_BORROW_LIMIT        = 32,
+    CANDLE_ERR_BORROW_INVALID      = 33,
+    CANDLE_ERR_REACTOR_ASSOCIATE   = 34,
+    CANDLE_ERR_DBC_PARSE           = 35,
+    CANDLE_ERR_DBC_NOT_FOUND       = 36,
+    CANDLE_ERR_DBC_OVERFLOW        = 37,
+    CANDLE_ERR_CHANNEL_OUT_OF_RANGE = 38,
+    CANDLE_ERR_CACHE_DISABLED      = 39,
+    CANDLE_ERR_CACHE_NOT_FOUND     = 40,
+    CANDLE_ERR_ARCHIVE_IO          = 41,
+    CANDLE_ERR_ARCHIVE_FORMAT      = 42,
+    CANDLE_ERR_ARCHIVE_EOF         = 43,
+    CANDLE_ERR_ARCHIVE_NO_INDEX    = 44,
+    CANDLE_ERR_TXQ_CONFIG          = 45,
+    CANDLE_ERR_TXQ_DISABLED        = 46,
+    CANDLE_ERR_TXQ_FULL            = 47,
+    CANDLE_ERR_THREAD_AFFINITY     = 48,
+    CANDLE_ERR_CONFIG_INVALID      = 49,
+    CANDLE_ERR_RECORDER_DISABLED   = 50,
+    CANDLE_ERR_RECORDER_CONFIG     = 51,
+    CANDLE_ERR_RECORDER_BUSY       = 52,
+    CANDLE_ERR_ISOTP_CONFIG        = 53,
+    CANDLE_ERR_ISOTP_TIMEOUT       = 54,
+    CANDLE_ERR_ISOTP_OVERFLOW      = 55,
+    CANDLE_ERR_NET_SOCKET          = 56,
+    CANDLE_ERR_NET_CONNECT         = 57,
+    CANDLE_ERR_NET_PROTOCOL        = 58,
+    CANDLE_ERR_NET_CLOSED          = 59,
+    CANDLE_ERR_NET_RUNNING         = 60,
+    CANDLE_ERR_NET_THREAD          = 61,
+    CANDLE_ERR_SHM_CREATE          = 62,
+    CANDLE_ERR_SHM_OPEN            = 63,
+    CANDLE_ERR_SHM_FULL            = 64,
+    CANDLE_ERR_SHM_CLOSED          = 65,
+    CANDLE_ERR_GATEWAY_RULE        = 66,
+    CANDLE_ERR_AUTOBAUD_CONFIG     = 67,
+    CANDLE_ERR_AUTOBAUD_NOT_FOUND  = 68,
+    CANDLE_ERR_ISOTP_WAIT          = 69,
+    CANDLE_ERR_REACTOR_BATCH       = 70,
+    CANDLE_ERR_DEV_NOT_OPEN        = 71,
 } candle_err_t;
 
 #pragma pack(push,1)
@@ -118,6 +160,40 @@ typedef struct {
     uint32_t brp;
 } candle_bittiming_t;
 
+typedef struct {
+    uint64_t spin_hits; /* frames found while polling */
+    uint64_t blocks;    /* spin budget ran out, fell back to a kernel wait */
+    uint32_t budget_us; /* current adaptive spin budget */
+} candle_rx_spin_stats_t;
+
+typedef struct {
+    uint32_t capacity;      /* entries in each column */
+    uint32_t *can_id;       /* columns may be NULL to skip them */
+    uint32_t *echo_id;
+    uint8_t *channel;
+    uint8_t *dlc;
+    uint8_t *flags;
+    uint32_t *timestamp_us;
+    uint8_t *data;          /* 8 bytes per frame */
+} candle_batch_t;
+
+#define CANDLE_MAX_FILTERS 8
+
+typedef struct {
+    uint32_t can_id; /* including the extended id and rtr flag bits */
+    uint32_t mask;
+} candle_filter_t;
+
+typedef struct {
+    uint8_t enabled;     /* start the channel after configuring it */
+    uint8_t num_filters; /* 0: read all frames; recorder, cache and ISO-TP always get all */
+    uint16_t reserved;
+    uint32_t bitrate;    /* 0: use timing */
+    uint32_t flags;      /* passed to candle_channel_start */
+    candle_bittiming_t timing;
+    candle_filter_t filters[CANDLE_MAX_FILTERS];
+} candle_channel_config_t;
+
 #pragma pack(pop)
 
 
@@ -143,19 +219,44 @@ DLL bool __stdcall candle_channel_count(candle_handle hdev, uint8_t *num_channel
 DLL bool __stdcall candle_channel_get_capabilities(candle_handle hdev, uint8_t ch, candle_capability_t *cap);
 DLL bool __stdcall candle_channel_set_timing(candle_handle hdev, uint8_t ch, candle_bittiming_t *data);
 DLL bool __stdcall candle_channel_set_bitrate(candle_handle hdev, uint8_t ch, uint32_t bitrate);
+
+/* bit timing for any bitrate within the device's capabilities; sample_point
+   is in per mille, 0 selects 87.5% like candle_channel_set_bitrate does */
+DLL bool __stdcall candle_channel_calc_timing(candle_handle hdev, uint8_t ch, uint32_t bitrate, uint16_t sample_point, candle_bittiming_t *timing);
+DLL bool __stdcall candle_channel_set_bitrate_sp(candle_handle hdev, uint8_t ch, uint32_t bitrate, uint16_t sample_point);
 DLL bool __stdcall candle_channel_start(candle_handle hdev, uint8_t ch, uint32_t flags);
 DLL bool __stdcall candle_channel_stop(candle_handle hdev, uint8_t ch);
 
+/* applies timing, mode and receive filters for channels 0..num_channels-1 in
+   one call; requests for values already set on the device are skipped */
+DLL bool __stdcall candle_dev_configure(candle_handle hdev, const candle_channel_config_t *channels, uint8_t num_channels);
+
 DLL bool __stdcall candle_frame_send(candle_handle hdev, uint8_t ch, candle_frame_t *frame);
 DLL bool __stdcall candle_frame_read(candle_handle hdev, candle_frame_t *frame, uint32_t timeout_ms);
 
-DLL candle_frametype_t __stdcall candle_frame_type(candle_frame_t *frame);
-DLL uint32_t __stdcall candle_frame_id(candle_frame_t *frame);
-DLL bool __stdcall candle_frame_is_extended_id(candle_frame_t *frame);
-DLL bool __stdcall candle_frame_is_rtr(candle_frame_t *frame);
-DLL uint8_t __stdcall candle_frame_dlc(candle_frame_t *frame);
+/* waits for one frame, then adds every other frame already received, up to
+   batch->capacity, into the column arrays (see candle_batch.h for helpers).
+   Frames are not guaranteed to be in reception order, use the timestamps */
+DLL bool __stdcall candle_frame_read_batch(candle_handle hdev, candle_batch_t *batch, uint32_t *num_frames, uint32_t timeout_ms);
+
+/* zero-copy receive: the frame stays in the receive buffer until it is released */
+DLL bool __stdcall candle_frame_borrow(candle_handle hdev, const candle_frame_t **frame, uint32_t timeout_ms);
+DLL bool __stdcall candle_frame_release(candle_handle hdev, const candle_frame_t *frame);
+DLL bool __stdcall candle_dev_set_max_borrows(candle_handle hdev, uint8_t max_borrows);
+
+/* low latency receive: poll for completed reads for up to an adaptive budget
+   between min_us and max_us before blocking; max_us == 0 disables polling */
+DLL bool __stdcall candle_dev_set_rx_spin(candle_handle hdev, uint32_t min_us, uint32_t max_us);
+DLL bool __stdcall candle_dev_get_rx_spin_stats(candle_handle hdev, candle_rx_spin_stats_t *stats);
+DLL bool __stdcall candle_dev_pin_rx_thread(candle_handle hdev, uint8_t cpu);
+
+DLL candle_frametype_t __stdcall candle_frame_type(const candle_frame_t *frame);
+DLL uint32_t __stdcall candle_frame_id(const candle_frame_t *frame);
+DLL bool __stdcall candle_frame_is_extended_id(const candle_frame_t *frame);
+DLL bool __stdcall candle_frame_is_rtr(const candle_frame_t *frame);
+DLL uint8_t __stdcall candle_frame_dlc(const candle_frame_t *frame);
 DLL uint8_t* __stdcall candle_frame_data(candle_frame_t *frame);
-DLL uint32_t __stdcall candle_frame_timestamp_us(candle_frame_t *frame);
+DLL uint32_t __stdcall candle_frame_timestamp_us(const candle_frame_t *frame);
 
 DLL candle_err_t __stdcall candle_dev_last_error(candle_handle hdev);
 
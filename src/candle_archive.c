@@ -0,0 +1,1063 @@
+/*
+
+  Copyright (c) 2016 Hubert Denkmair <hubert@denkmair.de>
+
+  This file is part of the candle windows API.
+  
+  This library is free software: you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation, either
+  version 3 of the License, or (at your option) any later version.
+ 
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+ 
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include "candle_archive.h"
+#include <stdlib.h>
+#include <string.h>
+#include <windows.h>
+
+#include "candle_lz.h"
+
+#define CANDLE_ARCHIVE_MAGIC "CNDLARC"
+#define CANDLE_ARCHIVE_VERSION 2
+#define CANDLE_ARCHIVE_BLOCK_MAGIC 0x314B4C42 /* "BLK1" */
+#define CANDLE_ARCHIVE_BLOCK_FRAMES 8192
+#define CANDLE_ARCHIVE_DICT_SLOTS (2 * CANDLE_ARCHIVE_BLOCK_FRAMES)
+#define CANDLE_ARCHIVE_MAX_RAW_SIZE (CANDLE_ARCHIVE_BLOCK_FRAMES * 48)
+#define CANDLE_ARCHIVE_DICT_ENTRY_SIZE 5 /* can_id + channel */
+#define CANDLE_ARCHIVE_INDEX_MAGIC 0x58444943 /* "CIDX" */
+#define CANDLE_ARCHIVE_ID_BITS 512
+#define CANDLE_ARCHIVE_ID_MASK 0x9FFFFFFF /* id and extended flag */
+
+enum {
+    COL_TS,     /* zigzag varint delta to the previous timestamp */
+    COL_DICT,   /* can_id (4 bytes) and channel of each dictionary entry */
+    COL_ID,     /* varint dictionary index per frame */
+    COL_DLC,
+    COL_FLAGS,
+    COL_ECHO,   /* varint echo_id + 1, so received frames store a single zero byte */
+    COL_DATA,   /* mask of non-zero bytes of the payload XOR previous payload, then those bytes */
+    CANDLE_ARCHIVE_COLUMNS
+};
+
+#pragma pack(push,1)
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t flags;
+    uint64_t start_time_us;
+    uint64_t reserved;
+} candle_archive_file_header_t;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t num_frames;
+    uint32_t raw_size;
+    uint32_t comp_size;  /* equal to raw_size if the block is stored uncompressed */
+    uint64_t first_ts;
+    uint64_t last_ts;
+} candle_archive_block_header_t;
+
+/* one entry per block, written between the block header and its payload, and
+   once more for all blocks after the last block when the archive is closed */
+typedef struct {
+    uint64_t offset;
+    uint64_t min_ts;
+    uint64_t max_ts;
+    uint32_t num_frames;
+    uint8_t ids[CANDLE_ARCHIVE_ID_BITS / 8]; /* bit hash(id) set for every id in the block */
+} candle_archive_index_entry_t;
+
+typedef struct {
+    uint64_t index_offset;
+    uint32_t num_entries;
+    uint32_t magic;
+} candle_archive_trailer_t;
+
+#pragma pack(pop)
+
+typedef struct {
+    uint8_t *data;
+    size_t len;
+    size_t cap;
+} candle_archive_buf_t;
+
+typedef struct {
+    candle_err_t last_error;
+    HANDLE file;
+    bool writing;
+    uint64_t start_time_us;
+
+    /* frames of the current block; collected by the writer, decoded by the reader */
+    candle_frame_t *frames;
+    uint64_t *ts;
+    uint32_t num_frames;
+    uint32_t pos;
+
+    uint64_t ts_ext;
+    bool ts_valid;
+
+    candle_archive_buf_t cols[CANDLE_ARCHIVE_COLUMNS];
+    candle_archive_buf_t raw;
+    candle_archive_buf_t comp;
+
+    uint64_t *dict_keys;
+    uint32_t *dict_index;
+    uint32_t *dict_gen;
+    uint32_t gen;
+    uint64_t *prev_payload;
+
+    uint64_t file_pos;
+    uint64_t data_end;
+    candle_archive_index_entry_t *index;
+    uint32_t num_entries;
+    uint32_t index_cap;
+    uint64_t *index_max_ts; /* running maximum of max_ts, for binary search */
+    uint64_t *index_min_ts; /* minimum of min_ts over this and all later blocks */
+
+    bool query;
+    uint64_t query_from;
+    uint64_t query_to;
+    uint32_t *query_ids;
+    uint32_t query_num_ids;
+    uint8_t query_bits[CANDLE_ARCHIVE_ID_BITS / 8];
+    uint32_t next_entry;
+} candle_archive_t;
+
+static bool buf_reserve(candle_archive_buf_t *b, size_t n)
+{
+    if (b->len + n <= b->cap) {
+        return true;
+    }
+    size_t cap = b->cap ? b->cap : 4096;
+    while (cap < b->len + n) {
+        cap *= 2;
+    }
+    uint8_t *p = (uint8_t *)realloc(b->data, cap);
+    if (p == NULL) {
+        return false;
+    }
+    b->data = p;
+    b->cap = cap;
+    return true;
+}
+
+static inline void buf_put(candle_archive_buf_t *b, const void *data, size_t n)
+{
+    memcpy(b->data + b->len, data, n);
+    b->len += n;
+}
+
+static inline void buf_byte(candle_archive_buf_t *b, uint8_t v)
+{
+    b->data[b->len++] = v;
+}
+
+static inline void buf_varint(candle_archive_buf_t *b, uint64_t v)
+{
+    while (v >= 0x80) {
+        b->data[b->len++] = (uint8_t)(v | 0x80);
+        v >>= 7;
+    }
+    b->data[b->len++] = (uint8_t)v;
+}
+
+static inline bool get_varint(const uint8_t **p, const uint8_t *end, uint64_t *v)
+{
+    uint64_t result = 0;
+    for (unsigned shift=0; shift<64; shift+=7) {
+        if (*p >= end) {
+            return false;
+        }
+        uint8_t b = *(*p)++;
+        result |= (uint64_t)(b & 0x7F) << shift;
+        if ((b & 0x80) == 0) {
+            *v = result;
+            return true;
+        }
+    }
+    return false;
+}
+
+static inline uint64_t zigzag_encode(int64_t v)
+{
+    return ((uint64_t)v << 1) ^ (uint64_t)(v >> 63);
+}
+
+static inline int64_t zigzag_decode(uint64_t v)
+{
+    return (int64_t)(v >> 1) ^ -(int64_t)(v & 1);
+}
+
+static uint32_t candle_archive_hash(uint64_t key)
+{
+    key ^= key >> 29;
+    key *= 0xBF58476D1CE4E5B9ull;
+    key ^= key >> 32;
+    return (uint32_t)key;
+}
+
+static unsigned candle_archive_id_bit(uint32_t can_id)
+{
+    return ((can_id & CANDLE_ARCHIVE_ID_MASK) * 2654435761u) >> (32 - 9); /* 9 bits for CANDLE_ARCHIVE_ID_BITS */
+}
+
+static bool candle_archive_seek(candle_archive_t *a, uint64_t pos)
+{
+    LARGE_INTEGER li;
+    li.QuadPart = (LONGLONG)pos;
+    if (!SetFilePointerEx(a->file, li, NULL, FILE_BEGIN)) {
+        a->last_error = CANDLE_ERR_ARCHIVE_IO;
+        return false;
+    }
+    a->file_pos = pos;
+    return true;
+}
+
+static bool candle_archive_write_all(candle_archive_t *a, const void *data, size_t len)
+{
+    DWORD written = 0;
+    if (!WriteFile(a->file, data, (DWORD)len, &written, NULL) || (written != len)) {
+        a->last_error = CANDLE_ERR_ARCHIVE_IO;
+        return false;
+    }
+    return true;
+}
+
+static bool candle_archive_read_all(candle_archive_t *a, void *data, size_t len, DWORD *bytes_read)
+{
+    if (!ReadFile(a->file, data, (DWORD)len, bytes_read, NULL)) {
+        a->last_error = CANDLE_ERR_ARCHIVE_IO;
+        return false;
+    }
+    return true;
+}
+
+static candle_archive_t *candle_archive_alloc(void)
+{
+    candle_archive_t *a = (candle_archive_t *)calloc(1, sizeof(candle_archive_t));
+    if (a == NULL) {
+        return NULL;
+    }
+
+    a->file = INVALID_HANDLE_VALUE;
+    a->frames = (candle_frame_t *)malloc(CANDLE_ARCHIVE_BLOCK_FRAMES * sizeof(candle_frame_t));
+    a->ts = (uint64_t *)malloc(CANDLE_ARCHIVE_BLOCK_FRAMES * sizeof(uint64_t));
+    a->prev_payload = (uint64_t *)malloc(CANDLE_ARCHIVE_BLOCK_FRAMES * sizeof(uint64_t));
+    if ((a->frames == NULL) || (a->ts == NULL) || (a->prev_payload == NULL)) {
+        candle_archive_close(a);
+        return NULL;
+    }
+    return a;
+}
+
+static bool candle_archive_encode_block(candle_archive_t *a)
+{
+    uint32_t n = a->num_frames;
+
+    for (unsigned c=0; c<CANDLE_ARCHIVE_COLUMNS; c++) {
+        a->cols[c].len = 0;
+    }
+
+    /* worst case sizes per frame, so the loop below needs no checks */
+    if (!buf_reserve(&a->cols[COL_TS], n * 10) || !buf_reserve(&a->cols[COL_DICT], n * CANDLE_ARCHIVE_DICT_ENTRY_SIZE)
+        || !buf_reserve(&a->cols[COL_ID], n * 3) || !buf_reserve(&a->cols[COL_DLC], n)
+        || !buf_reserve(&a->cols[COL_FLAGS], n) || !buf_reserve(&a->cols[COL_ECHO], n * 5)
+        || !buf_reserve(&a->cols[COL_DATA], n * 9))
+    {
+        a->last_error = CANDLE_ERR_MALLOC;
+        return false;
+    }
+
+    a->gen++;
+    uint32_t num_ids = 0;
+    uint64_t prev_ts = a->ts[0];
+
+    for (uint32_t i=0; i<n; i++) {
+        const candle_frame_t *f = &a->frames[i];
+
+        buf_varint(&a->cols[COL_TS], zigzag_encode((int64_t)(a->ts[i] - prev_ts)));
+        prev_ts = a->ts[i];
+
+        uint64_t key = f->can_id | ((uint64_t)f->channel << 32);
+        uint32_t h = candle_archive_hash(key) & (CANDLE_ARCHIVE_DICT_SLOTS - 1);
+        while ((a->dict_gen[h] == a->gen) && (a->dict_keys[h] != key)) {
+            h = (h + 1) & (CANDLE_ARCHIVE_DICT_SLOTS - 1);
+        }
+        if (a->dict_gen[h] != a->gen) {
+            a->dict_gen[h] = a->gen;
+            a->dict_keys[h] = key;
+            a->dict_index[h] = num_ids;
+            a->prev_payload[num_ids] = 0;
+            buf_put(&a->cols[COL_DICT], &f->can_id, sizeof(f->can_id));
+            buf_byte(&a->cols[COL_DICT], f->channel);
+            num_ids++;
+        }
+        uint32_t idx = a->dict_index[h];
+
+        buf_varint(&a->cols[COL_ID], idx);
+        buf_byte(&a->cols[COL_DLC], f->can_dlc);
+        buf_byte(&a->cols[COL_FLAGS], f->flags);
+        buf_varint(&a->cols[COL_ECHO], (uint32_t)(f->echo_id + 1));
+
+        uint64_t payload;
+        memcpy(&payload, f->data, sizeof(payload));
+        uint64_t x = payload ^ a->prev_payload[idx];
+        a->prev_payload[idx] = payload;
+
+        candle_archive_buf_t *d = &a->cols[COL_DATA];
+        size_t mask_pos = d->len++;
+        uint8_t mask = 0;
+        for (unsigned b=0; x != 0; b++, x >>= 8) {
+            if (x & 0xFF) {
+                mask |= (uint8_t)(1 << b);
+                d->data[d->len++] = (uint8_t)x;
+            }
+        }
+        d->data[mask_pos] = mask;
+    }
+
+    a->raw.len = 0;
+    size_t total = CANDLE_ARCHIVE_COLUMNS * 10;
+    for (unsigned c=0; c<CANDLE_ARCHIVE_COLUMNS; c++) {
+        total += a->cols[c].len;
+    }
+    if (!buf_reserve(&a->raw, total)) {
+        a->last_error = CANDLE_ERR_MALLOC;
+        return false;
+    }
+    for (unsigned c=0; c<CANDLE_ARCHIVE_COLUMNS; c++) {
+        buf_varint(&a->raw, a->cols[c].len);
+    }
+    for (unsigned c=0; c<CANDLE_ARCHIVE_COLUMNS; c++) {
+        buf_put(&a->raw, a->cols[c].data, a->cols[c].len);
+    }
+
+    a->comp.len = 0;
+    if (!buf_reserve(&a->comp, candle_lz_bound(a->raw.len))) {
+        a->last_error = CANDLE_ERR_MALLOC;
+        return false;
+    }
+    a->comp.len = candle_lz_compress(a->raw.data, a->raw.len, a->comp.data, a->comp.cap);
+    return true;
+}
+
+/* room for one more index entry at a->index[a->num_entries] */
+static bool candle_archive_index_grow(candle_archive_t *a)
+{
+    if (a->num_entries == a->index_cap) {
+        uint32_t cap = a->index_cap ? 2 * a->index_cap : 256;
+        candle_archive_index_entry_t *p = (candle_archive_index_entry_t *)realloc(a->index, cap * sizeof(*p));
+        if (p == NULL) {
+            a->last_error = CANDLE_ERR_MALLOC;
+            return false;
+        }
+        a->index = p;
+        a->index_cap = cap;
+    }
+    return true;
+}
+
+static bool candle_archive_write_block(candle_archive_t *a)
+{
+    if (a->num_frames == 0) {
+        return true;
+    }
+
+    if (!candle_archive_encode_block(a) || !candle_archive_index_grow(a)) {
+        return false;
+    }
+
+    candle_archive_index_entry_t *e = &a->index[a->num_entries];
+    memset(e, 0, sizeof(*e));
+    e->offset = a->file_pos;
+    e->num_frames = a->num_frames;
+    e->min_ts = e->max_ts = a->ts[0];
+    for (uint32_t i=0; i<a->num_frames; i++) {
+        if (a->ts[i] < e->min_ts) {
+            e->min_ts = a->ts[i];
+        }
+        if (a->ts[i] > e->max_ts) {
+            e->max_ts = a->ts[i];
+        }
+        unsigned bit = candle_archive_id_bit(a->frames[i].can_id);
+        e->ids[bit / 8] |= (uint8_t)(1 << (bit % 8));
+    }
+
+    bool compressed = (a->comp.len != 0) && (a->comp.len < a->raw.len);
+    candle_archive_buf_t *payload = compressed ? &a->comp : &a->raw;
+
+    candle_archive_block_header_t bh;
+    bh.magic = CANDLE_ARCHIVE_BLOCK_MAGIC;
+    bh.num_frames = a->num_frames;
+    bh.raw_size = (uint32_t)a->raw.len;
+    bh.comp_size = (uint32_t)payload->len;
+    bh.first_ts = a->ts[0];
+    bh.last_ts = a->ts[a->num_frames - 1];
+
+    if (!candle_archive_write_all(a, &bh, sizeof(bh)) || !candle_archive_write_all(a, e, sizeof(*e))
+        || !candle_archive_write_all(a, payload->data, payload->len))
+    {
+        return false;
+    }
+
+    a->file_pos += sizeof(bh) + sizeof(*e) + payload->len;
+    a->num_entries++;
+    a->num_frames = 0;
+    return true;
+}
+
+static bool candle_archive_decode_block(candle_archive_t *a, const uint8_t *raw, size_t raw_size, uint32_t num_frames, uint64_t first_ts)
+{
+    const uint8_t *p = raw;
+    const uint8_t *end = raw + raw_size;
+    const uint8_t *col[CANDLE_ARCHIVE_COLUMNS];
+    const uint8_t *col_end[CANDLE_ARCHIVE_COLUMNS];
+    uint64_t len[CANDLE_ARCHIVE_COLUMNS];
+
+    for (unsigned c=0; c<CANDLE_ARCHIVE_COLUMNS; c++) {
+        if (!get_varint(&p, end, &len[c])) {
+            return false;
+        }
+    }
+    for (unsigned c=0; c<CANDLE_ARCHIVE_COLUMNS; c++) {
+        if (len[c] > (uint64_t)(end - p)) {
+            return false;
+        }
+        col[c] = p;
+        p += len[c];
+        col_end[c] = p;
+    }
+
+    if ((len[COL_DLC] < num_frames) || (len[COL_FLAGS] < num_frames)
+        || (len[COL_DICT] % CANDLE_ARCHIVE_DICT_ENTRY_SIZE != 0))
+    {
+        return false;
+    }
+
+    uint32_t num_ids = (uint32_t)(len[COL_DICT] / CANDLE_ARCHIVE_DICT_ENTRY_SIZE);
+    if (num_ids > CANDLE_ARCHIVE_BLOCK_FRAMES) {
+        return false;
+    }
+    memset(a->prev_payload, 0, num_ids * sizeof(uint64_t));
+
+    uint64_t ts = first_ts;
+    for (uint32_t i=0; i<num_frames; i++) {
+        candle_frame_t *f = &a->frames[i];
+        uint64_t v, idx, echo;
+
+        if (!get_varint(&col[COL_TS], col_end[COL_TS], &v)
+            || !get_varint(&col[COL_ID], col_end[COL_ID], &idx) || (idx >= num_ids)
+            || !get_varint(&col[COL_ECHO], col_end[COL_ECHO], &echo)
+            || (col[COL_DATA] >= col_end[COL_DATA]))
+        {
+            return false;
+        }
+
+        ts += (uint64_t)zigzag_decode(v);
+        a->ts[i] = ts;
+
+        const uint8_t *dict = col[COL_DICT] + idx * CANDLE_ARCHIVE_DICT_ENTRY_SIZE;
+        memcpy(&f->can_id, dict, sizeof(f->can_id));
+        f->channel = dict[4];
+        f->can_dlc = col[COL_DLC][i];
+        f->flags = col[COL_FLAGS][i];
+        f->reserved = 0;
+        f->echo_id = (uint32_t)echo - 1;
+        f->timestamp_us = (uint32_t)ts;
+
+        uint8_t mask = *col[COL_DATA]++;
+        uint64_t x = 0;
+        for (unsigned b=0; b<8; b++) {
+            if (mask & (1 << b)) {
+                if (col[COL_DATA] >= col_end[COL_DATA]) {
+                    return false;
+                }
+                x |= (uint64_t)*col[COL_DATA]++ << (8 * b);
+            }
+        }
+        uint64_t payload = a->prev_payload[idx] ^ x;
+        a->prev_payload[idx] = payload;
+        memcpy(f->data, &payload, sizeof(payload));
+    }
+
+    return true;
+}
+
+static bool candle_archive_read_block(candle_archive_t *a)
+{
+    candle_archive_block_header_t bh;
+    candle_archive_index_entry_t entry;
+    DWORD bytes_read = 0;
+
+    if (a->file_pos >= a->data_end) {
+        a->last_error = CANDLE_ERR_ARCHIVE_EOF;
+        return false;
+    }
+
+    if (!candle_archive_read_all(a, &bh, sizeof(bh), &bytes_read)) {
+        return false;
+    }
+
+    if (bytes_read == 0) {
+        a->last_error = CANDLE_ERR_ARCHIVE_EOF;
+        return false;
+    }
+
+    if ((bytes_read != sizeof(bh)) || (bh.magic != CANDLE_ARCHIVE_BLOCK_MAGIC)
+        || (bh.num_frames == 0) || (bh.num_frames > CANDLE_ARCHIVE_BLOCK_FRAMES)
+        || (bh.raw_size > CANDLE_ARCHIVE_MAX_RAW_SIZE) || (bh.comp_size > candle_lz_bound(bh.raw_size)))
+    {
+        a->last_error = CANDLE_ERR_ARCHIVE_FORMAT;
+        return false;
+    }
+
+    /* the block's own index entry, only needed when the index is rebuilt */
+    if (!candle_archive_read_all(a, &entry, sizeof(entry), &bytes_read)) {
+        return false;
+    }
+    if (bytes_read != sizeof(entry)) {
+        a->last_error = CANDLE_ERR_ARCHIVE_FORMAT;
+        return false;
+    }
+
+    a->comp.len = 0;
+    a->raw.len = 0;
+    if (!buf_reserve(&a->comp, bh.comp_size) || !buf_reserve(&a->raw, bh.raw_size)) {
+        a->last_error = CANDLE_ERR_MALLOC;
+        return false;
+    }
+
+    if (!candle_archive_read_all(a, a->comp.data, bh.comp_size, &bytes_read)) {
+        return false;
+    }
+    if (bytes_read != bh.comp_size) {
+        a->last_error = CANDLE_ERR_ARCHIVE_FORMAT;
+        return false;
+    }
+    a->file_pos += sizeof(bh) + sizeof(entry) + bh.comp_size;
+
+    const uint8_t *raw = a->comp.data;
+    if (bh.comp_size != bh.raw_size) {
+        if (!candle_lz_decompress(a->comp.data, bh.comp_size, a->raw.data, bh.raw_size)) {
+            a->last_error = CANDLE_ERR_ARCHIVE_FORMAT;
+            return false;
+        }
+        raw = a->raw.data;
+    }
+
+    if (!candle_archive_decode_block(a, raw, bh.raw_size, bh.num_frames, bh.first_ts)) {
+        a->last_error = CANDLE_ERR_ARCHIVE_FORMAT;
+        return false;
+    }
+
+    a->num_frames = bh.num_frames;
+    a->pos = 0;
+    return true;
+}
+
+static bool candle_archive_write_index(candle_archive_t *a)
+{
+    candle_archive_trailer_t trailer;
+    trailer.index_offset = a->file_pos;
+    trailer.num_entries = a->num_entries;
+    trailer.magic = CANDLE_ARCHIVE_INDEX_MAGIC;
+
+    return candle_archive_write_all(a, a->index, a->num_entries * sizeof(candle_archive_index_entry_t))
+        && candle_archive_write_all(a, &trailer, sizeof(trailer));
+}
+
+static bool candle_archive_index_ranges(candle_archive_t *a)
+{
+    a->index_max_ts = (uint64_t *)malloc((a->num_entries + 1) * sizeof(uint64_t));
+    a->index_min_ts = (uint64_t *)malloc((a->num_entries + 1) * sizeof(uint64_t));
+    if ((a->index_max_ts == NULL) || (a->index_min_ts == NULL)) {
+        return false;
+    }
+
+    uint64_t max_ts = 0;
+    for (uint32_t i=0; i<a->num_entries; i++) {
+        if (a->index[i].max_ts > max_ts) {
+            max_ts = a->index[i].max_ts;
+        }
+        a->index_max_ts[i] = max_ts;
+    }
+    uint64_t min_ts = UINT64_MAX;
+    for (uint32_t i=a->num_entries; i-- > 0; ) {
+        if (a->index[i].min_ts < min_ts) {
+            min_ts = a->index[i].min_ts;
+        }
+        a->index_min_ts[i] = min_ts;
+    }
+
+    return true;
+}
+
+/* recording was interrupted before the index was appended: collect the entries
+   stored with every block, up to the last block that was written completely */
+static bool candle_archive_rebuild_index(candle_archive_t *a, uint64_t file_size)
+{
+    uint64_t pos = sizeof(candle_archive_file_header_t);
+
+    for (;;) {
+        candle_archive_block_header_t bh;
+        DWORD bytes_read = 0;
+
+        if ((pos + sizeof(bh) + sizeof(candle_archive_index_entry_t) > file_size)
+            || !candle_archive_seek(a, pos) || !candle_archive_read_all(a, &bh, sizeof(bh), &bytes_read)
+            || (bytes_read != sizeof(bh)) || (bh.magic != CANDLE_ARCHIVE_BLOCK_MAGIC)
+            || (pos + sizeof(bh) + sizeof(candle_archive_index_entry_t) + bh.comp_size > file_size)
+            || !candle_archive_index_grow(a))
+        {
+            break;
+        }
+
+        candle_archive_index_entry_t *e = &a->index[a->num_entries];
+        if (!candle_archive_read_all(a, e, sizeof(*e), &bytes_read) || (bytes_read != sizeof(*e))
+            || (e->offset != pos) || (e->num_frames != bh.num_frames))
+        {
+            break;
+        }
+
+        a->num_entries++;
+        pos += sizeof(bh) + sizeof(*e) + bh.comp_size;
+    }
+
+    a->data_end = pos;
+    return (a->num_entries > 0) && candle_archive_index_ranges(a);
+}
+
+/* archives whose index cannot be loaded or rebuilt are still read sequentially */
+static bool candle_archive_load_index(candle_archive_t *a, uint64_t file_size)
+{
+    candle_archive_trailer_t trailer;
+    DWORD bytes_read = 0;
+
+    if ((file_size < sizeof(candle_archive_file_header_t) + sizeof(trailer))
+        || !candle_archive_seek(a, file_size - sizeof(trailer))
+        || !candle_archive_read_all(a, &trailer, sizeof(trailer), &bytes_read)
+        || (bytes_read != sizeof(trailer)) || (trailer.magic != CANDLE_ARCHIVE_INDEX_MAGIC)
+        || (trailer.index_offset + (uint64_t)trailer.num_entries * sizeof(candle_archive_index_entry_t)
+            != file_size - sizeof(trailer)))
+    {
+        return candle_archive_rebuild_index(a, file_size);
+    }
+
+    size_t size = (size_t)trailer.num_entries * sizeof(candle_archive_index_entry_t);
+    a->index = (candle_archive_index_entry_t *)malloc(size ? size : 1);
+    if (a->index == NULL) {
+        return false;
+    }
+
+    if (!candle_archive_seek(a, trailer.index_offset)
+        || !candle_archive_read_all(a, a->index, (DWORD)size, &bytes_read) || (bytes_read != size))
+    {
+        return false;
+    }
+
+    a->num_entries = trailer.num_entries;
+    a->index_cap = trailer.num_entries;
+    a->data_end = trailer.index_offset;
+
+    return candle_archive_index_ranges(a);
+}
+
+static bool candle_archive_query_match(candle_archive_t *a, const candle_frame_t *frame, uint64_t ts)
+{
+    if ((ts < a->query_from) || (ts > a->query_to)) {
+        return false;
+    }
+    if (a->query_num_ids == 0) {
+        return true;
+    }
+
+    uint32_t id = frame->can_id & CANDLE_ARCHIVE_ID_MASK;
+    uint32_t lo = 0, hi = a->query_num_ids;
+    while (lo < hi) {
+        uint32_t mid = (lo + hi) / 2;
+        if (a->query_ids[mid] < id) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return (lo < a->query_num_ids) && (a->query_ids[lo] == id);
+}
+
+static bool candle_archive_entry_match(candle_archive_t *a, candle_archive_index_entry_t *e)
+{
+    if ((e->max_ts < a->query_from) || (e->min_ts > a->query_to)) {
+        return false;
+    }
+    if (a->query_num_ids == 0) {
+        return true;
+    }
+    for (unsigned i=0; i<sizeof(e->ids); i++) {
+        if (e->ids[i] & a->query_bits[i]) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/* seek to the next block the index says may contain matching frames */
+static bool candle_archive_next_query_block(candle_archive_t *a)
+{
+    while (a->next_entry < a->num_entries) {
+        uint32_t i = a->next_entry++;
+        if (a->index_min_ts[i] > a->query_to) {
+            break; // no later block reaches into the range
+        }
+        if (candle_archive_entry_match(a, &a->index[i])) {
+            return candle_archive_seek(a, a->index[i].offset) && candle_archive_read_block(a);
+        }
+    }
+
+    a->next_entry = a->num_entries;
+    a->last_error = CANDLE_ERR_ARCHIVE_EOF;
+    return false;
+}
+
+static int candle_archive_cmp_id(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t *)a;
+    uint32_t y = *(const uint32_t *)b;
+    return (x > y) - (x < y);
+}
+
+DLL bool __stdcall candle_archive_create(candle_archive_handle *archive, const wchar_t *path)
+{
+    if (archive==NULL) {
+        return false;
+    }
+
+    candle_archive_t *a = candle_archive_alloc();
+    *archive = a;
+    if (a==NULL) {
+        return false;
+    }
+
+    a->writing = true;
+    a->dict_keys = (uint64_t *)malloc(CANDLE_ARCHIVE_DICT_SLOTS * sizeof(uint64_t));
+    a->dict_index = (uint32_t *)malloc(CANDLE_ARCHIVE_DICT_SLOTS * sizeof(uint32_t));
+    a->dict_gen = (uint32_t *)calloc(CANDLE_ARCHIVE_DICT_SLOTS, sizeof(uint32_t));
+    if ((a->dict_keys == NULL) || (a->dict_index == NULL) || (a->dict_gen == NULL)) {
+        a->last_error = CANDLE_ERR_MALLOC;
+        return false;
+    }
+
+    a->file = CreateFile(path, GENERIC_WRITE, FILE_SHARE_READ, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (a->file == INVALID_HANDLE_VALUE) {
+        a->last_error = CANDLE_ERR_CREATE_FILE;
+        return false;
+    }
+
+    /* FILETIME counts 100ns intervals since 1601 */
+    FILETIME ft;
+    GetSystemTimeAsFileTime(&ft);
+    uint64_t t = ((uint64_t)ft.dwHighDateTime << 32) | ft.dwLowDateTime;
+    a->start_time_us = (t - 116444736000000000ull) / 10;
+
+    candle_archive_file_header_t fh;
+    memset(&fh, 0, sizeof(fh));
+    memcpy(fh.magic, CANDLE_ARCHIVE_MAGIC, sizeof(fh.magic));
+    fh.version = CANDLE_ARCHIVE_VERSION;
+    fh.start_time_us = a->start_time_us;
+
+    if (!candle_archive_write_all(a, &fh, sizeof(fh))) {
+        return false;
+    }
+
+    a->file_pos = sizeof(fh);
+    a->last_error = CANDLE_ERR_OK;
+    return true;
+}
+
+DLL bool __stdcall candle_archive_write(candle_archive_handle archive, const candle_frame_t *frames, uint32_t num_frames)
+{
+    candle_archive_t *a = (candle_archive_t *)archive;
+    if ((a==NULL) || (frames==NULL) || !a->writing) {
+        return false;
+    }
+
+    for (uint32_t i=0; i<num_frames; i++) {
+        uint32_t ts = frames[i].timestamp_us;
+        if (!a->ts_valid) {
+            a->ts_ext = ts;
+            a->ts_valid = true;
+        } else {
+            a->ts_ext += (int64_t)(int32_t)(ts - (uint32_t)a->ts_ext);
+        }
+
+        a->frames[a->num_frames] = frames[i];
+        a->ts[a->num_frames] = a->ts_ext;
+        a->num_frames++;
+
+        if ((a->num_frames == CANDLE_ARCHIVE_BLOCK_FRAMES) && !candle_archive_write_block(a)) {
+            return false;
+        }
+    }
+
+    a->last_error = CANDLE_ERR_OK;
+    return true;
+}
+
+DLL bool __stdcall candle_archive_flush(candle_archive_handle archive)
+{
+    candle_archive_t *a = (candle_archive_t *)archive;
+    if ((a==NULL) || !a->writing) {
+        return false;
+    }
+
+    if (!candle_archive_write_block(a)) {
+        return false;
+    }
+
+    a->last_error = CANDLE_ERR_OK;
+    return true;
+}
+
+DLL bool __stdcall candle_archive_open(candle_archive_handle *archive, const wchar_t *path)
+{
+    if (archive==NULL) {
+        return false;
+    }
+
+    candle_archive_t *a = candle_archive_alloc();
+    *archive = a;
+    if (a==NULL) {
+        return false;
+    }
+
+    a->file = CreateFile(path, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING,
+                         FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (a->file == INVALID_HANDLE_VALUE) {
+        a->last_error = CANDLE_ERR_CREATE_FILE;
+        return false;
+    }
+
+    candle_archive_file_header_t fh;
+    DWORD bytes_read = 0;
+    if (!candle_archive_read_all(a, &fh, sizeof(fh), &bytes_read)) {
+        return false;
+    }
+
+    if ((bytes_read != sizeof(fh)) || (memcmp(fh.magic, CANDLE_ARCHIVE_MAGIC, sizeof(fh.magic)) != 0)
+        || (fh.version != CANDLE_ARCHIVE_VERSION))
+    {
+        a->last_error = CANDLE_ERR_ARCHIVE_FORMAT;
+        return false;
+    }
+
+    a->start_time_us = fh.start_time_us;
+
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(a->file, &size)) {
+        a->last_error = CANDLE_ERR_ARCHIVE_IO;
+        return false;
+    }
+
+    if (!candle_archive_load_index(a, (uint64_t)size.QuadPart)) {
+        free(a->index);
+        free(a->index_max_ts);
+        free(a->index_min_ts);
+        a->index = NULL;
+        a->index_max_ts = NULL;
+        a->index_min_ts = NULL;
+        a->num_entries = 0;
+        a->index_cap = 0;
+        if (a->data_end == 0) {
+            a->data_end = (uint64_t)size.QuadPart;
+        }
+    }
+
+    if (!candle_archive_seek(a, sizeof(fh))) {
+        return false;
+    }
+
+    a->last_error = CANDLE_ERR_OK;
+    return true;
+}
+
+DLL bool __stdcall candle_archive_read(candle_archive_handle archive, candle_frame_t *frames, uint64_t *timestamps_us, uint32_t max_frames, uint32_t *num_frames)
+{
+    candle_archive_t *a = (candle_archive_t *)archive;
+    if ((a==NULL) || (frames==NULL) || (num_frames==NULL) || a->writing) {
+        return false;
+    }
+
+    uint32_t n = 0;
+    while (n < max_frames) {
+
+        if (a->pos == a->num_frames) {
+            bool indexed = a->query && (a->index != NULL);
+            if (!(indexed ? candle_archive_next_query_block(a) : candle_archive_read_block(a))) {
+                if ((n > 0) && (a->last_error == CANDLE_ERR_ARCHIVE_EOF)) {
+                    break;
+                }
+                *num_frames = n;
+                return false;
+            }
+        }
+
+        if (a->query) {
+            for (; (a->pos < a->num_frames) && (n < max_frames); a->pos++) {
+                if (candle_archive_query_match(a, &a->frames[a->pos], a->ts[a->pos])) {
+                    frames[n] = a->frames[a->pos];
+                    if (timestamps_us != NULL) {
+                        timestamps_us[n] = a->ts[a->pos];
+                    }
+                    n++;
+                }
+            }
+            continue;
+        }
+
+        uint32_t count = a->num_frames - a->pos;
+        if (count > max_frames - n) {
+            count = max_frames - n;
+        }
+
+        memcpy(&frames[n], &a->frames[a->pos], count * sizeof(candle_frame_t));
+        if (timestamps_us != NULL) {
+            memcpy(&timestamps_us[n], &a->ts[a->pos], count * sizeof(uint64_t));
+        }
+        a->pos += count;
+        n += count;
+    }
+
+    *num_frames = n;
+    a->last_error = CANDLE_ERR_OK;
+    return true;
+}
+
+DLL bool __stdcall candle_archive_query(candle_archive_handle archive, uint64_t from_us, uint64_t to_us, const uint32_t *ids, uint32_t num_ids)
+{
+    candle_archive_t *a = (candle_archive_t *)archive;
+    if ((a==NULL) || a->writing || ((ids==NULL) && (num_ids > 0))) {
+        return false;
+    }
+
+    uint32_t *query_ids = NULL;
+    if (num_ids > 0) {
+        query_ids = (uint32_t *)malloc(num_ids * sizeof(uint32_t));
+        if (query_ids == NULL) {
+            a->last_error = CANDLE_ERR_MALLOC;
+            return false;
+        }
+    }
+
+    memset(a->query_bits, 0, sizeof(a->query_bits));
+    for (uint32_t i=0; i<num_ids; i++) {
+        query_ids[i] = ids[i] & CANDLE_ARCHIVE_ID_MASK;
+        unsigned bit = candle_archive_id_bit(query_ids[i]);
+        a->query_bits[bit / 8] |= (uint8_t)(1 << (bit % 8));
+    }
+    if (num_ids > 1) {
+        qsort(query_ids, num_ids, sizeof(uint32_t), candle_archive_cmp_id);
+    }
+
+    free(a->query_ids);
+    a->query_ids = query_ids;
+    a->query_num_ids = num_ids;
+    a->query_from = from_us;
+    a->query_to = to_us;
+    a->query = true;
+    a->pos = a->num_frames = 0;
+
+    if (a->index != NULL) {
+        /* first block whose running maximum timestamp reaches the range */
+        uint32_t lo = 0, hi = a->num_entries;
+        while (lo < hi) {
+            uint32_t mid = (lo + hi) / 2;
+            if (a->index_max_ts[mid] < from_us) {
+                lo = mid + 1;
+            } else {
+                hi = mid;
+            }
+        }
+        a->next_entry = lo;
+    } else if (!candle_archive_seek(a, sizeof(candle_archive_file_header_t))) {
+        return false;
+    }
+
+    a->last_error = CANDLE_ERR_OK;
+    return true;
+}
+
+DLL bool __stdcall candle_archive_get_time_range(candle_archive_handle archive, uint64_t *first_us, uint64_t *last_us)
+{
+    candle_archive_t *a = (candle_archive_t *)archive;
+    if ((a==NULL) || (first_us==NULL) || (last_us==NULL)) {
+        return false;
+    }
+
+    if ((a->index_min_ts == NULL) || (a->num_entries == 0)) {
+        a->last_error = CANDLE_ERR_ARCHIVE_NO_INDEX;
+        return false;
+    }
+
+    *first_us = a->index_min_ts[0];
+    *last_us = a->index_max_ts[a->num_entries - 1];
+    a->last_error = CANDLE_ERR_OK;
+    return true;
+}
+
+DLL bool __stdcall candle_archive_get_start_time(candle_archive_handle archive, uint64_t *unix_time_us)
+{
+    candle_archive_t *a = (candle_archive_t *)archive;
+    if ((a==NULL) || (unix_time_us==NULL)) {
+        return false;
+    }
+    *unix_time_us = a->start_time_us;
+    return true;
+}
+
+DLL bool __stdcall candle_archive_close(candle_archive_handle archive)
+{
+    candle_archive_t *a = (candle_archive_t *)archive;
+    if (a==NULL) {
+        return false;
+    }
+
+    bool rc = true;
+    if (a->file != INVALID_HANDLE_VALUE) {
+        if (a->writing) {
+            rc = candle_archive_write_block(a) && candle_archive_write_index(a);
+        }
+        CloseHandle(a->file);
+    }
+
+    for (unsigned c=0; c<CANDLE_ARCHIVE_COLUMNS; c++) {
+        free(a->cols[c].data);
+    }
+    free(a->raw.data);
+    free(a->comp.data);
+    free(a->frames);
+    free(a->ts);
+    free(a->prev_payload);
+    free(a->dict_keys);
+    free(a->dict_index);
+    free(a->dict_gen);
+    free(a->index);
+    free(a->index_max_ts);
+    free(a->index_min_ts);
+    free(a->query_ids);
+    free(a);
+    return rc;
+}
+
+DLL candle_err_t __stdcall candle_archive_last_error(candle_archive_handle archive)
+{
+    candle_archive_t *a = (candle_archive_t *)archive;
+    return a->last_error;
+}
@@ -0,0 +1,64 @@
+/*
+
+  Copyright (c) 2016 Hubert Denkmair <hubert@denkmair.de>
+
+  This file is part of the candle windows API.
+  
+  This library is free software: you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation, either
+  version 3 of the License, or (at your option) any later version.
+ 
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+ 
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#pragma once
+#include "candle.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef void* candle_archive_handle;
+
+/*
+ * Compressed capture files. Frames are collected into blocks; inside a block
+ * timestamps are stored as varint deltas, ids (with channel) through a block
+ * dictionary, and payloads XORed against the previous payload of the same id.
+ * Each block is then compressed with a small built-in LZ codec, so blocks can
+ * be decoded independently.
+ * Timestamps are extended to 64bit while writing; candle_archive_read returns
+ * them in timestamps_us if it is not NULL.
+ *
+ * Every block is stored with an index entry holding its time range and an
+ * id presence bitmap; on close all entries are appended once more as the
+ * index. Archives that were not closed, e.g. after a crash, get their index
+ * rebuilt from the block entries when opened. After candle_archive_query, candle_archive_read only
+ * returns frames within [from_us, to_us] (archive timestamps, see
+ * candle_archive_get_time_range) and, if num_ids > 0, with one of the given
+ * ids. Blocks the index rules out are skipped without being read.
+ */
+DLL bool __stdcall candle_archive_create(candle_archive_handle *archive, const wchar_t *path);
+DLL bool __stdcall candle_archive_write(candle_archive_handle archive, const candle_frame_t *frames, uint32_t num_frames);
+DLL bool __stdcall candle_archive_flush(candle_archive_handle archive);
+
+DLL bool __stdcall candle_archive_open(candle_archive_handle *archive, const wchar_t *path);
+DLL bool __stdcall candle_archive_read(candle_archive_handle archive, candle_frame_t *frames, uint64_t *timestamps_us, uint32_t max_frames, uint32_t *num_frames);
+DLL bool __stdcall candle_archive_query(candle_archive_handle archive, uint64_t from_us, uint64_t to_us, const uint32_t *ids, uint32_t num_ids);
+DLL bool __stdcall candle_archive_get_time_range(candle_archive_handle archive, uint64_t *first_us, uint64_t *last_us);
+
+DLL bool __stdcall candle_archive_get_start_time(candle_archive_handle archive, uint64_t *unix_time_us);
+DLL bool __stdcall candle_archive_close(candle_archive_handle archive);
+
+DLL candle_err_t __stdcall candle_archive_last_error(candle_archive_handle archive);
+
+#ifdef __cplusplus
+}
+#endif
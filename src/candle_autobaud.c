@@ -0,0 +1,266 @@
+/*
+
+  Copyright (c) 2016 Hubert Denkmair <hubert@denkmair.de>
+
+  This file is part of the candle windows API.
+  
+  This library is free software: you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation, either
+  version 3 of the License, or (at your option) any later version.
+ 
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+ 
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include "candle_autobaud.h"
+#include <stdlib.h>
+#include <string.h>
+
+#include "candle_defs.h"
+#include "candle_timing.h"
+
+#define CANDLE_AUTOBAUD_READ_TIMEOUT_MS 10
+#define CANDLE_AUTOBAUD_SETTLE_MS 5     /* frames from the previous candidate may still arrive */
+#define CANDLE_AUTOBAUD_REJECT_ERRORS 3
+#define CANDLE_AUTOBAUD_ACCEPT_FRAMES 8
+
+static const uint32_t candle_autobaud_default_bitrates[] = {
+    500000, 250000, 125000, 1000000, 100000, 800000, 83333, 50000, 20000, 10000
+};
+
+typedef struct candle_autobaud_ctx candle_autobaud_ctx_t;
+
+typedef struct {
+    candle_device_t *dev;
+    uint8_t ch;
+    bool active;
+    uint32_t candidate;
+    candle_bittiming_t timing;
+    ULONGLONG start;
+    uint32_t valid;
+    uint32_t errors;
+} candle_autobaud_slot_t;
+
+typedef struct {
+    candle_autobaud_ctx_t *ctx;
+    candle_device_t *dev;
+    HANDLE thread;
+} candle_autobaud_dev_t;
+
+struct candle_autobaud_ctx {
+    const uint32_t *bitrates;
+    uint32_t num_bitrates;
+    uint32_t dwell_ms;
+    volatile LONG next;
+    volatile bool found;
+
+    uint8_t num_slots;
+    candle_autobaud_slot_t slots[CANDLE_AUTOBAUD_MAX_CHANNELS];
+
+    CRITICAL_SECTION lock;
+    candle_autobaud_result_t best;
+};
+
+static uint8_t candle_autobaud_confidence(uint32_t valid, uint32_t errors)
+{
+    if (valid == 0) {
+        return 0;
+    }
+    /* share of valid frames, scaled down while there are only a few */
+    uint32_t seen = (valid < CANDLE_AUTOBAUD_ACCEPT_FRAMES) ? valid : CANDLE_AUTOBAUD_ACCEPT_FRAMES;
+    return (uint8_t)((100ull * valid * seen) / ((uint64_t)(valid + errors) * CANDLE_AUTOBAUD_ACCEPT_FRAMES));
+}
+
+static void candle_autobaud_finish(candle_autobaud_ctx_t *ctx, candle_autobaud_slot_t *slot)
+{
+    uint8_t confidence = candle_autobaud_confidence(slot->valid, slot->errors);
+
+    EnterCriticalSection(&ctx->lock);
+    if ((confidence > ctx->best.confidence)
+        || ((confidence == ctx->best.confidence) && (slot->valid > ctx->best.valid_frames)))
+    {
+        ctx->best.bitrate = ctx->bitrates[slot->candidate];
+        ctx->best.timing = slot->timing;
+        ctx->best.confidence = confidence;
+        ctx->best.valid_frames = slot->valid;
+        ctx->best.error_frames = slot->errors;
+    }
+    LeaveCriticalSection(&ctx->lock);
+
+    if ((slot->errors == 0) && (slot->valid >= CANDLE_AUTOBAUD_ACCEPT_FRAMES)) {
+        ctx->found = true;
+    }
+
+    candle_channel_stop(slot->dev, slot->ch);
+    slot->active = false;
+}
+
+/* puts the next untested candidate on the slot's channel; false if none is left */
+static bool candle_autobaud_next(candle_autobaud_ctx_t *ctx, candle_autobaud_slot_t *slot)
+{
+    while (!ctx->found) {
+        LONG idx = InterlockedIncrement(&ctx->next) - 1;
+        if ((uint32_t)idx >= ctx->num_bitrates) {
+            return false;
+        }
+
+        /* the device's clock may not support this bitrate; another channel may */
+        if (!candle_timing_from_bitrate(slot->dev, ctx->bitrates[idx], &slot->timing)
+            || !candle_channel_stop(slot->dev, slot->ch)
+            || !candle_channel_set_timing(slot->dev, slot->ch, &slot->timing)
+            || !candle_channel_start(slot->dev, slot->ch, CANDLE_MODE_LISTEN_ONLY))
+        {
+            continue;
+        }
+
+        slot->candidate = (uint32_t)idx;
+        slot->valid = 0;
+        slot->errors = 0;
+        slot->start = GetTickCount64();
+        slot->active = true;
+        return true;
+    }
+    return false;
+}
+
+static DWORD WINAPI candle_autobaud_worker(LPVOID param)
+{
+    candle_autobaud_dev_t *ad = (candle_autobaud_dev_t *)param;
+    candle_autobaud_ctx_t *ctx = ad->ctx;
+
+    for (unsigned i=0; i<ctx->num_slots; i++) {
+        if (ctx->slots[i].dev == ad->dev) {
+            candle_autobaud_next(ctx, &ctx->slots[i]);
+        }
+    }
+
+    for (;;) {
+        bool busy = false;
+        for (unsigned i=0; i<ctx->num_slots; i++) {
+            busy = busy || ((ctx->slots[i].dev == ad->dev) && ctx->slots[i].active);
+        }
+        if (!busy) {
+            break;
+        }
+
+        candle_frame_t frame;
+        if (candle_frame_read(ad->dev, &frame, CANDLE_AUTOBAUD_READ_TIMEOUT_MS) && (frame.echo_id == 0xFFFFFFFF)) {
+            for (unsigned i=0; i<ctx->num_slots; i++) {
+                candle_autobaud_slot_t *slot = &ctx->slots[i];
+                if ((slot->dev != ad->dev) || (slot->ch != frame.channel) || !slot->active
+                    || (GetTickCount64() - slot->start < CANDLE_AUTOBAUD_SETTLE_MS))
+                {
+                    continue;
+                }
+                if (frame.can_id & 0x20000000) {
+                    slot->errors++;
+                } else {
+                    slot->valid++;
+                }
+            }
+        }
+
+        ULONGLONG now = GetTickCount64();
+        for (unsigned i=0; i<ctx->num_slots; i++) {
+            candle_autobaud_slot_t *slot = &ctx->slots[i];
+            if ((slot->dev != ad->dev) || !slot->active) {
+                continue;
+            }
+
+            bool rejected = (slot->valid == 0) && (slot->errors >= CANDLE_AUTOBAUD_REJECT_ERRORS);
+            bool accepted = (slot->errors == 0) && (slot->valid >= CANDLE_AUTOBAUD_ACCEPT_FRAMES);
+            if (rejected || accepted || ctx->found || (now - slot->start >= ctx->dwell_ms)) {
+                candle_autobaud_finish(ctx, slot);
+                candle_autobaud_next(ctx, slot);
+            }
+        }
+    }
+
+    return 0;
+}
+
+DLL bool __stdcall candle_autobaud(const candle_autobaud_channel_t *channels, uint8_t num_channels, const uint32_t *bitrates, uint8_t num_bitrates, uint32_t dwell_ms, candle_autobaud_result_t *result)
+{
+    if ((channels == NULL) || (num_channels == 0)) {
+        return false;
+    }
+    candle_device_t *first = (candle_device_t *)channels[0].hdev;
+
+    if (num_channels > CANDLE_AUTOBAUD_MAX_CHANNELS) {
+        first->last_error = CANDLE_ERR_AUTOBAUD_CONFIG;
+        return false;
+    }
+
+    candle_autobaud_ctx_t *ctx = (candle_autobaud_ctx_t *)calloc(1, sizeof(candle_autobaud_ctx_t));
+    if (ctx == NULL) {
+        first->last_error = CANDLE_ERR_MALLOC;
+        return false;
+    }
+
+    if (bitrates == NULL) {
+        bitrates = candle_autobaud_default_bitrates;
+        num_bitrates = sizeof(candle_autobaud_default_bitrates) / sizeof(candle_autobaud_default_bitrates[0]);
+    }
+    ctx->bitrates = bitrates;
+    ctx->num_bitrates = num_bitrates;
+    ctx->dwell_ms = dwell_ms;
+    ctx->num_slots = num_channels;
+    InitializeCriticalSection(&ctx->lock);
+
+    candle_autobaud_dev_t devs[CANDLE_AUTOBAUD_MAX_CHANNELS];
+    unsigned num_devs = 0;
+    bool ok = true;
+
+    for (unsigned i=0; i<num_channels; i++) {
+        candle_device_t *dev = (candle_device_t *)channels[i].hdev;
+        ctx->slots[i].dev = dev;
+        ctx->slots[i].ch = channels[i].channel;
+        if (channels[i].channel > dev->dconf.icount) {
+            first->last_error = CANDLE_ERR_CHANNEL_OUT_OF_RANGE;
+            ok = false;
+        }
+
+        unsigned d;
+        for (d=0; (d<num_devs) && (devs[d].dev != dev); d++);
+        if (d == num_devs) {
+            devs[d].ctx = ctx;
+            devs[d].dev = dev;
+            devs[d].thread = NULL;
+            num_devs++;
+        }
+    }
+
+    /* one thread per device, as every device is read on its own */
+    for (unsigned d=0; ok && (d<num_devs); d++) {
+        devs[d].thread = CreateThread(NULL, 0, candle_autobaud_worker, &devs[d], 0, NULL);
+        if (devs[d].thread == NULL) {
+            first->last_error = CANDLE_ERR_AUTOBAUD_CONFIG;
+            ctx->found = true; /* makes the threads already started stop */
+            ok = false;
+        }
+    }
+
+    for (unsigned d=0; d<num_devs; d++) {
+        if (devs[d].thread != NULL) {
+            WaitForSingleObject(devs[d].thread, INFINITE);
+            CloseHandle(devs[d].thread);
+        }
+    }
+
+    if (ok) {
+        *result = ctx->best;
+        ok = (ctx->best.confidence > 0);
+        first->last_error = ok ? CANDLE_ERR_OK : CANDLE_ERR_AUTOBAUD_NOT_FOUND;
+    }
+
+    DeleteCriticalSection(&ctx->lock);
+    free(ctx);
+    return ok;
+}
@@ -0,0 +1,63 @@
+/*
+
+  Copyright (c) 2016 Hubert Denkmair <hubert@denkmair.de>
+
+  This file is part of the candle windows API.
+  
+  This library is free software: you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation, either
+  version 3 of the License, or (at your option) any later version.
+ 
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+ 
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#pragma once
+#include "candle.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define CANDLE_AUTOBAUD_MAX_CHANNELS 16
+
+#pragma pack(push,1)
+
+typedef struct {
+    candle_handle hdev;
+    uint8_t channel;
+} candle_autobaud_channel_t;
+
+typedef struct {
+    uint32_t bitrate;
+    candle_bittiming_t timing;
+    uint8_t confidence;     /* 0..100 */
+    uint32_t valid_frames;
+    uint32_t error_frames;
+} candle_autobaud_result_t;
+
+#pragma pack(pop)
+
+/*
+ * Finds the bitrate of a bus by listening (CANDLE_MODE_LISTEN_ONLY) with
+ * candidate bitrates. All given channels have to be connected to the same
+ * bus; each listens to a different candidate at the same time, with one
+ * thread per device. A candidate is dropped as soon as it sees error frames
+ * but no valid frame, and accepted as soon as it sees enough valid frames
+ * without errors; otherwise it is scored after dwell_ms. The whole search
+ * takes at most about ceil(num_bitrates / num_channels) * dwell_ms.
+ * bitrates may be NULL to try the common bitrates. The channels are stopped
+ * afterwards; no other thread may read from the devices meanwhile.
+ */
+DLL bool __stdcall candle_autobaud(const candle_autobaud_channel_t *channels, uint8_t num_channels, const uint32_t *bitrates, uint8_t num_bitrates, uint32_t dwell_ms, candle_autobaud_result_t *result);
+
+#ifdef __cplusplus
+}
+#endif
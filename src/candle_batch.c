@@ -0,0 +1,117 @@
+/*
+
+  Copyright (c) 2016 Hubert Denkmair <hubert@denkmair.de>
+
+  This file is part of the candle windows API.
+  
+  This library is free software: you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation, either
+  version 3 of the License, or (at your option) any later version.
+ 
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+ 
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include "candle_batch.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && (_M_IX86_FP >= 2))
+#define CANDLE_BATCH_SSE2
+#include <emmintrin.h>
+#endif
+
+DLL uint32_t __stdcall candle_batch_match_ids(const uint32_t *can_id, uint32_t num, uint32_t id, uint32_t mask, uint32_t *indices)
+{
+    uint32_t count = 0;
+    uint32_t i = 0;
+
+#ifdef CANDLE_BATCH_SSE2
+    __m128i vmask = _mm_set1_epi32((int)mask);
+    __m128i vid = _mm_set1_epi32((int)(id & mask));
+
+    for (; i + 4 <= num; i += 4) {
+        __m128i v = _mm_and_si128(_mm_loadu_si128((const __m128i *)&can_id[i]), vmask);
+        int hits = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(v, vid)));
+        while (hits != 0) {
+            unsigned bit = 0;
+            while (((hits >> bit) & 1) == 0) {
+                bit++;
+            }
+            indices[count++] = i + bit;
+            hits &= hits - 1;
+        }
+    }
+#endif
+
+    for (; i < num; i++) {
+        if (((can_id[i] ^ id) & mask) == 0) {
+            indices[count++] = i;
+        }
+    }
+
+    return count;
+}
+
+DLL void __stdcall candle_batch_timestamp_deltas(const uint32_t *timestamp_us, uint32_t num, uint32_t prev_us, uint32_t *deltas)
+{
+    if (num == 0) {
+        return;
+    }
+
+    /* unsigned subtraction handles the 32bit timestamp wrap */
+    deltas[0] = timestamp_us[0] - prev_us;
+    uint32_t i = 1;
+
+#ifdef CANDLE_BATCH_SSE2
+    for (; i + 4 <= num; i += 4) {
+        __m128i cur = _mm_loadu_si128((const __m128i *)&timestamp_us[i]);
+        __m128i prev = _mm_loadu_si128((const __m128i *)&timestamp_us[i - 1]);
+        _mm_storeu_si128((__m128i *)&deltas[i], _mm_sub_epi32(cur, prev));
+    }
+#endif
+
+    for (; i < num; i++) {
+        deltas[i] = timestamp_us[i] - timestamp_us[i - 1];
+    }
+}
+
+DLL void __stdcall candle_batch_dlc_histogram(const uint8_t *dlc, uint32_t num, uint32_t histogram[16])
+{
+    uint32_t i = 0;
+
+#ifdef CANDLE_BATCH_SSE2
+    /* 8bit counters per lane, folded into the histogram before they can overflow */
+    const __m128i nibble = _mm_set1_epi8(0x0F);
+    const __m128i zero = _mm_setzero_si128();
+
+    while (i + 16 <= num) {
+        __m128i acc[16];
+        for (unsigned v=0; v<16; v++) {
+            acc[v] = zero;
+        }
+
+        for (unsigned round=0; (round < 255) && (i + 16 <= num); round++, i += 16) {
+            __m128i d = _mm_and_si128(_mm_loadu_si128((const __m128i *)&dlc[i]), nibble);
+            for (unsigned v=0; v<16; v++) {
+                /* a match is -1, so subtracting it counts up */
+                acc[v] = _mm_sub_epi8(acc[v], _mm_cmpeq_epi8(d, _mm_set1_epi8((char)v)));
+            }
+        }
+
+        for (unsigned v=0; v<16; v++) {
+            __m128i sums = _mm_sad_epu8(acc[v], zero);
+            histogram[v] += (uint32_t)_mm_cvtsi128_si32(sums) + (uint32_t)_mm_cvtsi128_si32(_mm_srli_si128(sums, 8));
+        }
+    }
+#endif
+
+    for (; i < num; i++) {
+        histogram[dlc[i] & 0x0F]++;
+    }
+}
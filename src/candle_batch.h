@@ -0,0 +1,46 @@
+/*
+
+  Copyright (c) 2016 Hubert Denkmair <hubert@denkmair.de>
+
+  This file is part of the candle windows API.
+  
+  This library is free software: you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation, either
+  version 3 of the License, or (at your option) any later version.
+ 
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+ 
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#pragma once
+#include "candle.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Helpers for the column arrays filled by candle_frame_read_batch. They use
+ * SSE2 where the compiler targets it and plain loops otherwise; 16 byte
+ * aligned columns are faster but not required.
+ */
+
+/* stores the index of every entry with (can_id & mask) == (id & mask), returns their count */
+DLL uint32_t __stdcall candle_batch_match_ids(const uint32_t *can_id, uint32_t num, uint32_t id, uint32_t mask, uint32_t *indices);
+
+/* deltas[i] = timestamp_us[i] - timestamp_us[i-1], with prev_us standing in for timestamp_us[-1] */
+DLL void __stdcall candle_batch_timestamp_deltas(const uint32_t *timestamp_us, uint32_t num, uint32_t prev_us, uint32_t *deltas);
+
+/* adds the number of entries with each dlc value (0..15) to histogram */
+DLL void __stdcall candle_batch_dlc_histogram(const uint8_t *dlc, uint32_t num, uint32_t histogram[16]);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,245 @@
+/*
+
+  Copyright (c) 2016 Hubert Denkmair <hubert@denkmair.de>
+
+  This file is part of the candle windows API.
+  
+  This library is free software: you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation, either
+  version 3 of the License, or (at your option) any later version.
+ 
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+ 
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include "candle_cache.h"
+#include <stdlib.h>
+
+#include "candle_defs.h"
+#include "candle_rx.h"
+
+#define CANDLE_CACHE_STD_IDS 2048
+#define CANDLE_CACHE_EXT_FLAG 0x80000000
+
+typedef struct {
+    volatile LONG seq; /* odd while the entry is written */
+    volatile LONG key; /* extended table only: id | CANDLE_CACHE_EXT_FLAG, 0 = empty */
+    candle_cache_entry_t e;
+} candle_cache_slot_t;
+
+typedef struct {
+    candle_cache_slot_t std[CANDLE_CACHE_STD_IDS];
+    candle_cache_slot_t *ext;
+} candle_cache_channel_t;
+
+struct candle_cache {
+    bool changed_only;
+    uint8_t num_channels;
+    uint32_t ext_mask;
+    candle_cache_channel_t *channels;
+};
+
+static uint32_t candle_cache_hash(uint32_t key)
+{
+    return key * 2654435761u;
+}
+
+static candle_cache_slot_t *candle_cache_find(struct candle_cache *cache, uint8_t ch, uint32_t can_id, bool insert)
+{
+    candle_cache_channel_t *c = &cache->channels[ch];
+
+    if ((can_id & CANDLE_CACHE_EXT_FLAG) == 0) {
+        return &c->std[can_id & (CANDLE_CACHE_STD_IDS - 1)];
+    }
+
+    LONG key = (LONG)((can_id & 0x1FFFFFFF) | CANDLE_CACHE_EXT_FLAG);
+    uint32_t i = candle_cache_hash((uint32_t)key) & cache->ext_mask;
+
+    for (uint32_t probe=0; probe<=cache->ext_mask; probe++) {
+        candle_cache_slot_t *slot = &c->ext[i];
+        LONG slot_key = slot->key;
+        if (slot_key == key) {
+            return slot;
+        }
+        if (slot_key == 0) {
+            if (!insert) {
+                return NULL;
+            }
+            /* claim the slot; another writer may have taken it for a different id */
+            slot_key = InterlockedCompareExchange(&slot->key, key, 0);
+            if ((slot_key == 0) || (slot_key == key)) {
+                return slot;
+            }
+        }
+        i = (i + 1) & cache->ext_mask;
+    }
+
+    return NULL; // table is full
+}
+
+bool candle_cache_update(struct candle_cache *cache, const candle_frame_t *frame)
+{
+    if ((frame->echo_id != 0xFFFFFFFF) || ((frame->can_id & 0x60000000) != 0)) {
+        return true; // only received data frames are cached
+    }
+
+    if (frame->channel >= cache->num_channels) {
+        return true;
+    }
+
+    candle_cache_slot_t *slot = candle_cache_find(cache, frame->channel, frame->can_id, true);
+    if (slot == NULL) {
+        return true;
+    }
+
+    /* the odd sequence number doubles as writer lock if several threads receive */
+    LONG seq;
+    for (;;) {
+        seq = slot->seq;
+        if (((seq & 1) == 0) && (InterlockedCompareExchange(&slot->seq, seq + 1, seq) == seq)) {
+            break;
+        }
+        YieldProcessor();
+    }
+
+    candle_cache_entry_t *e = &slot->e;
+    bool changed = (e->count == 0)
+        || (e->frame.can_dlc != frame->can_dlc)
+        || (memcmp(e->frame.data, frame->data, sizeof(frame->data)) != 0);
+
+    if (e->count > 0) {
+        uint32_t delta = frame->timestamp_us - e->frame.timestamp_us;
+        e->period_us = (e->count == 1) ? delta : (uint32_t)(((uint64_t)e->period_us * 7 + delta) / 8);
+    }
+    memcpy(&e->frame, frame, sizeof(*frame));
+    e->count++;
+
+    InterlockedExchange(&slot->seq, seq + 2);
+
+    return changed || !cache->changed_only;
+}
+
+DLL bool __stdcall candle_cache_enable(candle_handle hdev, uint32_t ext_capacity, bool changed_only)
+{
+    candle_device_t *dev = (candle_device_t*)hdev;
+
+    if (dev->cache != NULL) {
+        candle_cache_disable(dev);
+    }
+
+    uint32_t ext_size = 16;
+    while ((ext_size < ext_capacity) && (ext_size < 0x80000000)) {
+        ext_size *= 2;
+    }
+
+    struct candle_cache *cache = (struct candle_cache *)calloc(1, sizeof(struct candle_cache));
+    if (cache == NULL) {
+        dev->last_error = CANDLE_ERR_MALLOC;
+        return false;
+    }
+
+    cache->changed_only = changed_only;
+    cache->num_channels = dev->dconf.icount + 1;
+    cache->ext_mask = ext_size - 1;
+    cache->channels = (candle_cache_channel_t *)calloc(cache->num_channels, sizeof(candle_cache_channel_t));
+    if (cache->channels == NULL) {
+        free(cache);
+        dev->last_error = CANDLE_ERR_MALLOC;
+        return false;
+    }
+
+    for (unsigned ch=0; ch<cache->num_channels; ch++) {
+        cache->channels[ch].ext = (candle_cache_slot_t *)calloc(ext_size, sizeof(candle_cache_slot_t));
+        if (cache->channels[ch].ext == NULL) {
+            dev->cache = cache;
+            candle_cache_disable(dev);
+            dev->last_error = CANDLE_ERR_MALLOC;
+            return false;
+        }
+    }
+
+    dev->cache = cache;
+    dev->last_error = CANDLE_ERR_OK;
+    return true;
+}
+
+DLL bool __stdcall candle_cache_set_changed_only(candle_handle hdev, bool changed_only)
+{
+    candle_device_t *dev = (candle_device_t*)hdev;
+
+    if (dev->cache == NULL) {
+        dev->last_error = CANDLE_ERR_CACHE_DISABLED;
+        return false;
+    }
+
+    dev->cache->changed_only = changed_only;
+    dev->last_error = CANDLE_ERR_OK;
+    return true;
+}
+
+DLL bool __stdcall candle_cache_get(candle_handle hdev, uint8_t ch, uint32_t can_id, candle_cache_entry_t *entry)
+{
+    candle_device_t *dev = (candle_device_t*)hdev;
+    struct candle_cache *cache = dev->cache;
+
+    if (cache == NULL) {
+        dev->last_error = CANDLE_ERR_CACHE_DISABLED;
+        return false;
+    }
+
+    if (ch >= cache->num_channels) {
+        dev->last_error = CANDLE_ERR_CHANNEL_OUT_OF_RANGE;
+        return false;
+    }
+
+    candle_cache_slot_t *slot = candle_cache_find(cache, ch, can_id, false);
+    if (slot == NULL) {
+        dev->last_error = CANDLE_ERR_CACHE_NOT_FOUND;
+        return false;
+    }
+
+    LONG seq;
+    do {
+        seq = slot->seq;
+        if (seq & 1) {
+            YieldProcessor();
+            continue;
+        }
+        MemoryBarrier();
+        memcpy(entry, &slot->e, sizeof(*entry));
+        MemoryBarrier();
+    } while ((seq & 1) || (slot->seq != seq));
+
+    if (entry->count == 0) {
+        dev->last_error = CANDLE_ERR_CACHE_NOT_FOUND;
+        return false;
+    }
+
+    dev->last_error = CANDLE_ERR_OK;
+    return true;
+}
+
+DLL bool __stdcall candle_cache_disable(candle_handle hdev)
+{
+    candle_device_t *dev = (candle_device_t*)hdev;
+    struct candle_cache *cache = dev->cache;
+
+    dev->cache = NULL;
+    if (cache != NULL) {
+        for (unsigned ch=0; ch<cache->num_channels; ch++) {
+            free(cache->channels[ch].ext);
+        }
+        free(cache->channels);
+        free(cache);
+    }
+
+    dev->last_error = CANDLE_ERR_OK;
+    return true;
+}
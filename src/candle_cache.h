@@ -0,0 +1,56 @@
+/*
+
+  Copyright (c) 2016 Hubert Denkmair <hubert@denkmair.de>
+
+  This file is part of the candle windows API.
+  
+  This library is free software: you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation, either
+  version 3 of the License, or (at your option) any later version.
+ 
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+ 
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#pragma once
+#include "candle.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#pragma pack(push,1)
+
+typedef struct {
+    candle_frame_t frame;  /* last received frame, includes its timestamp */
+    uint32_t count;        /* frames received with this id */
+    uint32_t period_us;    /* smoothed interval between frames, 0 until the second frame */
+} candle_cache_entry_t;
+
+#pragma pack(pop)
+
+/*
+ * Keeps the latest frame of every CAN id per channel, updated on the receive
+ * path. Standard ids are stored in a direct indexed array, extended ids in an
+ * open addressing table with ext_capacity slots per channel (rounded up to a
+ * power of two). candle_cache_get returns a consistent snapshot even while
+ * the receiving thread updates the entry.
+ * With changed_only set, candle_frame_read only returns received frames whose
+ * payload differs from the cached one.
+ * Enable and disable the cache while no thread is reading from the device.
+ */
+DLL bool __stdcall candle_cache_enable(candle_handle hdev, uint32_t ext_capacity, bool changed_only);
+DLL bool __stdcall candle_cache_set_changed_only(candle_handle hdev, bool changed_only);
+DLL bool __stdcall candle_cache_get(candle_handle hdev, uint8_t ch, uint32_t can_id, candle_cache_entry_t *entry);
+DLL bool __stdcall candle_cache_disable(candle_handle hdev);
+
+#ifdef __cplusplus
+}
+#endif
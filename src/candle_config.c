@@ -0,0 +1,195 @@
+/*
+
+  Copyright (c) 2016 Hubert Denkmair <hubert@denkmair.de>
+
+  This file is part of the candle windows API.
+  
+  This library is free software: you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation, either
+  version 3 of the License, or (at your option) any later version.
+ 
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+ 
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include <string.h>
+
+#include "candle_defs.h"
+#include "candle_ctrl_req.h"
+#include "candle_timing.h"
+#include "candle_rx.h"
+
+static bool candle_config_wait(candle_device_t *dev, candle_ctrl_async_t *req, bool *pending, bool *failed, uint8_t num_channels, candle_err_t *err)
+{
+    bool ok = true;
+
+    for (uint8_t ch=0; ch<num_channels; ch++) {
+        if (!pending[ch]) {
+            continue;
+        }
+        pending[ch] = false;
+        if (!candle_ctrl_wait(dev, &req[ch])) {
+            failed[ch] = true;
+            if (ok) {
+                *err = dev->last_error;
+            }
+            ok = false;
+        }
+    }
+
+    return ok;
+}
+
+static void candle_config_set_filters(candle_channel_state_t *st, const candle_channel_config_t *cfg)
+{
+    InterlockedIncrement(&st->filter_seq);
+    memcpy(st->filters, cfg->filters, cfg->num_filters * sizeof(candle_filter_t));
+    st->num_filters = cfg->num_filters;
+    InterlockedIncrement(&st->filter_seq);
+}
+
+bool candle_config_filter(candle_device_t *dev, const candle_frame_t *frame)
+{
+    if ((frame->echo_id != 0xFFFFFFFF) || (frame->can_id & 0x20000000) || (frame->channel >= CANDLE_MAX_CHANNELS)) {
+        return true;
+    }
+
+    candle_channel_state_t *st = &dev->channels[frame->channel];
+    for (;;) {
+        LONG seq = st->filter_seq;
+        if (seq & 1) {
+            YieldProcessor();
+            continue;
+        }
+        MemoryBarrier();
+
+        bool accept = (st->num_filters == 0);
+        for (uint8_t i=0; !accept && (i<st->num_filters); i++) {
+            accept = ((frame->can_id ^ st->filters[i].can_id) & st->filters[i].mask) == 0;
+        }
+
+        MemoryBarrier();
+        if (st->filter_seq == seq) {
+            return accept;
+        }
+    }
+}
+
+DLL bool __stdcall candle_dev_configure(candle_handle hdev, const candle_channel_config_t *channels, uint8_t num_channels)
+{
+    candle_device_t *dev = (candle_device_t*)hdev;
+    candle_bittiming_t timing[CANDLE_MAX_CHANNELS];
+    candle_ctrl_async_t req[CANDLE_MAX_CHANNELS];
+    bool pending[CANDLE_MAX_CHANNELS] = { false };
+    bool failed[CANDLE_MAX_CHANNELS] = { false };
+    bool stopping[CANDLE_MAX_CHANNELS] = { false };
+    bool retiming[CANDLE_MAX_CHANNELS] = { false };
+    candle_err_t err = CANDLE_ERR_OK;
+
+    if ((num_channels > dev->dconf.icount + 1) || (num_channels > CANDLE_MAX_CHANNELS)) {
+        dev->last_error = CANDLE_ERR_CHANNEL_OUT_OF_RANGE;
+        return false;
+    }
+
+    for (uint8_t ch=0; ch<num_channels; ch++) {
+        if (channels[ch].num_filters > CANDLE_MAX_FILTERS) {
+            dev->last_error = CANDLE_ERR_CONFIG_INVALID;
+            return false;
+        }
+        if (channels[ch].bitrate != 0) {
+            if (!candle_timing_from_bitrate(dev, channels[ch].bitrate, &timing[ch])) {
+                return false;
+            }
+        } else {
+            timing[ch] = channels[ch].timing;
+        }
+    }
+
+    /*
+     * Requests for different channels do not depend on each other, so each
+     * phase is submitted for all channels at once and then collected:
+     * stop what has to change, set bit timing, start.
+     */
+
+    for (uint8_t ch=0; ch<num_channels; ch++) {
+        candle_channel_state_t *st = &dev->channels[ch];
+        const candle_channel_config_t *cfg = &channels[ch];
+
+        retiming[ch] = !st->timing_valid || (memcmp(&st->timing, &timing[ch], sizeof(candle_bittiming_t)) != 0);
+        stopping[ch] = !st->mode_valid
+                    || (st->started && (!cfg->enabled || retiming[ch] || (st->flags != cfg->flags)));
+
+        if (stopping[ch]) {
+            pending[ch] = candle_ctrl_set_device_mode_async(dev, ch, CANDLE_DEVMODE_RESET, 0, &req[ch]);
+            if (!pending[ch]) {
+                failed[ch] = true;
+                err = (err == CANDLE_ERR_OK) ? dev->last_error : err;
+            }
+        }
+    }
+    candle_config_wait(dev, req, pending, failed, num_channels, &err);
+
+    for (uint8_t ch=0; ch<num_channels; ch++) {
+        candle_channel_state_t *st = &dev->channels[ch];
+        if (failed[ch]) {
+            st->mode_valid = false;
+            continue;
+        }
+        if (stopping[ch]) {
+            st->mode_valid = true;
+            st->started = false;
+        }
+
+        if (retiming[ch]) {
+            st->timing_valid = false;
+            pending[ch] = candle_ctrl_set_bittiming_async(dev, ch, &timing[ch], &req[ch]);
+            if (!pending[ch]) {
+                failed[ch] = true;
+                err = (err == CANDLE_ERR_OK) ? dev->last_error : err;
+            }
+        }
+    }
+    candle_config_wait(dev, req, pending, failed, num_channels, &err);
+
+    for (uint8_t ch=0; ch<num_channels; ch++) {
+        candle_channel_state_t *st = &dev->channels[ch];
+        if (failed[ch]) {
+            continue;
+        }
+        if (retiming[ch]) {
+            st->timing = timing[ch];
+            st->timing_valid = true;
+        }
+
+        if (channels[ch].enabled && !st->started) {
+            pending[ch] = candle_ctrl_set_device_mode_async(dev, ch, CANDLE_DEVMODE_START, channels[ch].flags, &req[ch]);
+            if (!pending[ch]) {
+                failed[ch] = true;
+                err = (err == CANDLE_ERR_OK) ? dev->last_error : err;
+            }
+        }
+    }
+    candle_config_wait(dev, req, pending, failed, num_channels, &err);
+
+    for (uint8_t ch=0; ch<num_channels; ch++) {
+        candle_channel_state_t *st = &dev->channels[ch];
+        if (failed[ch]) {
+            st->mode_valid = false;
+        } else if (channels[ch].enabled && !st->started) {
+            st->started = true;
+            st->flags = channels[ch].flags;
+        }
+
+        candle_config_set_filters(st, &channels[ch]);
+    }
+
+    dev->last_error = err;
+    return err == CANDLE_ERR_OK;
+}
@@ -49,6 +49,48 @@ static bool usb_control_msg(WINUSB_INTERFACE_HANDLE hnd, uint8_t request, uint8_
     return WinUsb_ControlTransfer(hnd, packet, (uint8_t*)data, size, &bytes_sent, 0);
 }
 
+static bool usb_control_msg_async(WINUSB_INTERFACE_HANDLE hnd, uint8_t request, uint8_t requesttype, uint16_t value, uint16_t index, const void *data, uint16_t size, candle_ctrl_async_t *req)
+{
+    WINUSB_SETUP_PACKET packet;
+    memset(&packet, 0, sizeof(packet));
+
+    packet.Request = request;
+    packet.RequestType = requesttype;
+    packet.Value = value;
+    packet.Index = index;
+    packet.Length = size;
+
+    /* the buffer has to stay valid until the transfer completes */
+    memcpy(req->data, data, size);
+    memset(&req->ovl, 0, sizeof(req->ovl));
+
+    HANDLE ev = CreateEvent(NULL, true, false, NULL);
+    if (ev == NULL) {
+        return false;
+    }
+    /* the low bit keeps the completion away from a reactor's completion port */
+    req->ovl.hEvent = (HANDLE)((ULONG_PTR)ev | 1);
+
+    if (!WinUsb_ControlTransfer(hnd, packet, req->data, size, NULL, &req->ovl) && (GetLastError() != ERROR_IO_PENDING)) {
+        CloseHandle(ev);
+        req->ovl.hEvent = NULL;
+        return false;
+    }
+    return true;
+}
+
+bool candle_ctrl_wait(candle_device_t *dev, candle_ctrl_async_t *req)
+{
+    DWORD bytes_sent;
+    bool rc = WinUsb_GetOverlappedResult(dev->winUSBHandle, &req->ovl, &bytes_sent, true);
+
+    CloseHandle((HANDLE)((ULONG_PTR)req->ovl.hEvent & ~(ULONG_PTR)1));
+    req->ovl.hEvent = NULL;
+
+    dev->last_error = rc ? CANDLE_ERR_OK : req->err;
+    return rc;
+}
+
 bool candle_ctrl_set_host_format(candle_device_t *dev)
 {
     candle_host_config_t hconf;
@@ -106,6 +148,28 @@ bool candle_ctrl_set_device_mode(candle_device_t *dev, uint8_t channel, uint32_t
     return rc;
 }
 
+bool candle_ctrl_set_device_mode_async(candle_device_t *dev, uint8_t channel, uint32_t mode, uint32_t flags, candle_ctrl_async_t *req)
+{
+    candle_device_mode_t dm;
+    dm.mode = mode;
+    dm.flags = flags;
+
+    req->err = CANDLE_ERR_SET_DEVICE_MODE;
+    bool rc = usb_control_msg_async(
+        dev->winUSBHandle,
+        CANDLE_BREQ_MODE,
+        USB_DIR_OUT|USB_TYPE_VENDOR|USB_RECIP_INTERFACE,
+        channel,
+        dev->interfaceNumber,
+        &dm,
+        sizeof(dm),
+        req
+    );
+
+    dev->last_error = rc ? CANDLE_ERR_OK : req->err;
+    return rc;
+}
+
 
 bool candle_ctrl_get_config(candle_device_t *dev, candle_device_config_t *dconf)
 {
@@ -170,3 +234,21 @@ bool candle_ctrl_set_bittiming(candle_device_t *dev, uint8_t channel, candle_bit
     dev->last_error = rc ? CANDLE_ERR_OK : CANDLE_ERR_SET_BITTIMING;
     return rc;
 }
+
+bool candle_ctrl_set_bittiming_async(candle_device_t *dev, uint8_t channel, const candle_bittiming_t *data, candle_ctrl_async_t *req)
+{
+    req->err = CANDLE_ERR_SET_BITTIMING;
+    bool rc = usb_control_msg_async(
+        dev->winUSBHandle,
+        CANDLE_BREQ_BITTIMING,
+        USB_DIR_OUT|USB_TYPE_VENDOR|USB_RECIP_INTERFACE,
+        channel,
+        0,
+        data,
+        sizeof(*data),
+        req
+    );
+
+    dev->last_error = rc ? CANDLE_ERR_OK : req->err;
+    return rc;
+}
@@ -23,6 +23,12 @@
 
 #include "candle_defs.h"
 
+typedef struct {
+    OVERLAPPED ovl;
+    uint8_t data[sizeof(candle_bittiming_t)];
+    candle_err_t err;
+} candle_ctrl_async_t;
+
 enum {
     CANDLE_DEVMODE_RESET = 0,
     CANDLE_DEVMODE_START = 1
@@ -36,3 +42,8 @@ bool candle_ctrl_get_capability(candle_device_t *dev, uint8_t channel, candle_ca
 bool candle_ctrl_set_bittiming(candle_device_t *dev, uint8_t channel, candle_bittiming_t *data);
 bool candle_ctrl_get_timestamp(candle_device_t *dev, uint32_t *current_timestamp);
 
+/* overlapped variants; every submitted request has to be completed with candle_ctrl_wait */
+bool candle_ctrl_set_device_mode_async(candle_device_t *dev, uint8_t channel, uint32_t mode, uint32_t flags, candle_ctrl_async_t *req);
+bool candle_ctrl_set_bittiming_async(candle_device_t *dev, uint8_t channel, const candle_bittiming_t *data, candle_ctrl_async_t *req);
+bool candle_ctrl_wait(candle_device_t *dev, candle_ctrl_async_t *req);
+
@@ -0,0 +1,778 @@
+/*
+
+  Copyright (c) 2016 Hubert Denkmair <hubert@denkmair.de>
+
+  This file is part of the candle windows API.
+  
+  This library is free software: you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation, either
+  version 3 of the License, or (at your option) any later version.
+ 
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+ 
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include "candle_dbc.h"
+#include <stdlib.h>
+#include <string.h>
+#include <windows.h>
+
+/* messages seen at least this often in a batch are decoded column by column */
+#define CANDLE_DBC_VECTOR_MIN 8
+#define CANDLE_DBC_KEY_MASK 0x9FFFFFFF /* id and extended flag, without rtr/err flags */
+
+typedef struct {
+    candle_dbc_signal_info_t info;
+    uint8_t shift;
+    uint8_t dlc;   /* bytes the frame needs to carry the signal */
+    uint64_t mask;
+} candle_dbc_signal_t;
+
+typedef struct {
+    uint32_t key;
+    uint32_t first_signal;
+    uint32_t num_signals;
+    int32_t mux_signal; /* -1 if the message is not multiplexed */
+    bool has_motorola;
+} candle_dbc_msg_t;
+
+typedef struct {
+    candle_err_t last_error;
+
+    candle_dbc_msg_t *msgs;
+    uint32_t num_msgs;
+    candle_dbc_signal_t *signals;
+    uint32_t num_signals;
+
+    uint32_t *table; /* open addressing, msg index + 1, 0 = empty */
+    uint32_t table_mask;
+} candle_dbc_t;
+
+typedef struct {
+    const char *p;
+    const char *end;
+} candle_dbc_parser_t;
+
+static void parser_skip_ws(candle_dbc_parser_t *ps)
+{
+    while ((ps->p < ps->end) && ((*ps->p == ' ') || (*ps->p == '\t'))) {
+        ps->p++;
+    }
+}
+
+static bool parser_expect(candle_dbc_parser_t *ps, char c)
+{
+    parser_skip_ws(ps);
+    if ((ps->p < ps->end) && (*ps->p == c)) {
+        ps->p++;
+        return true;
+    }
+    return false;
+}
+
+static bool parser_token(candle_dbc_parser_t *ps, char *buf, size_t size)
+{
+    parser_skip_ws(ps);
+    size_t n = 0;
+    while ((ps->p < ps->end) && (*ps->p != ' ') && (*ps->p != '\t') && (*ps->p != ':')
+           && (*ps->p != ';') && (*ps->p != '\r') && (*ps->p != '\n'))
+    {
+        if (n + 1 < size) {
+            buf[n++] = *ps->p;
+        }
+        ps->p++;
+    }
+    buf[n] = 0;
+    return n > 0;
+}
+
+static bool parser_number(candle_dbc_parser_t *ps, double *value)
+{
+    char buf[64];
+    size_t n = 0;
+    parser_skip_ws(ps);
+    while ((ps->p < ps->end) && (n + 1 < sizeof(buf)) && strchr("0123456789+-.eE", *ps->p)) {
+        buf[n++] = *ps->p++;
+    }
+    buf[n] = 0;
+    if (n == 0) {
+        return false;
+    }
+    *value = strtod(buf, NULL);
+    return true;
+}
+
+static bool parser_uint(candle_dbc_parser_t *ps, uint32_t *value)
+{
+    double d;
+    if (!parser_number(ps, &d) || (d < 0)) {
+        return false;
+    }
+    *value = (uint32_t)d;
+    return true;
+}
+
+static void parser_next_line(candle_dbc_parser_t *ps)
+{
+    while ((ps->p < ps->end) && (*ps->p != '\n')) {
+        ps->p++;
+    }
+    if (ps->p < ps->end) {
+        ps->p++;
+    }
+}
+
+static bool parser_keyword(candle_dbc_parser_t *ps, const char *kw)
+{
+    size_t len = strlen(kw);
+    if (((size_t)(ps->end - ps->p) > len) && (memcmp(ps->p, kw, len) == 0)
+        && ((ps->p[len] == ' ') || (ps->p[len] == '\t')))
+    {
+        ps->p += len;
+        return true;
+    }
+    return false;
+}
+
+static bool candle_dbc_grow(void **array, uint32_t count, size_t elem_size)
+{
+    /* grow in powers of two */
+    if ((count & (count - 1)) != 0) {
+        return true;
+    }
+    uint32_t capacity = count ? 2 * count : 16;
+    void *p = realloc(*array, capacity * elem_size);
+    if (p == NULL) {
+        return false;
+    }
+    *array = p;
+    return true;
+}
+
+/* SG_ name [M|mN] : start|len@order sign (factor,offset) [min|max] "unit" receivers */
+static bool candle_dbc_parse_signal(candle_dbc_parser_t *ps, candle_dbc_signal_info_t *info)
+{
+    char mux[16];
+    uint32_t start, length;
+    int order;
+
+    memset(info, 0, sizeof(*info));
+    info->mux_value = -1;
+
+    if (!parser_token(ps, info->name, sizeof(info->name))) {
+        return false;
+    }
+
+    if (parser_token(ps, mux, sizeof(mux))) {
+        if (strcmp(mux, "M") == 0) {
+            info->is_multiplexor = 1;
+        } else if (mux[0] == 'm') {
+            info->mux_value = (int16_t)strtol(mux + 1, NULL, 10);
+        } else {
+            return false;
+        }
+    }
+
+    if (!parser_expect(ps, ':') || !parser_uint(ps, &start) || !parser_expect(ps, '|')
+        || !parser_uint(ps, &length) || !parser_expect(ps, '@'))
+    {
+        return false;
+    }
+
+    /* order and sign are written without separator, e.g. "1+" */
+    if ((ps->p >= ps->end) || ((*ps->p != '0') && (*ps->p != '1'))) {
+        return false;
+    }
+    order = *ps->p++ - '0';
+    if ((ps->p >= ps->end) || ((*ps->p != '+') && (*ps->p != '-'))) {
+        return false;
+    }
+    info->type = (*ps->p++ == '-') ? CANDLE_DBC_TYPE_SIGNED : CANDLE_DBC_TYPE_UNSIGNED;
+
+    if (!parser_expect(ps, '(') || !parser_number(ps, &info->factor) || !parser_expect(ps, ',')
+        || !parser_number(ps, &info->offset) || !parser_expect(ps, ')')
+        || !parser_expect(ps, '[') || !parser_number(ps, &info->min) || !parser_expect(ps, '|')
+        || !parser_number(ps, &info->max) || !parser_expect(ps, ']'))
+    {
+        return false;
+    }
+
+    if (parser_expect(ps, '"')) {
+        size_t n = 0;
+        while ((ps->p < ps->end) && (*ps->p != '"') && (*ps->p != '\n')) {
+            if (n + 1 < sizeof(info->unit)) {
+                info->unit[n++] = *ps->p;
+            }
+            ps->p++;
+        }
+        info->unit[n] = 0;
+    }
+
+    if ((start > 63) || (length < 1) || (length > 64)) {
+        return false;
+    }
+
+    info->start_bit = (uint8_t)start;
+    info->length = (uint8_t)length;
+    info->motorola = (order == 0) ? 1 : 0;
+    return true;
+}
+
+static bool candle_dbc_compile_signal(candle_dbc_signal_t *s)
+{
+    unsigned len = s->info.length;
+    int shift;
+
+    if (s->info.motorola) {
+        /* DBC numbers motorola start bits as the msb in byte order; on the
+           byte swapped payload this becomes a plain shift from the lsb */
+        unsigned start = s->info.start_bit;
+        int msb = (7 - (int)(start / 8)) * 8 + (int)(start % 8);
+        shift = msb - (int)len + 1;
+    } else {
+        shift = s->info.start_bit;
+        if (shift + len > 64) {
+            return false;
+        }
+    }
+
+    if (shift < 0) {
+        return false;
+    }
+
+    if ((s->info.type == CANDLE_DBC_TYPE_FLOAT) && (len != 32)) {
+        return false;
+    }
+    if ((s->info.type == CANDLE_DBC_TYPE_DOUBLE) && (len != 64)) {
+        return false;
+    }
+
+    s->shift = (uint8_t)shift;
+    s->mask = (len == 64) ? ~(uint64_t)0 : (((uint64_t)1 << len) - 1);
+    /* bit b of the byte swapped payload is in byte 7 - b/8 of the frame */
+    s->dlc = s->info.motorola ? (uint8_t)(8 - shift / 8) : (uint8_t)((shift + len - 1) / 8 + 1);
+    return true;
+}
+
+static uint32_t candle_dbc_hash(uint32_t key)
+{
+    return key * 2654435761u;
+}
+
+static candle_dbc_msg_t *candle_dbc_lookup(candle_dbc_t *d, uint32_t key)
+{
+    uint32_t i = candle_dbc_hash(key) & d->table_mask;
+    for (;;) {
+        uint32_t slot = d->table[i];
+        if (slot == 0) {
+            return NULL;
+        }
+        if (d->msgs[slot - 1].key == key) {
+            return &d->msgs[slot - 1];
+        }
+        i = (i + 1) & d->table_mask;
+    }
+}
+
+static bool candle_dbc_compile(candle_dbc_t *d)
+{
+    uint32_t size = 16;
+    while (size < 2 * d->num_msgs) {
+        size *= 2;
+    }
+
+    d->table = (uint32_t *)calloc(size, sizeof(uint32_t));
+    if (d->table == NULL) {
+        d->last_error = CANDLE_ERR_MALLOC;
+        return false;
+    }
+    d->table_mask = size - 1;
+
+    for (uint32_t m=0; m<d->num_msgs; m++) {
+        candle_dbc_msg_t *msg = &d->msgs[m];
+        msg->mux_signal = -1;
+        msg->has_motorola = false;
+
+        for (uint32_t i=0; i<msg->num_signals; i++) {
+            candle_dbc_signal_t *s = &d->signals[msg->first_signal + i];
+            if (!candle_dbc_compile_signal(s)) {
+                d->last_error = CANDLE_ERR_DBC_PARSE;
+                return false;
+            }
+            if (s->info.is_multiplexor) {
+                msg->mux_signal = (int32_t)(msg->first_signal + i);
+            }
+            if (s->info.motorola) {
+                msg->has_motorola = true;
+            }
+        }
+
+        if (candle_dbc_lookup(d, msg->key) != NULL) {
+            continue; // duplicate message, first one wins
+        }
+
+        uint32_t h = candle_dbc_hash(msg->key) & d->table_mask;
+        while (d->table[h] != 0) {
+            h = (h + 1) & d->table_mask;
+        }
+        d->table[h] = m + 1;
+    }
+
+    return true;
+}
+
+static candle_dbc_signal_t *candle_dbc_find(candle_dbc_t *d, uint32_t msg_id, const char *name)
+{
+    for (uint32_t m=0; m<d->num_msgs; m++) {
+        if (d->msgs[m].key != (msg_id & CANDLE_DBC_KEY_MASK)) {
+            continue;
+        }
+        for (uint32_t i=0; i<d->msgs[m].num_signals; i++) {
+            candle_dbc_signal_t *s = &d->signals[d->msgs[m].first_signal + i];
+            if (strcmp(s->info.name, name) == 0) {
+                return s;
+            }
+        }
+    }
+    return NULL;
+}
+
+static bool candle_dbc_parse(candle_dbc_t *d, const char *text, size_t len)
+{
+    candle_dbc_parser_t ps = { text, text + len };
+    candle_dbc_msg_t *msg = NULL;
+
+    while (ps.p < ps.end) {
+
+        parser_skip_ws(&ps);
+
+        if (parser_keyword(&ps, "BO_")) {
+            uint32_t id, dlc;
+            char name[64];
+            if (!parser_uint(&ps, &id) || !parser_token(&ps, name, sizeof(name))
+                || !parser_expect(&ps, ':') || !parser_uint(&ps, &dlc))
+            {
+                d->last_error = CANDLE_ERR_DBC_PARSE;
+                return false;
+            }
+            if (!candle_dbc_grow((void **)&d->msgs, d->num_msgs, sizeof(candle_dbc_msg_t))) {
+                d->last_error = CANDLE_ERR_MALLOC;
+                return false;
+            }
+            msg = &d->msgs[d->num_msgs++];
+            memset(msg, 0, sizeof(*msg));
+            msg->key = id & CANDLE_DBC_KEY_MASK;
+            msg->first_signal = d->num_signals;
+
+        } else if (parser_keyword(&ps, "SG_")) {
+            if (msg == NULL) {
+                d->last_error = CANDLE_ERR_DBC_PARSE;
+                return false;
+            }
+            if (!candle_dbc_grow((void **)&d->signals, d->num_signals, sizeof(candle_dbc_signal_t))) {
+                d->last_error = CANDLE_ERR_MALLOC;
+                return false;
+            }
+            candle_dbc_signal_t *s = &d->signals[d->num_signals];
+            memset(s, 0, sizeof(*s));
+            if (!candle_dbc_parse_signal(&ps, &s->info)) {
+                d->last_error = CANDLE_ERR_DBC_PARSE;
+                return false;
+            }
+            s->info.msg_id = msg->key;
+            d->num_signals++;
+            msg->num_signals++;
+
+        } else if (parser_keyword(&ps, "SIG_VALTYPE_")) {
+            uint32_t id, type;
+            char name[64];
+            if (parser_uint(&ps, &id) && parser_token(&ps, name, sizeof(name))
+                && parser_expect(&ps, ':') && parser_uint(&ps, &type))
+            {
+                candle_dbc_signal_t *s = candle_dbc_find(d, id, name);
+                if ((s != NULL) && (type == 1)) {
+                    s->info.type = CANDLE_DBC_TYPE_FLOAT;
+                } else if ((s != NULL) && (type == 2)) {
+                    s->info.type = CANDLE_DBC_TYPE_DOUBLE;
+                }
+            }
+
+        } else if ((ps.p < ps.end) && (*ps.p != '\r') && (*ps.p != '\n')) {
+            msg = NULL; // any other section ends the signal list of a message
+        }
+
+        parser_next_line(&ps);
+    }
+
+    return candle_dbc_compile(d);
+}
+
+static inline uint64_t candle_dbc_bswap64(uint64_t v)
+{
+    v = ((v & 0x00FF00FF00FF00FFull) << 8) | ((v >> 8) & 0x00FF00FF00FF00FFull);
+    v = ((v & 0x0000FFFF0000FFFFull) << 16) | ((v >> 16) & 0x0000FFFF0000FFFFull);
+    return (v << 32) | (v >> 32);
+}
+
+static inline uint64_t candle_dbc_payload(const candle_frame_t *frame)
+{
+    uint64_t v;
+    memcpy(&v, frame->data, sizeof(v));
+    return v;
+}
+
+static inline int64_t candle_dbc_raw(const candle_dbc_signal_t *s, uint64_t le, uint64_t be)
+{
+    uint64_t raw = ((s->info.motorola ? be : le) >> s->shift) & s->mask;
+    if ((s->info.type == CANDLE_DBC_TYPE_SIGNED) && (s->info.length < 64)) {
+        unsigned unused = 64 - s->info.length;
+        return (int64_t)(raw << unused) >> unused;
+    }
+    return (int64_t)raw;
+}
+
+static inline double candle_dbc_physical(const candle_dbc_signal_t *s, int64_t raw)
+{
+    switch (s->info.type) {
+        case CANDLE_DBC_TYPE_FLOAT: {
+            uint32_t bits = (uint32_t)raw;
+            float f;
+            memcpy(&f, &bits, sizeof(f));
+            return f * s->info.factor + s->info.offset;
+        }
+        case CANDLE_DBC_TYPE_DOUBLE: {
+            double v;
+            memcpy(&v, &raw, sizeof(v));
+            return v * s->info.factor + s->info.offset;
+        }
+        case CANDLE_DBC_TYPE_UNSIGNED:
+            return (double)(uint64_t)raw * s->info.factor + s->info.offset;
+        default:
+            return (double)raw * s->info.factor + s->info.offset;
+    }
+}
+
+static candle_dbc_msg_t *candle_dbc_frame_msg(candle_dbc_t *d, const candle_frame_t *frame)
+{
+    if ((frame->can_id & 0x60000000) != 0) {
+        return NULL; // rtr and error frames carry no signals
+    }
+    return candle_dbc_lookup(d, frame->can_id & CANDLE_DBC_KEY_MASK);
+}
+
+static bool candle_dbc_signal_active(candle_dbc_t *d, candle_dbc_msg_t *msg, candle_dbc_signal_t *s, uint8_t dlc, uint64_t le, uint64_t be)
+{
+    if ((s->info.mux_value < 0) || (msg->mux_signal < 0)) {
+        return true;
+    }
+    candle_dbc_signal_t *mux = &d->signals[msg->mux_signal];
+    return (dlc >= mux->dlc) && (candle_dbc_raw(mux, le, be) == s->info.mux_value);
+}
+
+static uint32_t candle_dbc_count_values(candle_dbc_t *d, candle_dbc_msg_t *msg, uint8_t dlc, uint64_t le)
+{
+    if (msg->mux_signal < 0) {
+        return msg->num_signals;
+    }
+
+    uint64_t be = candle_dbc_bswap64(le);
+    uint32_t n = 0;
+    for (uint32_t i=0; i<msg->num_signals; i++) {
+        if (candle_dbc_signal_active(d, msg, &d->signals[msg->first_signal + i], dlc, le, be)) {
+            n++;
+        }
+    }
+    return n;
+}
+
+static void candle_dbc_decode_frame(candle_dbc_t *d, candle_dbc_msg_t *msg, uint32_t frame_index, uint8_t dlc, uint64_t le, candle_dbc_value_t *out)
+{
+    uint64_t be = candle_dbc_bswap64(le);
+    for (uint32_t i=0; i<msg->num_signals; i++) {
+        candle_dbc_signal_t *s = &d->signals[msg->first_signal + i];
+        if (!candle_dbc_signal_active(d, msg, s, dlc, le, be)) {
+            continue;
+        }
+        out->frame_index = frame_index;
+        out->signal_index = msg->first_signal + i;
+        out->valid = (dlc >= s->dlc);
+        out->raw = out->valid ? candle_dbc_raw(s, le, be) : 0;
+        out->value = out->valid ? candle_dbc_physical(s, out->raw) : 0;
+        out++;
+    }
+}
+
+/* decode one signal over all frames of a message; the inner loops have no
+   branches on the frame data so the compiler can vectorise them */
+static void candle_dbc_decode_column(candle_dbc_signal_t *s, uint32_t signal_index, const uint64_t *payload, const uint8_t *dlc, const uint32_t *frame_index, const uint32_t *out_index, uint32_t n, int64_t *raw, candle_dbc_value_t *values)
+{
+    const uint64_t mask = s->mask;
+    const unsigned shift = s->shift;
+    const uint8_t need = s->dlc;
+
+    for (uint32_t k=0; k<n; k++) {
+        uint64_t keep = (uint64_t)0 - (uint64_t)(dlc[k] >= need);
+        raw[k] = (int64_t)((payload[k] >> shift) & mask & keep);
+    }
+
+    if ((s->info.type == CANDLE_DBC_TYPE_SIGNED) && (s->info.length < 64)) {
+        const unsigned unused = 64 - s->info.length;
+        for (uint32_t k=0; k<n; k++) {
+            raw[k] = (int64_t)((uint64_t)raw[k] << unused) >> unused;
+        }
+    }
+
+    for (uint32_t k=0; k<n; k++) {
+        candle_dbc_value_t *v = &values[out_index[k]];
+        v->frame_index = frame_index[k];
+        v->signal_index = signal_index;
+        v->valid = (dlc[k] >= need);
+        v->raw = raw[k];
+        v->value = v->valid ? candle_dbc_physical(s, raw[k]) : 0;
+    }
+}
+
+DLL bool __stdcall candle_dbc_load(candle_dbc_handle *dbc, const char *text, size_t len)
+{
+    if ((dbc==NULL) || (text==NULL)) {
+        return false;
+    }
+
+    candle_dbc_t *d = (candle_dbc_t *)calloc(1, sizeof(candle_dbc_t));
+    *dbc = d;
+    if (d==NULL) {
+        return false;
+    }
+
+    if (!candle_dbc_parse(d, text, len)) {
+        return false; // keep last_error, caller frees the handle
+    }
+
+    d->last_error = CANDLE_ERR_OK;
+    return true;
+}
+
+DLL bool __stdcall candle_dbc_load_file(candle_dbc_handle *dbc, const wchar_t *path)
+{
+    if (dbc==NULL) {
+        return false;
+    }
+    *dbc = NULL;
+
+    HANDLE file = CreateFile(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+
+    LARGE_INTEGER size;
+    char *text = NULL;
+    DWORD bytes_read = 0;
+    bool rc = GetFileSizeEx(file, &size) && (size.QuadPart < 0x40000000)
+        && ((text = (char *)malloc((size_t)size.QuadPart + 1)) != NULL)
+        && ReadFile(file, text, (DWORD)size.QuadPart, &bytes_read, NULL);
+    CloseHandle(file);
+
+    if (rc) {
+        rc = candle_dbc_load(dbc, text, bytes_read);
+    }
+
+    free(text);
+    return rc;
+}
+
+DLL bool __stdcall candle_dbc_signal_count(candle_dbc_handle dbc, uint32_t *count)
+{
+    candle_dbc_t *d = (candle_dbc_t *)dbc;
+    if ((d==NULL) || (count==NULL)) {
+        return false;
+    }
+    *count = d->num_signals;
+    return true;
+}
+
+DLL bool __stdcall candle_dbc_signal_info(candle_dbc_handle dbc, uint32_t signal_index, candle_dbc_signal_info_t *info)
+{
+    candle_dbc_t *d = (candle_dbc_t *)dbc;
+    if ((d==NULL) || (info==NULL)) {
+        return false;
+    }
+
+    if (signal_index >= d->num_signals) {
+        d->last_error = CANDLE_ERR_DBC_NOT_FOUND;
+        return false;
+    }
+
+    memcpy(info, &d->signals[signal_index].info, sizeof(*info));
+    d->last_error = CANDLE_ERR_OK;
+    return true;
+}
+
+DLL bool __stdcall candle_dbc_find_signal(candle_dbc_handle dbc, uint32_t msg_id, const char *name, uint32_t *signal_index)
+{
+    candle_dbc_t *d = (candle_dbc_t *)dbc;
+    if ((d==NULL) || (name==NULL) || (signal_index==NULL)) {
+        return false;
+    }
+
+    candle_dbc_signal_t *s = candle_dbc_find(d, msg_id, name);
+    if (s == NULL) {
+        d->last_error = CANDLE_ERR_DBC_NOT_FOUND;
+        return false;
+    }
+
+    *signal_index = (uint32_t)(s - d->signals);
+    d->last_error = CANDLE_ERR_OK;
+    return true;
+}
+
+DLL bool __stdcall candle_dbc_decode(candle_dbc_handle dbc, const candle_frame_t *frames, uint32_t num_frames, candle_dbc_value_t *values, uint32_t max_values, uint32_t *num_values)
+{
+    candle_dbc_t *d = (candle_dbc_t *)dbc;
+    if ((d==NULL) || (frames==NULL) || (num_values==NULL)) {
+        return false;
+    }
+
+    *num_values = 0;
+    if (num_frames == 0) {
+        d->last_error = CANDLE_ERR_OK;
+        return true;
+    }
+
+    /* per frame: message index + 1 (0 = unknown) and first output slot */
+    uint32_t *frame_msg = (uint32_t *)malloc(num_frames * sizeof(uint32_t));
+    uint32_t *frame_out = (uint32_t *)malloc(num_frames * sizeof(uint32_t));
+    uint32_t *msg_count = (uint32_t *)calloc(d->num_msgs + 1, sizeof(uint32_t));
+    if ((frame_msg==NULL) || (frame_out==NULL) || (msg_count==NULL)) {
+        free(frame_msg);
+        free(frame_out);
+        free(msg_count);
+        d->last_error = CANDLE_ERR_MALLOC;
+        return false;
+    }
+
+    uint32_t total = 0;
+    for (uint32_t i=0; i<num_frames; i++) {
+        candle_dbc_msg_t *msg = candle_dbc_frame_msg(d, &frames[i]);
+        frame_out[i] = total;
+        if (msg == NULL) {
+            frame_msg[i] = 0;
+            continue;
+        }
+        frame_msg[i] = (uint32_t)(msg - d->msgs) + 1;
+        msg_count[frame_msg[i]]++;
+        total += candle_dbc_count_values(d, msg, frames[i].can_dlc, candle_dbc_payload(&frames[i]));
+    }
+
+    if ((values==NULL) || (total > max_values)) {
+        free(frame_msg);
+        free(frame_out);
+        free(msg_count);
+        *num_values = total;
+        d->last_error = CANDLE_ERR_DBC_OVERFLOW;
+        return false;
+    }
+
+    /* frequent, non multiplexed messages: gather their payloads and decode column by column */
+    uint64_t *payload = NULL;
+    uint64_t *payload_be = NULL;
+    uint8_t *dlc = NULL;
+    uint32_t *index = NULL;
+    uint32_t *out_index = NULL;
+    int64_t *raw = NULL;
+
+    for (uint32_t m=1; m<=d->num_msgs; m++) {
+        candle_dbc_msg_t *msg = &d->msgs[m - 1];
+        uint32_t n = msg_count[m];
+        if ((n < CANDLE_DBC_VECTOR_MIN) || (msg->mux_signal >= 0) || (msg->num_signals == 0)) {
+            continue;
+        }
+
+        if (payload == NULL) {
+            payload = (uint64_t *)malloc(num_frames * sizeof(uint64_t));
+            payload_be = (uint64_t *)malloc(num_frames * sizeof(uint64_t));
+            dlc = (uint8_t *)malloc(num_frames);
+            index = (uint32_t *)malloc(num_frames * sizeof(uint32_t));
+            out_index = (uint32_t *)malloc(num_frames * sizeof(uint32_t));
+            raw = (int64_t *)malloc(num_frames * sizeof(int64_t));
+            if ((payload==NULL) || (payload_be==NULL) || (dlc==NULL) || (index==NULL) || (out_index==NULL) || (raw==NULL)) {
+                break; // fall back to the per frame path below
+            }
+        }
+
+        uint32_t k = 0;
+        for (uint32_t i=0; i<num_frames; i++) {
+            if (frame_msg[i] == m) {
+                index[k] = i;
+                payload[k] = candle_dbc_payload(&frames[i]);
+                dlc[k] = frames[i].can_dlc;
+                k++;
+            }
+        }
+
+        if (msg->has_motorola) {
+            for (uint32_t j=0; j<n; j++) {
+                payload_be[j] = candle_dbc_bswap64(payload[j]);
+            }
+        }
+
+        for (uint32_t s=0; s<msg->num_signals; s++) {
+            candle_dbc_signal_t *sig = &d->signals[msg->first_signal + s];
+            for (uint32_t j=0; j<n; j++) {
+                out_index[j] = frame_out[index[j]] + s;
+            }
+            candle_dbc_decode_column(sig, msg->first_signal + s, sig->info.motorola ? payload_be : payload,
+                                     dlc, index, out_index, n, raw, values);
+        }
+
+        msg_count[m] = 0; // done, skip in the per frame pass
+    }
+
+    for (uint32_t i=0; i<num_frames; i++) {
+        uint32_t m = frame_msg[i];
+        if ((m == 0) || (msg_count[m] == 0)) {
+            continue;
+        }
+        candle_dbc_decode_frame(d, &d->msgs[m - 1], i, frames[i].can_dlc, candle_dbc_payload(&frames[i]), &values[frame_out[i]]);
+    }
+
+    free(payload);
+    free(payload_be);
+    free(dlc);
+    free(index);
+    free(out_index);
+    free(raw);
+    free(frame_msg);
+    free(frame_out);
+    free(msg_count);
+
+    *num_values = total;
+    d->last_error = CANDLE_ERR_OK;
+    return true;
+}
+
+DLL bool __stdcall candle_dbc_free(candle_dbc_handle dbc)
+{
+    candle_dbc_t *d = (candle_dbc_t *)dbc;
+    if (d==NULL) {
+        return false;
+    }
+
+    free(d->msgs);
+    free(d->signals);
+    free(d->table);
+    free(d);
+    return true;
+}
+
+DLL candle_err_t __stdcall candle_dbc_last_error(candle_dbc_handle dbc)
+{
+    candle_dbc_t *d = (candle_dbc_t *)dbc;
+    return d->last_error;
+}
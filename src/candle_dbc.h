@@ -0,0 +1,89 @@
+/*
+
+  Copyright (c) 2016 Hubert Denkmair <hubert@denkmair.de>
+
+  This file is part of the candle windows API.
+  
+  This library is free software: you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation, either
+  version 3 of the License, or (at your option) any later version.
+ 
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+ 
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#pragma once
+#include <stddef.h>
+#include "candle.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef void* candle_dbc_handle;
+
+typedef enum {
+    CANDLE_DBC_TYPE_UNSIGNED = 0,
+    CANDLE_DBC_TYPE_SIGNED   = 1,
+    CANDLE_DBC_TYPE_FLOAT    = 2,
+    CANDLE_DBC_TYPE_DOUBLE   = 3
+} candle_dbc_type_t;
+
+#pragma pack(push,1)
+
+typedef struct {
+    char name[64];
+    char unit[16];
+    uint32_t msg_id;       /* as in the DBC file, bit 31 set for extended ids */
+    uint8_t start_bit;
+    uint8_t length;
+    uint8_t motorola;
+    uint8_t type;          /* candle_dbc_type_t */
+    int16_t mux_value;     /* -1 if the signal is not multiplexed */
+    uint8_t is_multiplexor;
+    uint8_t reserved;
+    double factor;
+    double offset;
+    double min;
+    double max;
+} candle_dbc_signal_info_t;
+
+typedef struct {
+    uint32_t frame_index;  /* index of the frame in the decoded batch */
+    uint32_t signal_index; /* index for candle_dbc_signal_info */
+    int64_t raw;           /* sign extended for signed signals */
+    double value;          /* raw * factor + offset */
+    uint8_t valid;         /* 0 if the signal lies past the frame's dlc, raw and value are 0 then */
+    uint8_t reserved[7];
+} candle_dbc_value_t;
+
+#pragma pack(pop)
+
+/*
+ * Loads BO_, SG_ and SIG_VALTYPE_ entries of a DBC file and compiles them
+ * into per-id extraction plans. candle_dbc_decode then turns a batch of
+ * frames into signal values, in frame order and in signal order within a
+ * frame. Signals not covered by a frame's dlc are still reported, with
+ * valid set to 0. If max_values is too small, it fails with CANDLE_ERR_DBC_OVERFLOW
+ * and sets num_values to the number of values needed.
+ */
+DLL bool __stdcall candle_dbc_load(candle_dbc_handle *dbc, const char *text, size_t len);
+DLL bool __stdcall candle_dbc_load_file(candle_dbc_handle *dbc, const wchar_t *path);
+DLL bool __stdcall candle_dbc_signal_count(candle_dbc_handle dbc, uint32_t *count);
+DLL bool __stdcall candle_dbc_signal_info(candle_dbc_handle dbc, uint32_t signal_index, candle_dbc_signal_info_t *info);
+DLL bool __stdcall candle_dbc_find_signal(candle_dbc_handle dbc, uint32_t msg_id, const char *name, uint32_t *signal_index);
+DLL bool __stdcall candle_dbc_decode(candle_dbc_handle dbc, const candle_frame_t *frames, uint32_t num_frames, candle_dbc_value_t *values, uint32_t max_values, uint32_t *num_values);
+DLL bool __stdcall candle_dbc_free(candle_dbc_handle dbc);
+
+DLL candle_err_t __stdcall candle_dbc_last_error(candle_dbc_handle dbc);
+
+#ifdef __cplusplus
+}
+#endif
@@ -37,6 +37,9 @@
 
 #define CANDLE_MAX_DEVICES 32
 #define CANDLE_URB_COUNT 30
+#define CANDLE_DEFAULT_MAX_BORROWS (CANDLE_URB_COUNT/2)
+#define CANDLE_MIN_FREE_URBS 4
+#define CANDLE_MAX_CHANNELS 8
 
 #pragma pack(push,1)
 
@@ -66,6 +69,24 @@ typedef struct {
     uint8_t buf[64];
 } canlde_rx_urb;
 
+typedef struct {
+    bool timing_valid; /* timing is known to be set on the device */
+    bool mode_valid;   /* started and flags are known */
+    bool started;
+    uint32_t flags;
+    candle_bittiming_t timing;
+
+    volatile LONG filter_seq; /* odd while the filters are being replaced */
+    uint8_t num_filters;
+    candle_filter_t filters[CANDLE_MAX_FILTERS];
+} candle_channel_state_t;
+
+struct candle_cache;
+struct candle_txq;
+struct candle_recorder;
+struct candle_isotp;
+struct candle_gateway;
+
 typedef struct {
     wchar_t path[256];
     candle_devstate_t state;
@@ -79,8 +100,26 @@ typedef struct {
 
     candle_device_config_t dconf;
     candle_capability_t bt_const;
+    candle_channel_state_t channels[CANDLE_MAX_CHANNELS];
     canlde_rx_urb rxurbs[CANDLE_URB_COUNT];
     HANDLE rxevents[CANDLE_URB_COUNT];
+    volatile LONG rx_borrowed; /* bitmask of urbs handed out by candle_frame_borrow */
+    volatile LONG num_borrowed;
+    uint8_t max_borrows;
+    volatile LONG rx_failed; /* set by a reactor once a transfer failed, urbs are not restarted */
+
+    uint32_t rx_spin_min_us;
+    uint32_t rx_spin_max_us; /* 0: polling disabled */
+    uint32_t rx_spin_budget_us;
+    DWORD rx_spin_next;
+    uint64_t rx_spin_hits;
+    uint64_t rx_blocks;
+
+    struct candle_cache *cache;
+    struct candle_txq *txq;
+    struct candle_recorder *recorder;
+    struct candle_isotp *isotp;
+    struct candle_gateway *gateway;
 } candle_device_t;
 
 typedef struct {
@@ -0,0 +1,145 @@
+/*
+
+  Copyright (c) 2016 Hubert Denkmair <hubert@denkmair.de>
+
+  This file is part of the candle windows API.
+  
+  This library is free software: you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation, either
+  version 3 of the License, or (at your option) any later version.
+ 
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+ 
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include "candle_gateway.h"
+#include <stdlib.h>
+#include <string.h>
+
+#include "candle_defs.h"
+#include "candle_rx.h"
+#include "candle_txq.h"
+
+typedef struct {
+    candle_gateway_rule_t rule;
+    uint32_t match_id;  /* can_id & mask, precomputed */
+    volatile LONG64 forwarded;
+    volatile LONG64 failed;
+} candle_gateway_entry_t;
+
+struct candle_gateway {
+    uint8_t num_rules;
+    candle_gateway_entry_t rules[CANDLE_GATEWAY_MAX_RULES];
+};
+
+bool candle_gateway_forward(struct candle_gateway *gw, const candle_frame_t *frame)
+{
+    bool deliver = true;
+
+    if ((frame->echo_id != 0xFFFFFFFF) || (frame->can_id & 0x20000000)) {
+        return true;
+    }
+
+    for (unsigned i=0; i<gw->num_rules; i++) {
+        candle_gateway_entry_t *e = &gw->rules[i];
+        const candle_gateway_rule_t *r = &e->rule;
+
+        if (((frame->can_id & r->mask) != e->match_id)
+            || ((r->src_channel != CANDLE_GATEWAY_ANY_CHANNEL) && (r->src_channel != frame->channel)))
+        {
+            continue;
+        }
+
+        candle_frame_t out = *frame;
+        out.can_id = (frame->can_id & ~r->remap_mask) | (r->remap_id & r->remap_mask);
+        for (unsigned b=0; b<8; b++) {
+            out.data[b] = (frame->data[b] & r->data_and[b]) | r->data_or[b];
+        }
+
+        /* never wait for queue space on the receive path */
+        bool rc = candle_txq_send(r->dst_dev, r->dst_channel, &out, 0);
+
+        InterlockedIncrement64(rc ? &e->forwarded : &e->failed);
+        if (r->flags & CANDLE_GATEWAY_CONSUME) {
+            deliver = false;
+        }
+    }
+
+    return deliver;
+}
+
+DLL bool __stdcall candle_gateway_add_rule(candle_handle hdev, const candle_gateway_rule_t *rule, uint8_t *rule_index)
+{
+    candle_device_t *dev = (candle_device_t*)hdev;
+    candle_device_t *dst = (candle_device_t *)rule->dst_dev;
+
+    if ((dst == NULL) || (rule->dst_channel > dst->dconf.icount)
+        || ((rule->src_channel != CANDLE_GATEWAY_ANY_CHANNEL) && (rule->src_channel > dev->dconf.icount)))
+    {
+        dev->last_error = CANDLE_ERR_CHANNEL_OUT_OF_RANGE;
+        return false;
+    }
+
+    if (dst->txq == NULL) {
+        dev->last_error = CANDLE_ERR_TXQ_DISABLED;
+        return false;
+    }
+
+    if (dev->gateway == NULL) {
+        dev->gateway = (struct candle_gateway *)calloc(1, sizeof(struct candle_gateway));
+        if (dev->gateway == NULL) {
+            dev->last_error = CANDLE_ERR_MALLOC;
+            return false;
+        }
+    }
+
+    struct candle_gateway *gw = dev->gateway;
+    if (gw->num_rules >= CANDLE_GATEWAY_MAX_RULES) {
+        dev->last_error = CANDLE_ERR_GATEWAY_RULE;
+        return false;
+    }
+
+    candle_gateway_entry_t *e = &gw->rules[gw->num_rules];
+    memset(e, 0, sizeof(*e));
+    e->rule = *rule;
+    e->match_id = rule->can_id & rule->mask;
+    *rule_index = gw->num_rules++;
+
+    dev->last_error = CANDLE_ERR_OK;
+    return true;
+}
+
+DLL bool __stdcall candle_gateway_get_counters(candle_handle hdev, uint8_t rule_index, uint64_t *forwarded, uint64_t *failed)
+{
+    candle_device_t *dev = (candle_device_t*)hdev;
+    struct candle_gateway *gw = dev->gateway;
+
+    if ((gw == NULL) || (rule_index >= gw->num_rules)) {
+        dev->last_error = CANDLE_ERR_GATEWAY_RULE;
+        return false;
+    }
+
+    *forwarded = (uint64_t)InterlockedCompareExchange64(&gw->rules[rule_index].forwarded, 0, 0);
+    *failed = (uint64_t)InterlockedCompareExchange64(&gw->rules[rule_index].failed, 0, 0);
+
+    dev->last_error = CANDLE_ERR_OK;
+    return true;
+}
+
+DLL bool __stdcall candle_gateway_clear(candle_handle hdev)
+{
+    candle_device_t *dev = (candle_device_t*)hdev;
+
+    free(dev->gateway);
+    dev->gateway = NULL;
+
+    dev->last_error = CANDLE_ERR_OK;
+    return true;
+}
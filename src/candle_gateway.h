@@ -0,0 +1,70 @@
+/*
+
+  Copyright (c) 2016 Hubert Denkmair <hubert@denkmair.de>
+
+  This file is part of the candle windows API.
+  
+  This library is free software: you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation, either
+  version 3 of the License, or (at your option) any later version.
+ 
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+ 
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#pragma once
+#include "candle.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define CANDLE_GATEWAY_MAX_RULES 64
+#define CANDLE_GATEWAY_ANY_CHANNEL 0xFF
+
+#define CANDLE_GATEWAY_CONSUME 0x01 /* do not hand forwarded frames to the application */
+
+#pragma pack(push,1)
+
+typedef struct {
+    uint8_t src_channel;   /* or CANDLE_GATEWAY_ANY_CHANNEL */
+    uint8_t dst_channel;
+    uint8_t flags;
+    uint8_t reserved;
+    uint32_t can_id;       /* frames with (id & mask) == (can_id & mask) are forwarded */
+    uint32_t mask;
+    uint32_t remap_id;     /* bits selected by remap_mask are replaced, 0: keep the id */
+    uint32_t remap_mask;
+    uint8_t data_and[8];   /* payload becomes (data & data_and) | data_or */
+    uint8_t data_or[8];
+    candle_handle dst_dev;
+} candle_gateway_rule_t;
+
+#pragma pack(pop)
+
+/*
+ * Forwards received frames of hdev to other channels, on the same or another
+ * device, directly from the receive path. A frame is forwarded by every rule
+ * it matches. Frames are written asynchronously through the destination's
+ * transmit queue (candle_txq.h), which has to be enabled before adding the
+ * rule; a full queue counts the frame as failed instead of waiting.
+ * dst_dev must stay open and must not be freed, nor its queue disabled,
+ * while rules forwarding to it exist; clear them first.
+ * Only frames received from the bus are forwarded, never echoes or error
+ * frames, so rules in both directions do not loop.
+ * Add and clear rules while no thread is reading from hdev.
+ */
+DLL bool __stdcall candle_gateway_add_rule(candle_handle hdev, const candle_gateway_rule_t *rule, uint8_t *rule_index);
+DLL bool __stdcall candle_gateway_get_counters(candle_handle hdev, uint8_t rule_index, uint64_t *forwarded, uint64_t *failed);
+DLL bool __stdcall candle_gateway_clear(candle_handle hdev);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,525 @@
+/*
+
+  Copyright (c) 2016 Hubert Denkmair <hubert@denkmair.de>
+
+  This file is part of the candle windows API.
+  
+  This library is free software: you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation, either
+  version 3 of the License, or (at your option) any later version.
+ 
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+ 
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include "candle_isotp.h"
+#include <stdlib.h>
+#include <string.h>
+
+#include "candle_defs.h"
+#include "candle_rx.h"
+#include "candle_txq.h"
+
+#define CANDLE_ISOTP_MAX_SESSIONS 128
+#define CANDLE_ISOTP_TABLE_SIZE 256 /* power of two, at least twice the sessions */
+#define CANDLE_ISOTP_TIMEOUT_BS_MS 1000
+#define CANDLE_ISOTP_WFT_MAX 16 /* N_WFTmax, flow control WAIT frames accepted in a row */
+
+enum {
+    CANDLE_ISOTP_PCI_SF = 0,
+    CANDLE_ISOTP_PCI_FF = 1,
+    CANDLE_ISOTP_PCI_CF = 2,
+    CANDLE_ISOTP_PCI_FC = 3
+};
+
+enum {
+    CANDLE_ISOTP_FC_CTS = 0,
+    CANDLE_ISOTP_FC_WAIT = 1,
+    CANDLE_ISOTP_FC_OVERFLOW = 2
+};
+
+typedef struct candle_isotp_session {
+    candle_device_t *dev;
+    uint8_t ch;
+    candle_isotp_config_t config;
+    candle_err_t last_error;
+    CRITICAL_SECTION lock;
+
+    /* transmit side, flow control as received */
+    HANDLE fc_event;
+    uint8_t fc_status;
+    uint8_t fc_bs;
+    uint8_t fc_st_min;
+
+    /* receive side */
+    bool rx_active;
+    uint32_t rx_len;
+    uint32_t rx_off;
+    uint8_t rx_seq;
+    uint8_t rx_block;
+    candle_err_t rx_error;
+    uint8_t rx_buf[CANDLE_ISOTP_MAX_LEN];
+
+    HANDLE done_event;
+    bool done_valid;
+    uint32_t done_len;
+    uint8_t done_buf[CANDLE_ISOTP_MAX_LEN];
+} candle_isotp_session_t;
+
+struct candle_isotp {
+    CRITICAL_SECTION lock;
+    uint32_t num_sessions;
+    candle_isotp_session_t *table[CANDLE_ISOTP_TABLE_SIZE];
+};
+
+static uint32_t candle_isotp_hash(uint8_t ch, uint32_t can_id)
+{
+    uint32_t h = (can_id ^ ((uint32_t)ch << 24)) * 0x9E3779B1u;
+    return h >> (32 - 8);
+}
+
+static candle_isotp_session_t *candle_isotp_find(struct candle_isotp *reg, uint8_t ch, uint32_t can_id)
+{
+    for (uint32_t i=candle_isotp_hash(ch, can_id); ; i=(i+1) & (CANDLE_ISOTP_TABLE_SIZE-1)) {
+        candle_isotp_session_t *s = reg->table[i];
+        if ((s == NULL) || ((s->ch == ch) && (s->config.rx_id == can_id))) {
+            return s;
+        }
+    }
+}
+
+static void candle_isotp_insert(struct candle_isotp *reg, candle_isotp_session_t *s)
+{
+    uint32_t i = candle_isotp_hash(s->ch, s->config.rx_id);
+    while (reg->table[i] != NULL) {
+        i = (i+1) & (CANDLE_ISOTP_TABLE_SIZE-1);
+    }
+    reg->table[i] = s;
+}
+
+static bool candle_isotp_tx(candle_isotp_session_t *s, const uint8_t *data, uint8_t len, uint32_t timeout_ms)
+{
+    candle_frame_t frame;
+    memset(&frame, 0, sizeof(frame));
+    frame.can_id = s->config.tx_id;
+    frame.can_dlc = s->config.pad ? 8 : len;
+    if (s->config.pad) {
+        memset(frame.data, s->config.pad_byte, sizeof(frame.data));
+    }
+    memcpy(frame.data, data, len);
+
+    /* waits on the queue's space condition whatever policy the application chose,
+       so consecutive frames are neither dropped nor refused */
+    return candle_txq_push(s->dev, s->ch, &frame, timeout_ms, CANDLE_TXQ_BLOCK);
+}
+
+static void candle_isotp_send_fc(candle_isotp_session_t *s, uint8_t status)
+{
+    uint8_t fc[3] = { (CANDLE_ISOTP_PCI_FC << 4) | status, s->config.block_size, s->config.st_min };
+    /* on the receive path, so never wait for queue space */
+    if (!candle_isotp_tx(s, fc, sizeof(fc), 0)) {
+        /* the sender would wait for a flow control that never comes; give up and let candle_isotp_recv report it */
+        s->rx_active = false;
+        s->rx_error = s->dev->last_error;
+        SetEvent(s->done_event);
+    }
+}
+
+static void candle_isotp_complete(candle_isotp_session_t *s, const uint8_t *data, uint32_t len)
+{
+    /* an unread message is replaced by the newer one */
+    memcpy(s->done_buf, data, len);
+    s->done_len = len;
+    s->done_valid = true;
+    SetEvent(s->done_event);
+}
+
+static void candle_isotp_process(candle_isotp_session_t *s, const candle_frame_t *frame)
+{
+    const uint8_t *d = frame->data;
+    uint8_t dlc = frame->can_dlc;
+    if (dlc == 0) {
+        return;
+    }
+
+    EnterCriticalSection(&s->lock);
+
+    switch (d[0] >> 4) {
+
+        case CANDLE_ISOTP_PCI_SF: {
+            uint8_t len = d[0] & 0x0F;
+            if ((len > 0) && (len < dlc)) {
+                s->rx_active = false;
+                candle_isotp_complete(s, &d[1], len);
+            }
+            break;
+        }
+
+        case CANDLE_ISOTP_PCI_FF: {
+            uint32_t len = ((uint32_t)(d[0] & 0x0F) << 8) | d[1];
+            if ((dlc < 8) || (len < 8)) {
+                break;
+            }
+            memcpy(s->rx_buf, &d[2], 6);
+            s->rx_len = len;
+            s->rx_off = 6;
+            s->rx_seq = 1;
+            s->rx_block = 0;
+            s->rx_active = true;
+            candle_isotp_send_fc(s, CANDLE_ISOTP_FC_CTS);
+            break;
+        }
+
+        case CANDLE_ISOTP_PCI_CF: {
+            if (!s->rx_active) {
+                break;
+            }
+            if ((d[0] & 0x0F) != (s->rx_seq & 0x0F)) {
+                s->rx_active = false; /* lost a segment, wait for the next first frame */
+                break;
+            }
+
+            uint32_t n = s->rx_len - s->rx_off;
+            if (n > 7) {
+                n = 7;
+            }
+            if (n > (uint32_t)(dlc - 1)) {
+                n = dlc - 1;
+            }
+            memcpy(&s->rx_buf[s->rx_off], &d[1], n);
+            s->rx_off += n;
+            s->rx_seq++;
+
+            if (s->rx_off >= s->rx_len) {
+                s->rx_active = false;
+                candle_isotp_complete(s, s->rx_buf, s->rx_len);
+            } else if ((s->config.block_size != 0) && (++s->rx_block >= s->config.block_size)) {
+                s->rx_block = 0;
+                candle_isotp_send_fc(s, CANDLE_ISOTP_FC_CTS);
+            }
+            break;
+        }
+
+        case CANDLE_ISOTP_PCI_FC:
+            if (dlc >= 3) {
+                s->fc_status = d[0] & 0x0F;
+                s->fc_bs = d[1];
+                s->fc_st_min = d[2];
+                SetEvent(s->fc_event);
+            }
+            break;
+
+        default:
+            break;
+    }
+
+    LeaveCriticalSection(&s->lock);
+}
+
+bool candle_isotp_on_frame(candle_device_t *dev, const candle_frame_t *frame)
+{
+    struct candle_isotp *reg = dev->isotp;
+
+    if ((frame->echo_id != 0xFFFFFFFF) || (frame->can_id & 0x20000000)) {
+        return true;
+    }
+
+    EnterCriticalSection(&reg->lock);
+    candle_isotp_session_t *s = (reg->num_sessions > 0) ? candle_isotp_find(reg, frame->channel, frame->can_id) : NULL;
+    if (s != NULL) {
+        candle_isotp_process(s, frame);
+    }
+    LeaveCriticalSection(&reg->lock);
+
+    return s == NULL;
+}
+
+static void candle_isotp_delay(uint8_t st_min)
+{
+    uint32_t us;
+    if (st_min <= 0x7F) {
+        us = st_min * 1000;
+    } else if ((st_min >= 0xF1) && (st_min <= 0xF9)) {
+        us = (st_min - 0xF0) * 100;
+    } else {
+        us = 127000; /* reserved values mean the maximum */
+    }
+
+    if (us >= 2000) {
+        Sleep(us / 1000);
+        return;
+    }
+
+    /* Sleep is far too coarse for sub-millisecond gaps */
+    LARGE_INTEGER freq, start, now;
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&start);
+    LONGLONG ticks = (LONGLONG)us * freq.QuadPart / 1000000;
+    do {
+        YieldProcessor();
+        QueryPerformanceCounter(&now);
+    } while (now.QuadPart - start.QuadPart < ticks);
+}
+
+static bool candle_isotp_wait_fc(candle_isotp_session_t *s, ULONGLONG start, uint32_t timeout_ms)
+{
+    for (unsigned num_wait=0; ; num_wait++) {
+        uint32_t wait_ms = candle_rx_time_left(start, timeout_ms);
+        if (wait_ms > CANDLE_ISOTP_TIMEOUT_BS_MS) {
+            wait_ms = CANDLE_ISOTP_TIMEOUT_BS_MS;
+        }
+        if (WaitForSingleObject(s->fc_event, wait_ms) != WAIT_OBJECT_0) {
+            s->last_error = CANDLE_ERR_ISOTP_TIMEOUT;
+            return false;
+        }
+
+        EnterCriticalSection(&s->lock);
+        uint8_t status = s->fc_status;
+        ResetEvent(s->fc_event);
+        LeaveCriticalSection(&s->lock);
+
+        if (status == CANDLE_ISOTP_FC_CTS) {
+            return true;
+        }
+        if (status != CANDLE_ISOTP_FC_WAIT) {
+            s->last_error = CANDLE_ERR_ISOTP_OVERFLOW;
+            return false;
+        }
+        if (num_wait >= CANDLE_ISOTP_WFT_MAX) {
+            s->last_error = CANDLE_ERR_ISOTP_WAIT;
+            return false;
+        }
+    }
+}
+
+DLL bool __stdcall candle_isotp_open(candle_handle hdev, uint8_t ch, const candle_isotp_config_t *config, candle_isotp_handle *session)
+{
+    candle_device_t *dev = (candle_device_t*)hdev;
+
+    if (ch > dev->dconf.icount) {
+        dev->last_error = CANDLE_ERR_CHANNEL_OUT_OF_RANGE;
+        return false;
+    }
+
+    /* frames are written asynchronously through the transmit queue, so
+       consecutive frames do not wait for a usb round trip each */
+    if (dev->txq == NULL) {
+        dev->last_error = CANDLE_ERR_TXQ_DISABLED;
+        return false;
+    }
+
+    if (dev->isotp == NULL) {
+        struct candle_isotp *reg = (struct candle_isotp *)calloc(1, sizeof(struct candle_isotp));
+        if (reg == NULL) {
+            dev->last_error = CANDLE_ERR_MALLOC;
+            return false;
+        }
+        InitializeCriticalSection(&reg->lock);
+        dev->isotp = reg;
+    }
+
+    candle_isotp_session_t *s = (candle_isotp_session_t *)calloc(1, sizeof(candle_isotp_session_t));
+    if (s == NULL) {
+        dev->last_error = CANDLE_ERR_MALLOC;
+        return false;
+    }
+
+    s->dev = dev;
+    s->ch = ch;
+    s->config = *config;
+    InitializeCriticalSection(&s->lock);
+    s->fc_event = CreateEvent(NULL, true, false, NULL);
+    s->done_event = CreateEvent(NULL, true, false, NULL);
+    if ((s->fc_event == NULL) || (s->done_event == NULL)) {
+        dev->last_error = CANDLE_ERR_ISOTP_CONFIG;
+        candle_isotp_close(s);
+        return false;
+    }
+
+    struct candle_isotp *reg = dev->isotp;
+    EnterCriticalSection(&reg->lock);
+    bool rc = (reg->num_sessions < CANDLE_ISOTP_MAX_SESSIONS) && (candle_isotp_find(reg, ch, config->rx_id) == NULL);
+    if (rc) {
+        candle_isotp_insert(reg, s);
+        reg->num_sessions++;
+    }
+    LeaveCriticalSection(&reg->lock);
+
+    if (!rc) {
+        dev->last_error = CANDLE_ERR_ISOTP_CONFIG;
+        s->dev = NULL; /* not registered */
+        candle_isotp_close(s);
+        return false;
+    }
+
+    *session = s;
+    dev->last_error = CANDLE_ERR_OK;
+    return true;
+}
+
+DLL bool __stdcall candle_isotp_send(candle_isotp_handle session, const uint8_t *data, uint32_t len, uint32_t timeout_ms)
+{
+    candle_isotp_session_t *s = (candle_isotp_session_t *)session;
+    ULONGLONG start = GetTickCount64();
+    uint8_t buf[8];
+
+    if ((len == 0) || (len > CANDLE_ISOTP_MAX_LEN)) {
+        s->last_error = CANDLE_ERR_ISOTP_OVERFLOW;
+        return false;
+    }
+
+    if (len <= 7) {
+        buf[0] = (CANDLE_ISOTP_PCI_SF << 4) | (uint8_t)len;
+        memcpy(&buf[1], data, len);
+        if (!candle_isotp_tx(s, buf, (uint8_t)(len + 1), timeout_ms)) {
+            s->last_error = s->dev->last_error;
+            return false;
+        }
+        s->last_error = CANDLE_ERR_OK;
+        return true;
+    }
+
+    /* the flow control may arrive before the frame asking for it is confirmed */
+    ResetEvent(s->fc_event);
+
+    buf[0] = (CANDLE_ISOTP_PCI_FF << 4) | (uint8_t)(len >> 8);
+    buf[1] = (uint8_t)len;
+    memcpy(&buf[2], data, 6);
+    if (!candle_isotp_tx(s, buf, 8, timeout_ms)) {
+        s->last_error = s->dev->last_error;
+        return false;
+    }
+
+    uint32_t off = 6;
+    uint8_t seq = 1;
+
+    while (off < len) {
+        if (!candle_isotp_wait_fc(s, start, timeout_ms)) {
+            return false;
+        }
+
+        EnterCriticalSection(&s->lock);
+        uint8_t bs = s->fc_bs;
+        uint8_t st_min = s->fc_st_min;
+        LeaveCriticalSection(&s->lock);
+
+        for (uint32_t count=0; (off < len) && ((bs == 0) || (count < bs)); count++) {
+            uint32_t n = len - off;
+            if (n > 7) {
+                n = 7;
+            }
+
+            buf[0] = (CANDLE_ISOTP_PCI_CF << 4) | (seq & 0x0F);
+            memcpy(&buf[1], &data[off], n);
+            if (!candle_isotp_tx(s, buf, (uint8_t)(n + 1), candle_rx_time_left(start, timeout_ms))) {
+                s->last_error = s->dev->last_error;
+                return false;
+            }
+            off += n;
+            seq++;
+
+            bool block_done = (bs != 0) && (count + 1 == bs);
+            if ((off < len) && !block_done && (st_min != 0)) {
+                candle_isotp_delay(st_min);
+            }
+        }
+    }
+
+    s->last_error = CANDLE_ERR_OK;
+    return true;
+}
+
+DLL bool __stdcall candle_isotp_recv(candle_isotp_handle session, uint8_t *data, uint32_t max_len, uint32_t *len, uint32_t timeout_ms)
+{
+    candle_isotp_session_t *s = (candle_isotp_session_t *)session;
+
+    if (WaitForSingleObject(s->done_event, timeout_ms) != WAIT_OBJECT_0) {
+        s->last_error = CANDLE_ERR_ISOTP_TIMEOUT;
+        return false;
+    }
+
+    candle_err_t err;
+    EnterCriticalSection(&s->lock);
+    if (s->done_valid) {
+        /* a message that does not fit stays queued for a larger buffer */
+        *len = s->done_len;
+        err = (s->done_len <= max_len) ? CANDLE_ERR_OK : CANDLE_ERR_ISOTP_OVERFLOW;
+        if (err == CANDLE_ERR_OK) {
+            memcpy(data, s->done_buf, s->done_len);
+            s->done_valid = false;
+        }
+    } else {
+        err = (s->rx_error != CANDLE_ERR_OK) ? s->rx_error : CANDLE_ERR_ISOTP_TIMEOUT;
+        s->rx_error = CANDLE_ERR_OK;
+    }
+    if (!s->done_valid && (s->rx_error == CANDLE_ERR_OK)) {
+        ResetEvent(s->done_event);
+    }
+    LeaveCriticalSection(&s->lock);
+
+    s->last_error = err;
+    return err == CANDLE_ERR_OK;
+}
+
+DLL bool __stdcall candle_isotp_close(candle_isotp_handle session)
+{
+    candle_isotp_session_t *s = (candle_isotp_session_t *)session;
+    struct candle_isotp *reg = (s->dev != NULL) ? s->dev->isotp : NULL;
+
+    if (reg != NULL) {
+        /* rebuild the table instead of handling deleted slots during lookup */
+        EnterCriticalSection(&reg->lock);
+        candle_isotp_session_t *old[CANDLE_ISOTP_TABLE_SIZE];
+        memcpy(old, reg->table, sizeof(old));
+        memset(reg->table, 0, sizeof(reg->table));
+        for (unsigned i=0; i<CANDLE_ISOTP_TABLE_SIZE; i++) {
+            if (old[i] == s) {
+                reg->num_sessions--;
+            } else if (old[i] != NULL) {
+                candle_isotp_insert(reg, old[i]);
+            }
+        }
+        LeaveCriticalSection(&reg->lock);
+    }
+
+    if (s->fc_event != NULL) {
+        CloseHandle(s->fc_event);
+    }
+    if (s->done_event != NULL) {
+        CloseHandle(s->done_event);
+    }
+    DeleteCriticalSection(&s->lock);
+    free(s);
+    return true;
+}
+
+void candle_isotp_free(candle_device_t *dev)
+{
+    struct candle_isotp *reg = dev->isotp;
+
+    /* sessions still open are closed along with the device */
+    for (unsigned i=0; i<CANDLE_ISOTP_TABLE_SIZE; i++) {
+        candle_isotp_session_t *s = reg->table[i];
+        if (s != NULL) {
+            s->dev = NULL;
+            candle_isotp_close(s);
+        }
+    }
+
+    dev->isotp = NULL;
+    DeleteCriticalSection(&reg->lock);
+    free(reg);
+}
+
+DLL candle_err_t __stdcall candle_isotp_last_error(candle_isotp_handle session)
+{
+    candle_isotp_session_t *s = (candle_isotp_session_t *)session;
+    return s->last_error;
+}
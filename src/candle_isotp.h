@@ -0,0 +1,70 @@
+/*
+
+  Copyright (c) 2016 Hubert Denkmair <hubert@denkmair.de>
+
+  This file is part of the candle windows API.
+  
+  This library is free software: you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation, either
+  version 3 of the License, or (at your option) any later version.
+ 
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+ 
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#pragma once
+#include "candle.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define CANDLE_ISOTP_MAX_LEN 4095
+
+typedef void* candle_isotp_handle;
+
+#pragma pack(push,1)
+
+typedef struct {
+    uint32_t tx_id;      /* can ids, including the extended id flag bit */
+    uint32_t rx_id;
+    uint8_t block_size;  /* announced in our flow control frames, 0: no limit */
+    uint8_t st_min;      /* announced separation time, ISO 15765-2 encoding */
+    uint8_t pad;         /* pad every frame to 8 bytes with pad_byte */
+    uint8_t pad_byte;
+} candle_isotp_config_t;
+
+#pragma pack(pop)
+
+/*
+ * ISO 15765-2 transport sessions, identified by channel and rx_id. Frames
+ * for a session are handled on the receive path: flow control is answered
+ * and received segments are reassembled there, and neither is returned by
+ * candle_frame_read. Some thread therefore has to keep reading from the
+ * device while sessions are open.
+ * candle_isotp_send blocks until the message is sent and gives up after
+ * 16 flow control WAIT frames in a row (CANDLE_ERR_ISOTP_WAIT). All frames go
+ * through the transmit queue (candle_txq.h), which keeps several of them in
+ * flight at once and has to be enabled before opening a session.
+ * candle_isotp_recv stores the message length in len; if it exceeds max_len
+ * the call fails with CANDLE_ERR_ISOTP_OVERFLOW and the message is kept for
+ * the next call. If a flow control frame could not be sent, the reception is
+ * aborted and the next candle_isotp_recv fails with the send error.
+ */
+DLL bool __stdcall candle_isotp_open(candle_handle hdev, uint8_t ch, const candle_isotp_config_t *config, candle_isotp_handle *session);
+DLL bool __stdcall candle_isotp_send(candle_isotp_handle session, const uint8_t *data, uint32_t len, uint32_t timeout_ms);
+DLL bool __stdcall candle_isotp_recv(candle_isotp_handle session, uint8_t *data, uint32_t max_len, uint32_t *len, uint32_t timeout_ms);
+DLL bool __stdcall candle_isotp_close(candle_isotp_handle session);
+
+DLL candle_err_t __stdcall candle_isotp_last_error(candle_isotp_handle session);
+
+#ifdef __cplusplus
+}
+#endif
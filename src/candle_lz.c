@@ -0,0 +1,184 @@
+/*
+
+  Copyright (c) 2016 Hubert Denkmair <hubert@denkmair.de>
+
+  This file is part of the candle windows API.
+  
+  This library is free software: you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation, either
+  version 3 of the License, or (at your option) any later version.
+ 
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+ 
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include "candle_lz.h"
+#include <string.h>
+
+#define LZ_HASH_BITS 13
+#define LZ_MIN_MATCH 4
+#define LZ_MAX_OFFSET 65535
+#define LZ_SKIP_SHIFT 5
+
+static inline uint32_t lz_read32(const uint8_t *p)
+{
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint32_t lz_hash(uint32_t v)
+{
+    return (v * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+static uint8_t *lz_put_length(uint8_t *op, size_t len)
+{
+    while (len >= 255) {
+        *op++ = 255;
+        len -= 255;
+    }
+    *op++ = (uint8_t)len;
+    return op;
+}
+
+size_t candle_lz_bound(size_t len)
+{
+    return len + len / 255 + 16;
+}
+
+static uint8_t *lz_emit(uint8_t *op, const uint8_t *lit, size_t lit_len, size_t offset, size_t match_len)
+{
+    size_t ml = match_len ? match_len - LZ_MIN_MATCH : 0;
+    uint8_t *token = op++;
+    *token = (uint8_t)(((lit_len < 15) ? lit_len : 15) << 4);
+    if (lit_len >= 15) {
+        op = lz_put_length(op, lit_len - 15);
+    }
+    memcpy(op, lit, lit_len);
+    op += lit_len;
+
+    if (match_len) {
+        *token |= (uint8_t)((ml < 15) ? ml : 15);
+        *op++ = (uint8_t)(offset & 0xFF);
+        *op++ = (uint8_t)(offset >> 8);
+        if (ml >= 15) {
+            op = lz_put_length(op, ml - 15);
+        }
+    }
+    return op;
+}
+
+size_t candle_lz_compress(const uint8_t *src, size_t len, uint8_t *dst, size_t dst_cap)
+{
+    uint32_t table[1 << LZ_HASH_BITS]; /* position + 1, 0 = empty */
+    memset(table, 0, sizeof(table));
+
+    if (dst_cap < candle_lz_bound(len)) {
+        return 0;
+    }
+
+    uint8_t *op = dst;
+    size_t ip = 0;
+    size_t anchor = 0;
+    unsigned misses = 0;
+
+    while (ip + LZ_MIN_MATCH <= len) {
+        uint32_t seq = lz_read32(src + ip);
+        uint32_t h = lz_hash(seq);
+        size_t ref = table[h];
+        table[h] = (uint32_t)(ip + 1);
+
+        if ((ref != 0) && (ip - (ref - 1) <= LZ_MAX_OFFSET) && (lz_read32(src + ref - 1) == seq)) {
+            ref--;
+            size_t ml = LZ_MIN_MATCH;
+            while ((ip + ml < len) && (src[ref + ml] == src[ip + ml])) {
+                ml++;
+            }
+            op = lz_emit(op, src + anchor, ip - anchor, ip - ref, ml);
+            ip += ml;
+            anchor = ip;
+            misses = 0;
+        } else {
+            /* step faster through data that does not compress */
+            ip += 1 + (misses++ >> LZ_SKIP_SHIFT);
+        }
+    }
+
+    op = lz_emit(op, src + anchor, len - anchor, 0, 0);
+    return (size_t)(op - dst);
+}
+
+static bool lz_get_length(const uint8_t **ip, const uint8_t *end, size_t *len)
+{
+    uint8_t b;
+    do {
+        if (*ip >= end) {
+            return false;
+        }
+        b = *(*ip)++;
+        *len += b;
+    } while (b == 255);
+    return true;
+}
+
+bool candle_lz_decompress(const uint8_t *src, size_t len, uint8_t *dst, size_t dst_len)
+{
+    const uint8_t *ip = src;
+    const uint8_t *end = src + len;
+    size_t op = 0;
+
+    while (ip < end) {
+        uint8_t token = *ip++;
+
+        size_t lit_len = token >> 4;
+        if ((lit_len == 15) && !lz_get_length(&ip, end, &lit_len)) {
+            return false;
+        }
+        if (((size_t)(end - ip) < lit_len) || (dst_len - op < lit_len)) {
+            return false;
+        }
+        memcpy(dst + op, ip, lit_len);
+        ip += lit_len;
+        op += lit_len;
+
+        if (ip == end) {
+            break; // last sequence has no match
+        }
+
+        if (end - ip < 2) {
+            return false;
+        }
+        size_t offset = ip[0] | ((size_t)ip[1] << 8);
+        ip += 2;
+
+        size_t ml = token & 0x0F;
+        if ((ml == 15) && !lz_get_length(&ip, end, &ml)) {
+            return false;
+        }
+        ml += LZ_MIN_MATCH;
+
+        if ((offset == 0) || (offset > op) || (dst_len - op < ml)) {
+            return false;
+        }
+
+        const uint8_t *ref = dst + op - offset;
+        if (offset >= ml) {
+            memcpy(dst + op, ref, ml);
+        } else {
+            for (size_t i=0; i<ml; i++) {
+                dst[op + i] = ref[i];
+            }
+        }
+        op += ml;
+    }
+
+    return op == dst_len;
+}
@@ -0,0 +1,36 @@
+/*
+
+  Copyright (c) 2016 Hubert Denkmair <hubert@denkmair.de>
+
+  This file is part of the candle windows API.
+  
+  This library is free software: you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation, either
+  version 3 of the License, or (at your option) any later version.
+ 
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+ 
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+ * Small LZ77 block codec in the style of LZ4: a token byte holds the literal
+ * and match lengths, followed by the literals and a 16bit match offset.
+ * Used to compress archive blocks without pulling in an external library.
+ */
+size_t candle_lz_bound(size_t len);
+size_t candle_lz_compress(const uint8_t *src, size_t len, uint8_t *dst, size_t dst_cap);
+bool candle_lz_decompress(const uint8_t *src, size_t len, uint8_t *dst, size_t dst_len);
+
@@ -0,0 +1,489 @@
+/*
+
+  Copyright (c) 2016 Hubert Denkmair <hubert@denkmair.de>
+
+  This file is part of the candle windows API.
+  
+  This library is free software: you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation, either
+  version 3 of the License, or (at your option) any later version.
+ 
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+ 
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include "candle_merge.h"
+#include <stdlib.h>
+
+#include "candle_defs.h"
+#include "candle_ctrl_req.h"
+
+#define CANDLE_MERGE_HEAP_SIZE 16384
+#define CANDLE_MERGE_CLOCK_SAMPLES 16
+#define CANDLE_MERGE_SYNC_PROBES 8
+#define CANDLE_MERGE_RESYNC_PROBES 3
+#define CANDLE_MERGE_RESYNC_MS 1000
+#define CANDLE_MERGE_READ_TIMEOUT_MS 50
+#define CANDLE_MERGE_MAX_DRIFT 0.001 /* 1000ppm, far beyond any crystal tolerance */
+
+typedef struct {
+    double dev_us;
+    double host_us;
+} candle_merge_sample_t;
+
+typedef struct {
+    uint64_t seq;
+    candle_merge_frame_t f;
+} candle_merge_entry_t;
+
+struct candle_merge;
+
+typedef struct {
+    struct candle_merge *merge;
+    candle_device_t *dev;
+    uint8_t index;
+    HANDLE thread;
+
+    uint64_t ts_ext;
+    bool ts_valid;
+    ULONGLONG last_sync;
+
+    candle_merge_sample_t samples[CANDLE_MERGE_CLOCK_SAMPLES];
+    unsigned num_samples;
+    unsigned next_sample;
+
+    /* host_us = offset + rate * (dev_us - dev_ref) */
+    double dev_ref;
+    double offset;
+    double rate;
+} candle_merge_dev_t;
+
+typedef struct candle_merge {
+    candle_err_t last_error;
+    uint32_t reorder_window_us;
+    uint8_t num_devices;
+    candle_merge_dev_t devs[CANDLE_MAX_DEVICES];
+
+    LARGE_INTEGER qpc_freq;
+    LARGE_INTEGER qpc_start;
+    volatile LONG running;
+
+    CRITICAL_SECTION lock;
+    HANDLE data_event;
+    candle_merge_entry_t *heap;
+    unsigned heap_len;
+    uint64_t seq;
+    uint32_t dropped;
+} candle_merge_t;
+
+static double candle_merge_host_us(candle_merge_t *m)
+{
+    LARGE_INTEGER now;
+    QueryPerformanceCounter(&now);
+    return (double)(now.QuadPart - m->qpc_start.QuadPart) * 1e6 / (double)m->qpc_freq.QuadPart;
+}
+
+/* extend the wrapping 32bit device timestamp to 64bit; tolerates small backward steps */
+static uint64_t candle_merge_extend_ts(candle_merge_dev_t *md, uint32_t ts)
+{
+    if (!md->ts_valid) {
+        md->ts_ext = ts;
+        md->ts_valid = true;
+    } else {
+        md->ts_ext += (int64_t)(int32_t)(ts - (uint32_t)md->ts_ext);
+    }
+    return md->ts_ext;
+}
+
+static void candle_merge_fit_clock(candle_merge_dev_t *md)
+{
+    unsigned n = md->num_samples;
+    double mx = 0, my = 0;
+    for (unsigned i=0; i<n; i++) {
+        mx += md->samples[i].dev_us;
+        my += md->samples[i].host_us;
+    }
+    mx /= n;
+    my /= n;
+
+    double sxx = 0, sxy = 0;
+    for (unsigned i=0; i<n; i++) {
+        double dx = md->samples[i].dev_us - mx;
+        sxx += dx * dx;
+        sxy += dx * (md->samples[i].host_us - my);
+    }
+
+    double rate = 1.0;
+    if ((n >= 2) && (sxx > 0)) {
+        rate = sxy / sxx;
+        if ((rate < 1.0 - CANDLE_MERGE_MAX_DRIFT) || (rate > 1.0 + CANDLE_MERGE_MAX_DRIFT)) {
+            rate = 1.0;
+        }
+    }
+
+    md->dev_ref = mx;
+    md->offset = my;
+    md->rate = rate;
+}
+
+/* take a few timestamp probes and keep the one with the shortest round trip */
+static bool candle_merge_sample_clock(candle_merge_dev_t *md, unsigned probes)
+{
+    candle_merge_t *m = md->merge;
+    bool have_sample = false;
+    double best_rtt = 0;
+    candle_merge_sample_t best;
+
+    for (unsigned i=0; i<probes; i++) {
+        uint32_t ts;
+        double t0 = candle_merge_host_us(m);
+        if (!candle_ctrl_get_timestamp(md->dev, &ts)) {
+            continue;
+        }
+        double t1 = candle_merge_host_us(m);
+
+        uint64_t ts_ext = candle_merge_extend_ts(md, ts);
+        if (!have_sample || (t1 - t0 < best_rtt)) {
+            best_rtt = t1 - t0;
+            best.dev_us = (double)ts_ext;
+            best.host_us = (t0 + t1) / 2;
+            have_sample = true;
+        }
+    }
+
+    md->last_sync = GetTickCount64();
+    if (!have_sample) {
+        return false;
+    }
+
+    md->samples[md->next_sample] = best;
+    md->next_sample = (md->next_sample + 1) % CANDLE_MERGE_CLOCK_SAMPLES;
+    if (md->num_samples < CANDLE_MERGE_CLOCK_SAMPLES) {
+        md->num_samples++;
+    }
+
+    candle_merge_fit_clock(md);
+    return true;
+}
+
+static bool candle_merge_entry_less(candle_merge_entry_t *a, candle_merge_entry_t *b)
+{
+    if (a->f.timestamp_us != b->f.timestamp_us) {
+        return a->f.timestamp_us < b->f.timestamp_us;
+    }
+    return a->seq < b->seq;
+}
+
+static void candle_merge_heap_push(candle_merge_t *m, candle_merge_entry_t *e)
+{
+    unsigned i = m->heap_len++;
+    while (i > 0) {
+        unsigned parent = (i - 1) / 2;
+        if (!candle_merge_entry_less(e, &m->heap[parent])) {
+            break;
+        }
+        m->heap[i] = m->heap[parent];
+        i = parent;
+    }
+    m->heap[i] = *e;
+}
+
+static void candle_merge_heap_pop(candle_merge_t *m, candle_merge_entry_t *e)
+{
+    *e = m->heap[0];
+    candle_merge_entry_t last = m->heap[--m->heap_len];
+
+    unsigned i = 0;
+    for (;;) {
+        unsigned child = 2 * i + 1;
+        if (child >= m->heap_len) {
+            break;
+        }
+        if ((child + 1 < m->heap_len) && candle_merge_entry_less(&m->heap[child + 1], &m->heap[child])) {
+            child++;
+        }
+        if (!candle_merge_entry_less(&m->heap[child], &last)) {
+            break;
+        }
+        m->heap[i] = m->heap[child];
+        i = child;
+    }
+    m->heap[i] = last;
+}
+
+static DWORD WINAPI candle_merge_reader(LPVOID param)
+{
+    candle_merge_dev_t *md = (candle_merge_dev_t *)param;
+    candle_merge_t *m = md->merge;
+
+    while (m->running) {
+
+        if (GetTickCount64() - md->last_sync >= CANDLE_MERGE_RESYNC_MS) {
+            candle_merge_sample_clock(md, CANDLE_MERGE_RESYNC_PROBES);
+        }
+
+        candle_merge_entry_t e;
+        if (!candle_frame_read(md->dev, &e.f.frame, CANDLE_MERGE_READ_TIMEOUT_MS)) {
+            if (md->dev->last_error == CANDLE_ERR_READ_WAIT) {
+                break; // device handles are gone, nothing more to read
+            }
+            continue;
+        }
+
+        double dev_us = (double)candle_merge_extend_ts(md, e.f.frame.timestamp_us);
+        double host_us = md->offset + md->rate * (dev_us - md->dev_ref);
+        e.f.dev_index = md->index;
+        e.f.timestamp_us = (host_us > 0) ? (uint64_t)host_us : 0;
+
+        EnterCriticalSection(&m->lock);
+        if (m->heap_len < CANDLE_MERGE_HEAP_SIZE) {
+            e.seq = m->seq++;
+            candle_merge_heap_push(m, &e);
+        } else {
+            m->dropped++;
+        }
+        LeaveCriticalSection(&m->lock);
+
+        SetEvent(m->data_event);
+    }
+
+    return 0;
+}
+
+DLL bool __stdcall candle_merge_create(candle_merge_handle *merge, uint32_t reorder_window_us)
+{
+    if (merge==NULL) {
+        return false;
+    }
+
+    candle_merge_t *m = (candle_merge_t *)calloc(1, sizeof(candle_merge_t));
+    *merge = m;
+    if (m==NULL) {
+        return false;
+    }
+
+    m->heap = (candle_merge_entry_t *)calloc(CANDLE_MERGE_HEAP_SIZE, sizeof(candle_merge_entry_t));
+    m->data_event = CreateEvent(NULL, false, false, NULL);
+    if ((m->heap==NULL) || (m->data_event==NULL)) {
+        if (m->data_event != NULL) {
+            CloseHandle(m->data_event);
+        }
+        free(m->heap);
+        free(m);
+        *merge = NULL;
+        return false;
+    }
+
+    InitializeCriticalSection(&m->lock);
+    QueryPerformanceFrequency(&m->qpc_freq);
+    m->reorder_window_us = reorder_window_us;
+    m->last_error = CANDLE_ERR_OK;
+    return true;
+}
+
+DLL bool __stdcall candle_merge_add_device(candle_merge_handle merge, candle_handle hdev, uint8_t *dev_index)
+{
+    candle_merge_t *m = (candle_merge_t *)merge;
+    if ((m==NULL) || (hdev==NULL)) {
+        return false;
+    }
+
+    if (m->running) {
+        m->last_error = CANDLE_ERR_MERGE_RUNNING;
+        return false;
+    }
+
+    if (m->num_devices >= CANDLE_MAX_DEVICES) {
+        m->last_error = CANDLE_ERR_DEV_OUT_OF_RANGE;
+        return false;
+    }
+
+    candle_merge_dev_t *md = &m->devs[m->num_devices];
+    memset(md, 0, sizeof(*md));
+    md->merge = m;
+    md->dev = (candle_device_t *)hdev;
+    md->index = m->num_devices;
+    md->rate = 1.0;
+
+    if (dev_index != NULL) {
+        *dev_index = md->index;
+    }
+
+    m->num_devices++;
+    m->last_error = CANDLE_ERR_OK;
+    return true;
+}
+
+DLL bool __stdcall candle_merge_start(candle_merge_handle merge)
+{
+    candle_merge_t *m = (candle_merge_t *)merge;
+    if (m==NULL) {
+        return false;
+    }
+
+    if (m->running) {
+        m->last_error = CANDLE_ERR_MERGE_RUNNING;
+        return false;
+    }
+
+    m->heap_len = 0;
+    m->dropped = 0;
+    QueryPerformanceCounter(&m->qpc_start);
+
+    for (unsigned i=0; i<m->num_devices; i++) {
+        candle_merge_dev_t *md = &m->devs[i];
+        md->num_samples = 0;
+        md->next_sample = 0;
+        md->ts_valid = false;
+        if (!candle_merge_sample_clock(md, CANDLE_MERGE_SYNC_PROBES)) {
+            m->last_error = CANDLE_ERR_GET_TIMESTAMP;
+            return false;
+        }
+    }
+
+    m->running = 1;
+    for (unsigned i=0; i<m->num_devices; i++) {
+        m->devs[i].thread = CreateThread(NULL, 0, candle_merge_reader, &m->devs[i], 0, NULL);
+        if (m->devs[i].thread == NULL) {
+            candle_merge_stop(m);
+            m->last_error = CANDLE_ERR_MERGE_THREAD;
+            return false;
+        }
+    }
+
+    m->last_error = CANDLE_ERR_OK;
+    return true;
+}
+
+DLL bool __stdcall candle_merge_read(candle_merge_handle merge, candle_merge_frame_t *frame, uint32_t timeout_ms)
+{
+    candle_merge_t *m = (candle_merge_t *)merge;
+    if ((m==NULL) || (frame==NULL)) {
+        return false;
+    }
+
+    ULONGLONG start = GetTickCount64();
+
+    for (;;) {
+
+        DWORD wait_ms = INFINITE;
+
+        EnterCriticalSection(&m->lock);
+        if (m->heap_len > 0) {
+            double due = (double)m->heap[0].f.timestamp_us + m->reorder_window_us;
+            double now = candle_merge_host_us(m);
+            if (!m->running || (due <= now)) {
+                candle_merge_entry_t e;
+                candle_merge_heap_pop(m, &e);
+                LeaveCriticalSection(&m->lock);
+                *frame = e.f;
+                m->last_error = CANDLE_ERR_OK;
+                return true;
+            }
+            wait_ms = (DWORD)((due - now) / 1000) + 1;
+        }
+        LeaveCriticalSection(&m->lock);
+
+        if (timeout_ms != INFINITE) {
+            ULONGLONG elapsed = GetTickCount64() - start;
+            if (elapsed >= timeout_ms) {
+                m->last_error = CANDLE_ERR_READ_TIMEOUT;
+                return false;
+            }
+            if (timeout_ms - elapsed < wait_ms) {
+                wait_ms = (DWORD)(timeout_ms - elapsed);
+            }
+        }
+
+        WaitForSingleObject(m->data_event, wait_ms);
+    }
+}
+
+DLL bool __stdcall candle_merge_get_clock(candle_merge_handle merge, uint8_t dev_index, double *offset_us, double *drift_ppm)
+{
+    candle_merge_t *m = (candle_merge_t *)merge;
+    if (m==NULL) {
+        return false;
+    }
+
+    if (dev_index >= m->num_devices) {
+        m->last_error = CANDLE_ERR_DEV_OUT_OF_RANGE;
+        return false;
+    }
+
+    /* values are updated by the reader thread; a torn read only affects diagnostics */
+    candle_merge_dev_t *md = &m->devs[dev_index];
+    if (offset_us != NULL) {
+        *offset_us = md->offset - md->rate * md->dev_ref;
+    }
+    if (drift_ppm != NULL) {
+        *drift_ppm = (md->rate - 1.0) * 1e6;
+    }
+
+    m->last_error = CANDLE_ERR_OK;
+    return true;
+}
+
+DLL bool __stdcall candle_merge_get_dropped(candle_merge_handle merge, uint32_t *dropped)
+{
+    candle_merge_t *m = (candle_merge_t *)merge;
+    if ((m==NULL) || (dropped==NULL)) {
+        return false;
+    }
+
+    EnterCriticalSection(&m->lock);
+    *dropped = m->dropped;
+    LeaveCriticalSection(&m->lock);
+    return true;
+}
+
+DLL bool __stdcall candle_merge_stop(candle_merge_handle merge)
+{
+    candle_merge_t *m = (candle_merge_t *)merge;
+    if (m==NULL) {
+        return false;
+    }
+
+    m->running = 0;
+    for (unsigned i=0; i<m->num_devices; i++) {
+        if (m->devs[i].thread != NULL) {
+            WaitForSingleObject(m->devs[i].thread, INFINITE);
+            CloseHandle(m->devs[i].thread);
+            m->devs[i].thread = NULL;
+        }
+    }
+
+    /* wake up readers so they can drain what is left without waiting for the window */
+    SetEvent(m->data_event);
+
+    m->last_error = CANDLE_ERR_OK;
+    return true;
+}
+
+DLL bool __stdcall candle_merge_free(candle_merge_handle merge)
+{
+    candle_merge_t *m = (candle_merge_t *)merge;
+    if (m==NULL) {
+        return false;
+    }
+
+    candle_merge_stop(m);
+    DeleteCriticalSection(&m->lock);
+    CloseHandle(m->data_event);
+    free(m->heap);
+    free(m);
+    return true;
+}
+
+DLL candle_err_t __stdcall candle_merge_last_error(candle_merge_handle merge)
+{
+    candle_merge_t *m = (candle_merge_t *)merge;
+    return m->last_error;
+}
@@ -0,0 +1,62 @@
+/*
+
+  Copyright (c) 2016 Hubert Denkmair <hubert@denkmair.de>
+
+  This file is part of the candle windows API.
+  
+  This library is free software: you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation, either
+  version 3 of the License, or (at your option) any later version.
+ 
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+ 
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#pragma once
+#include "candle.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef void* candle_merge_handle;
+
+#pragma pack(push,1)
+
+typedef struct {
+    candle_frame_t frame;
+    uint8_t dev_index;
+    uint64_t timestamp_us; /* device timestamp mapped to the merge time base */
+} candle_merge_frame_t;
+
+#pragma pack(pop)
+
+/*
+ * Merges the receive streams of several opened devices into one stream
+ * ordered by host-aligned timestamp. Every device's clock is mapped onto a
+ * common time base (microseconds since candle_merge_start) by periodically
+ * sampling candle_dev_get_timestamp_us and fitting offset and drift.
+ * A frame is delivered once it is older than reorder_window_us, so frames
+ * arriving late from one device can still be sorted in before it.
+ */
+DLL bool __stdcall candle_merge_create(candle_merge_handle *merge, uint32_t reorder_window_us);
+DLL bool __stdcall candle_merge_add_device(candle_merge_handle merge, candle_handle hdev, uint8_t *dev_index);
+DLL bool __stdcall candle_merge_start(candle_merge_handle merge);
+DLL bool __stdcall candle_merge_read(candle_merge_handle merge, candle_merge_frame_t *frame, uint32_t timeout_ms);
+DLL bool __stdcall candle_merge_get_clock(candle_merge_handle merge, uint8_t dev_index, double *offset_us, double *drift_ppm);
+DLL bool __stdcall candle_merge_get_dropped(candle_merge_handle merge, uint32_t *dropped);
+DLL bool __stdcall candle_merge_stop(candle_merge_handle merge);
+DLL bool __stdcall candle_merge_free(candle_merge_handle merge);
+
+DLL candle_err_t __stdcall candle_merge_last_error(candle_merge_handle merge);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,923 @@
+/*
+
+  Copyright (c) 2016 Hubert Denkmair <hubert@denkmair.de>
+
+  This file is part of the candle windows API.
+  
+  This library is free software: you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation, either
+  version 3 of the License, or (at your option) any later version.
+ 
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+ 
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include <winsock2.h>
+#include <ws2tcpip.h>
+
+#include "candle_net.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "candle_defs.h"
+
+#define CANDLE_NET_MAGIC 0x54454E43 /* "CNET" */
+#define CANDLE_NET_MAX_CLIENTS 16
+#define CANDLE_NET_MAX_BATCH 4096
+#define CANDLE_NET_OUT_BUFFER (1024 * 1024)
+#define CANDLE_NET_READ_TIMEOUT_MS 100
+#define CANDLE_NET_READ_BACKOFF_MS 1000 /* longest pause after failed reads */
+#define CANDLE_NET_ACCEPT_POLL_MS 100
+
+enum {
+    CANDLE_NET_MSG_HELLO = 1,  /* server to client: device and channel counts */
+    CANDLE_NET_MSG_FRAMES = 2, /* server to client: batch of candle_net_frame_t */
+    CANDLE_NET_MSG_FILTER = 3, /* client to server: candle_net_filter_t list */
+    CANDLE_NET_MSG_SEND = 4,   /* client to server: candle_net_frame_t to transmit */
+    CANDLE_NET_MSG_STATUS = 5  /* server to client: candle_net_status_t after failed sends */
+};
+
+#pragma pack(push,1)
+
+typedef struct {
+    uint32_t magic;
+    uint8_t type;
+    uint8_t reserved[3];
+    uint32_t length; /* payload bytes following the header */
+    uint32_t seq;
+} candle_net_header_t;
+
+typedef struct {
+    uint32_t send_failed; /* since the client connected */
+    uint32_t last_error;  /* candle_err_t of the latest failure */
+} candle_net_status_t;
+
+#pragma pack(pop)
+
+typedef struct candle_net_server candle_net_server_t;
+
+typedef struct {
+    candle_net_server_t *server;
+    SOCKET sock;
+    HANDLE send_thread;
+    HANDLE recv_thread;
+    HANDLE event;
+    volatile bool active;
+
+    CRITICAL_SECTION lock;
+    uint8_t num_filters;
+    candle_net_filter_t filters[CANDLE_NET_MAX_FILTERS];
+
+    uint8_t *batch;
+    uint32_t batch_frames;
+    uint64_t batch_start_us;
+    uint32_t seq;
+
+    uint8_t *out; /* filled by the readers */
+    uint8_t *spare; /* being sent */
+    uint32_t out_len;
+    uint32_t dropped;
+    candle_net_status_t status;
+} candle_net_conn_t;
+
+typedef struct {
+    candle_net_server_t *server;
+    candle_device_t *dev;
+    uint8_t index;
+    HANDLE thread;
+} candle_net_dev_t;
+
+struct candle_net_server {
+    candle_err_t last_error;
+    bool wsa_started;
+    uint16_t port;
+    uint32_t coalesce_us;
+    uint32_t max_batch;
+    volatile bool running;
+
+    SOCKET listen_sock;
+    HANDLE accept_thread;
+
+    uint8_t num_devices;
+    candle_net_dev_t devs[CANDLE_MAX_DEVICES];
+
+    CRITICAL_SECTION lock;
+    candle_net_conn_t *conns[CANDLE_NET_MAX_CLIENTS];
+};
+
+typedef struct {
+    candle_err_t last_error;
+    bool wsa_started;
+    SOCKET sock;
+    uint8_t num_devices;
+
+    uint8_t *buf;
+    uint32_t buf_size;
+    uint32_t buf_frames;
+    uint32_t buf_pos;
+
+    bool have_seq;
+    uint32_t next_seq;
+    uint32_t lost;
+    candle_net_status_t status;
+} candle_net_client_t;
+
+static uint64_t candle_net_now_us(void)
+{
+    LARGE_INTEGER freq, now;
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&now);
+    return (uint64_t)(now.QuadPart / freq.QuadPart) * 1000000
+         + (uint64_t)(now.QuadPart % freq.QuadPart) * 1000000 / (uint64_t)freq.QuadPart;
+}
+
+static bool candle_net_send_all(SOCKET sock, const void *data, uint32_t len)
+{
+    const char *p = (const char *)data;
+    while (len > 0) {
+        int n = send(sock, p, (int)len, 0);
+        if (n <= 0) {
+            return false;
+        }
+        p += n;
+        len -= (uint32_t)n;
+    }
+    return true;
+}
+
+static bool candle_net_recv_all(SOCKET sock, void *data, uint32_t len)
+{
+    char *p = (char *)data;
+    while (len > 0) {
+        int n = recv(sock, p, (int)len, 0);
+        if (n <= 0) {
+            return false;
+        }
+        p += n;
+        len -= (uint32_t)n;
+    }
+    return true;
+}
+
+static bool candle_net_send_msg(SOCKET sock, uint8_t type, const void *payload, uint32_t len)
+{
+    candle_net_header_t hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.magic = CANDLE_NET_MAGIC;
+    hdr.type = type;
+    hdr.length = len;
+    return candle_net_send_all(sock, &hdr, sizeof(hdr)) && ((len == 0) || candle_net_send_all(sock, payload, len));
+}
+
+static bool candle_net_wsa_startup(void)
+{
+    WSADATA wsa;
+    return WSAStartup(MAKEWORD(2, 2), &wsa) == 0;
+}
+
+static bool candle_net_filter_match(const candle_net_filter_t *filters, uint8_t num_filters, uint8_t dev_index, const candle_frame_t *frame)
+{
+    if (num_filters == 0) {
+        return true;
+    }
+
+    for (uint8_t i=0; i<num_filters; i++) {
+        const candle_net_filter_t *f = &filters[i];
+        if (((f->dev_index == CANDLE_NET_ANY) || (f->dev_index == dev_index))
+            && ((f->channel == CANDLE_NET_ANY) || (f->channel == frame->channel))
+            && (((frame->can_id ^ f->can_id) & f->mask) == 0))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+/* moves the pending batch into the send buffer; call with conn->lock held */
+static void candle_net_flush_batch(candle_net_conn_t *c)
+{
+    if (c->batch_frames == 0) {
+        return;
+    }
+
+    uint32_t len = c->batch_frames * sizeof(candle_net_frame_t);
+    candle_net_header_t *hdr = (candle_net_header_t *)c->batch;
+    memset(hdr, 0, sizeof(*hdr));
+    hdr->magic = CANDLE_NET_MAGIC;
+    hdr->type = CANDLE_NET_MSG_FRAMES;
+    hdr->length = len;
+    hdr->seq = c->seq++; /* also counted when dropped, so the client sees the gap */
+
+    if (c->out_len + sizeof(*hdr) + len <= CANDLE_NET_OUT_BUFFER) {
+        memcpy(&c->out[c->out_len], c->batch, sizeof(*hdr) + len);
+        c->out_len += sizeof(*hdr) + len;
+        SetEvent(c->event);
+    } else {
+        c->dropped++;
+    }
+    c->batch_frames = 0;
+}
+
+/* queues the send status behind the pending batches, so it is never sent
+   from the receiving thread directly */
+static void candle_net_report_failures(candle_net_conn_t *c, uint32_t failed, candle_err_t err)
+{
+    EnterCriticalSection(&c->lock);
+    c->status.send_failed += failed;
+    c->status.last_error = err;
+
+    candle_net_flush_batch(c);
+    candle_net_header_t hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.magic = CANDLE_NET_MAGIC;
+    hdr.type = CANDLE_NET_MSG_STATUS;
+    hdr.length = sizeof(c->status);
+
+    /* the counter is cumulative, a report that does not fit is caught up by the next one */
+    if (c->out_len + sizeof(hdr) + sizeof(c->status) <= CANDLE_NET_OUT_BUFFER) {
+        memcpy(&c->out[c->out_len], &hdr, sizeof(hdr));
+        memcpy(&c->out[c->out_len + sizeof(hdr)], &c->status, sizeof(c->status));
+        c->out_len += sizeof(hdr) + sizeof(c->status);
+        SetEvent(c->event);
+    }
+    LeaveCriticalSection(&c->lock);
+}
+
+static void candle_net_publish(candle_net_server_t *s, uint8_t dev_index, const candle_frame_t *frame)
+{
+    EnterCriticalSection(&s->lock);
+    for (unsigned i=0; i<CANDLE_NET_MAX_CLIENTS; i++) {
+        candle_net_conn_t *c = s->conns[i];
+        if ((c == NULL) || !c->active) {
+            continue;
+        }
+
+        EnterCriticalSection(&c->lock);
+        if (candle_net_filter_match(c->filters, c->num_filters, dev_index, frame)) {
+            candle_net_frame_t *nf = (candle_net_frame_t *)(c->batch + sizeof(candle_net_header_t)) + c->batch_frames;
+            nf->dev_index = dev_index;
+            nf->frame = *frame;
+            if (c->batch_frames++ == 0) {
+                c->batch_start_us = candle_net_now_us();
+                SetEvent(c->event); /* let the sender arm its coalescing timeout */
+            }
+            if (c->batch_frames >= s->max_batch) {
+                candle_net_flush_batch(c);
+            }
+        }
+        LeaveCriticalSection(&c->lock);
+    }
+    LeaveCriticalSection(&s->lock);
+}
+
+static DWORD WINAPI candle_net_reader(LPVOID param)
+{
+    candle_net_dev_t *nd = (candle_net_dev_t *)param;
+    candle_net_server_t *s = nd->server;
+    DWORD backoff_ms = 0;
+
+    while (s->running) {
+        candle_frame_t frame;
+        if (!candle_frame_read(nd->dev, &frame, CANDLE_NET_READ_TIMEOUT_MS)) {
+            candle_err_t err = nd->dev->last_error;
+            if (err == CANDLE_ERR_READ_WAIT) {
+                break; // device handles are gone, nothing more to read
+            }
+            if (err != CANDLE_ERR_READ_TIMEOUT) {
+                /* failing transfers return at once, do not spin on an unplugged device */
+                backoff_ms = (backoff_ms == 0) ? 1 : backoff_ms * 2;
+                if (backoff_ms > CANDLE_NET_READ_BACKOFF_MS) {
+                    backoff_ms = CANDLE_NET_READ_BACKOFF_MS;
+                }
+                Sleep(backoff_ms);
+            }
+            continue;
+        }
+        backoff_ms = 0;
+        candle_net_publish(s, nd->index, &frame);
+    }
+
+    return 0;
+}
+
+static DWORD WINAPI candle_net_conn_sender(LPVOID param)
+{
+    candle_net_conn_t *c = (candle_net_conn_t *)param;
+    candle_net_server_t *s = c->server;
+
+    while (c->active) {
+        DWORD wait_ms = INFINITE;
+
+        EnterCriticalSection(&c->lock);
+        if (c->batch_frames > 0) {
+            uint64_t age = candle_net_now_us() - c->batch_start_us;
+            if (age >= s->coalesce_us) {
+                candle_net_flush_batch(c);
+            } else {
+                wait_ms = (DWORD)((s->coalesce_us - age + 999) / 1000);
+            }
+        }
+
+        uint8_t *data = c->out;
+        uint32_t len = c->out_len;
+        c->out = c->spare;
+        c->spare = data;
+        c->out_len = 0;
+        LeaveCriticalSection(&c->lock);
+
+        if (len > 0) {
+            if (!candle_net_send_all(c->sock, data, len)) {
+                break;
+            }
+            continue;
+        }
+
+        WaitForSingleObject(c->event, wait_ms);
+    }
+
+    c->active = false;
+    shutdown(c->sock, SD_BOTH); /* also ends the receiving thread */
+    return 0;
+}
+
+static DWORD WINAPI candle_net_conn_receiver(LPVOID param)
+{
+    candle_net_conn_t *c = (candle_net_conn_t *)param;
+    candle_net_server_t *s = c->server;
+    candle_net_header_t hdr;
+    candle_net_frame_t frames[64];
+
+    while (c->active && candle_net_recv_all(c->sock, &hdr, sizeof(hdr))) {
+
+        if (hdr.magic != CANDLE_NET_MAGIC) {
+            break;
+        }
+
+        if (hdr.type == CANDLE_NET_MSG_FILTER) {
+            candle_net_filter_t filters[CANDLE_NET_MAX_FILTERS];
+            uint32_t num = hdr.length / sizeof(candle_net_filter_t);
+            if ((hdr.length % sizeof(candle_net_filter_t) != 0) || (num > CANDLE_NET_MAX_FILTERS)
+                || !candle_net_recv_all(c->sock, filters, hdr.length))
+            {
+                break;
+            }
+            EnterCriticalSection(&c->lock);
+            memcpy(c->filters, filters, hdr.length);
+            c->num_filters = (uint8_t)num;
+            LeaveCriticalSection(&c->lock);
+
+        } else if (hdr.type == CANDLE_NET_MSG_SEND) {
+            if ((hdr.length % sizeof(candle_net_frame_t) != 0) || (hdr.length > sizeof(frames))
+                || !candle_net_recv_all(c->sock, frames, hdr.length))
+            {
+                break;
+            }
+            uint32_t failed = 0;
+            candle_err_t err = CANDLE_ERR_OK;
+            for (uint32_t i=0; i<hdr.length / sizeof(candle_net_frame_t); i++) {
+                if (frames[i].dev_index >= s->num_devices) {
+                    err = CANDLE_ERR_DEV_OUT_OF_RANGE;
+                    failed++;
+                    continue;
+                }
+                candle_device_t *dev = s->devs[frames[i].dev_index].dev;
+                if (!candle_frame_send(dev, frames[i].frame.channel, &frames[i].frame)) {
+                    err = dev->last_error;
+                    failed++;
+                }
+            }
+            if (failed > 0) {
+                candle_net_report_failures(c, failed, err);
+            }
+
+        } else {
+            break;
+        }
+    }
+
+    c->active = false;
+    SetEvent(c->event);
+    return 0;
+}
+
+static void candle_net_conn_free(candle_net_conn_t *c)
+{
+    c->active = false;
+    shutdown(c->sock, SD_BOTH);
+    SetEvent(c->event);
+
+    if (c->send_thread != NULL) {
+        WaitForSingleObject(c->send_thread, INFINITE);
+        CloseHandle(c->send_thread);
+    }
+    if (c->recv_thread != NULL) {
+        WaitForSingleObject(c->recv_thread, INFINITE);
+        CloseHandle(c->recv_thread);
+    }
+
+    closesocket(c->sock);
+    CloseHandle(c->event);
+    DeleteCriticalSection(&c->lock);
+    free(c->batch);
+    free(c->out);
+    free(c->spare);
+    free(c);
+}
+
+static void candle_net_accept_conn(candle_net_server_t *s, SOCKET sock)
+{
+    unsigned slot;
+    for (slot=0; slot<CANDLE_NET_MAX_CLIENTS; slot++) {
+        if (s->conns[slot] == NULL) {
+            break;
+        }
+    }
+
+    candle_net_conn_t *c = (slot < CANDLE_NET_MAX_CLIENTS) ? (candle_net_conn_t *)calloc(1, sizeof(candle_net_conn_t)) : NULL;
+    if (c == NULL) {
+        closesocket(sock);
+        return;
+    }
+
+    int nodelay = 1;
+    setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, (const char *)&nodelay, sizeof(nodelay));
+
+    c->server = s;
+    c->sock = sock;
+    c->active = true;
+    InitializeCriticalSection(&c->lock);
+    c->event = CreateEvent(NULL, false, false, NULL);
+    c->batch = (uint8_t *)malloc(sizeof(candle_net_header_t) + s->max_batch * sizeof(candle_net_frame_t));
+    c->out = (uint8_t *)malloc(CANDLE_NET_OUT_BUFFER);
+    c->spare = (uint8_t *)malloc(CANDLE_NET_OUT_BUFFER);
+
+    uint8_t hello[1 + CANDLE_MAX_DEVICES];
+    hello[0] = s->num_devices;
+    for (unsigned i=0; i<s->num_devices; i++) {
+        hello[1 + i] = s->devs[i].dev->dconf.icount + 1;
+    }
+
+    if ((c->event == NULL) || (c->batch == NULL) || (c->out == NULL) || (c->spare == NULL)
+        || !candle_net_send_msg(sock, CANDLE_NET_MSG_HELLO, hello, 1 + s->num_devices))
+    {
+        candle_net_conn_free(c);
+        return;
+    }
+
+    c->send_thread = CreateThread(NULL, 0, candle_net_conn_sender, c, 0, NULL);
+    c->recv_thread = CreateThread(NULL, 0, candle_net_conn_receiver, c, 0, NULL);
+    if ((c->send_thread == NULL) || (c->recv_thread == NULL)) {
+        candle_net_conn_free(c);
+        return;
+    }
+
+    EnterCriticalSection(&s->lock);
+    s->conns[slot] = c;
+    LeaveCriticalSection(&s->lock);
+}
+
+static DWORD WINAPI candle_net_acceptor(LPVOID param)
+{
+    candle_net_server_t *s = (candle_net_server_t *)param;
+
+    while (s->running) {
+
+        /* reap connections whose peer went away */
+        for (unsigned i=0; i<CANDLE_NET_MAX_CLIENTS; i++) {
+            candle_net_conn_t *c = s->conns[i];
+            if ((c != NULL) && !c->active) {
+                EnterCriticalSection(&s->lock);
+                s->conns[i] = NULL;
+                LeaveCriticalSection(&s->lock);
+                candle_net_conn_free(c);
+            }
+        }
+
+        fd_set readable;
+        FD_ZERO(&readable);
+        FD_SET(s->listen_sock, &readable);
+        struct timeval tv = { 0, CANDLE_NET_ACCEPT_POLL_MS * 1000 };
+        if (select(0, &readable, NULL, NULL, &tv) <= 0) {
+            continue;
+        }
+
+        SOCKET sock = accept(s->listen_sock, NULL, NULL);
+        if (sock != INVALID_SOCKET) {
+            candle_net_accept_conn(s, sock);
+        }
+    }
+
+    return 0;
+}
+
+DLL bool __stdcall candle_net_server_create(candle_net_server_handle *server, uint16_t port, uint32_t coalesce_us, uint32_t max_batch_frames)
+{
+    if (server==NULL) {
+        return false;
+    }
+
+    candle_net_server_t *s = (candle_net_server_t *)calloc(1, sizeof(candle_net_server_t));
+    *server = s;
+    if (s==NULL) {
+        return false;
+    }
+
+    InitializeCriticalSection(&s->lock);
+    s->listen_sock = INVALID_SOCKET;
+    s->port = port;
+    s->coalesce_us = coalesce_us;
+    s->max_batch = ((max_batch_frames == 0) || (max_batch_frames > CANDLE_NET_MAX_BATCH)) ? CANDLE_NET_MAX_BATCH : max_batch_frames;
+
+    s->wsa_started = candle_net_wsa_startup();
+    if (!s->wsa_started) {
+        s->last_error = CANDLE_ERR_NET_SOCKET;
+        return false;
+    }
+
+    s->last_error = CANDLE_ERR_OK;
+    return true;
+}
+
+DLL bool __stdcall candle_net_server_add_device(candle_net_server_handle server, candle_handle hdev, uint8_t *dev_index)
+{
+    candle_net_server_t *s = (candle_net_server_t *)server;
+
+    if (s->running) {
+        s->last_error = CANDLE_ERR_NET_RUNNING;
+        return false;
+    }
+
+    if (s->num_devices >= CANDLE_MAX_DEVICES) {
+        s->last_error = CANDLE_ERR_DEV_OUT_OF_RANGE;
+        return false;
+    }
+
+    candle_net_dev_t *nd = &s->devs[s->num_devices];
+    nd->server = s;
+    nd->dev = (candle_device_t *)hdev;
+    nd->index = s->num_devices;
+    *dev_index = s->num_devices++;
+
+    s->last_error = CANDLE_ERR_OK;
+    return true;
+}
+
+DLL bool __stdcall candle_net_server_start(candle_net_server_handle server)
+{
+    candle_net_server_t *s = (candle_net_server_t *)server;
+
+    if (s->running) {
+        s->last_error = CANDLE_ERR_NET_RUNNING;
+        return false;
+    }
+
+    s->listen_sock = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if (s->listen_sock == INVALID_SOCKET) {
+        s->last_error = CANDLE_ERR_NET_SOCKET;
+        return false;
+    }
+
+    int reuse = 1;
+    setsockopt(s->listen_sock, SOL_SOCKET, SO_REUSEADDR, (const char *)&reuse, sizeof(reuse));
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(s->port);
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+
+    if ((bind(s->listen_sock, (struct sockaddr *)&addr, sizeof(addr)) == SOCKET_ERROR)
+        || (listen(s->listen_sock, CANDLE_NET_MAX_CLIENTS) == SOCKET_ERROR))
+    {
+        closesocket(s->listen_sock);
+        s->listen_sock = INVALID_SOCKET;
+        s->last_error = CANDLE_ERR_NET_SOCKET;
+        return false;
+    }
+
+    s->running = true;
+    for (unsigned i=0; i<s->num_devices; i++) {
+        s->devs[i].thread = CreateThread(NULL, 0, candle_net_reader, &s->devs[i], 0, NULL);
+        if (s->devs[i].thread == NULL) {
+            candle_net_server_stop(s);
+            s->last_error = CANDLE_ERR_NET_THREAD;
+            return false;
+        }
+    }
+
+    s->accept_thread = CreateThread(NULL, 0, candle_net_acceptor, s, 0, NULL);
+    if (s->accept_thread == NULL) {
+        candle_net_server_stop(s);
+        s->last_error = CANDLE_ERR_NET_THREAD;
+        return false;
+    }
+
+    s->last_error = CANDLE_ERR_OK;
+    return true;
+}
+
+DLL bool __stdcall candle_net_server_stop(candle_net_server_handle server)
+{
+    candle_net_server_t *s = (candle_net_server_t *)server;
+
+    s->running = false;
+
+    for (unsigned i=0; i<s->num_devices; i++) {
+        if (s->devs[i].thread != NULL) {
+            WaitForSingleObject(s->devs[i].thread, INFINITE);
+            CloseHandle(s->devs[i].thread);
+            s->devs[i].thread = NULL;
+        }
+    }
+
+    if (s->accept_thread != NULL) {
+        WaitForSingleObject(s->accept_thread, INFINITE);
+        CloseHandle(s->accept_thread);
+        s->accept_thread = NULL;
+    }
+
+    if (s->listen_sock != INVALID_SOCKET) {
+        closesocket(s->listen_sock);
+        s->listen_sock = INVALID_SOCKET;
+    }
+
+    for (unsigned i=0; i<CANDLE_NET_MAX_CLIENTS; i++) {
+        if (s->conns[i] != NULL) {
+            candle_net_conn_free(s->conns[i]);
+            s->conns[i] = NULL;
+        }
+    }
+
+    s->last_error = CANDLE_ERR_OK;
+    return true;
+}
+
+DLL bool __stdcall candle_net_server_free(candle_net_server_handle server)
+{
+    candle_net_server_t *s = (candle_net_server_t *)server;
+
+    candle_net_server_stop(s);
+    DeleteCriticalSection(&s->lock);
+    if (s->wsa_started) {
+        WSACleanup();
+    }
+    free(s);
+    return true;
+}
+
+DLL candle_err_t __stdcall candle_net_server_last_error(candle_net_server_handle server)
+{
+    candle_net_server_t *s = (candle_net_server_t *)server;
+    return s->last_error;
+}
+
+static bool candle_net_client_recv(candle_net_client_t *c, candle_net_header_t *hdr)
+{
+    if (!candle_net_recv_all(c->sock, hdr, sizeof(*hdr))) {
+        c->last_error = CANDLE_ERR_NET_CLOSED;
+        return false;
+    }
+
+    if (hdr->magic != CANDLE_NET_MAGIC) {
+        c->last_error = CANDLE_ERR_NET_PROTOCOL;
+        return false;
+    }
+
+    if (hdr->length > CANDLE_NET_MAX_BATCH * sizeof(candle_net_frame_t)) {
+        c->last_error = CANDLE_ERR_NET_PROTOCOL;
+        return false;
+    }
+
+    if (hdr->length > c->buf_size) {
+        uint8_t *buf = (uint8_t *)realloc(c->buf, hdr->length);
+        if (buf == NULL) {
+            c->last_error = CANDLE_ERR_MALLOC;
+            return false;
+        }
+        c->buf = buf;
+        c->buf_size = hdr->length;
+    }
+
+    if (!candle_net_recv_all(c->sock, c->buf, hdr->length)) {
+        c->last_error = CANDLE_ERR_NET_CLOSED;
+        return false;
+    }
+
+    return true;
+}
+
+DLL bool __stdcall candle_net_connect(candle_net_client_handle *client, const char *host, uint16_t port)
+{
+    if (client==NULL) {
+        return false;
+    }
+
+    candle_net_client_t *c = (candle_net_client_t *)calloc(1, sizeof(candle_net_client_t));
+    *client = c;
+    if (c==NULL) {
+        return false;
+    }
+
+    c->sock = INVALID_SOCKET;
+    c->wsa_started = candle_net_wsa_startup();
+    if (!c->wsa_started) {
+        c->last_error = CANDLE_ERR_NET_SOCKET;
+        return false;
+    }
+
+    char service[8];
+    snprintf(service, sizeof(service), "%u", port);
+
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_protocol = IPPROTO_TCP;
+
+    struct addrinfo *res;
+    if (getaddrinfo(host, service, &hints, &res) != 0) {
+        c->last_error = CANDLE_ERR_NET_CONNECT;
+        return false;
+    }
+
+    for (struct addrinfo *ai=res; ai!=NULL; ai=ai->ai_next) {
+        c->sock = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if (c->sock == INVALID_SOCKET) {
+            continue;
+        }
+        if (connect(c->sock, ai->ai_addr, (int)ai->ai_addrlen) != SOCKET_ERROR) {
+            break;
+        }
+        closesocket(c->sock);
+        c->sock = INVALID_SOCKET;
+    }
+    freeaddrinfo(res);
+
+    if (c->sock == INVALID_SOCKET) {
+        c->last_error = CANDLE_ERR_NET_CONNECT;
+        return false;
+    }
+
+    int nodelay = 1;
+    setsockopt(c->sock, IPPROTO_TCP, TCP_NODELAY, (const char *)&nodelay, sizeof(nodelay));
+
+    candle_net_header_t hdr;
+    if (!candle_net_client_recv(c, &hdr)) {
+        return false;
+    }
+    if ((hdr.type != CANDLE_NET_MSG_HELLO) || (hdr.length < 1)) {
+        c->last_error = CANDLE_ERR_NET_PROTOCOL;
+        return false;
+    }
+    c->num_devices = c->buf[0];
+
+    c->last_error = CANDLE_ERR_OK;
+    return true;
+}
+
+DLL bool __stdcall candle_net_device_count(candle_net_client_handle client, uint8_t *num_devices)
+{
+    candle_net_client_t *c = (candle_net_client_t *)client;
+    *num_devices = c->num_devices;
+    c->last_error = CANDLE_ERR_OK;
+    return true;
+}
+
+DLL bool __stdcall candle_net_set_filters(candle_net_client_handle client, const candle_net_filter_t *filters, uint8_t num_filters)
+{
+    candle_net_client_t *c = (candle_net_client_t *)client;
+
+    if (num_filters > CANDLE_NET_MAX_FILTERS) {
+        c->last_error = CANDLE_ERR_NET_PROTOCOL;
+        return false;
+    }
+
+    if (!candle_net_send_msg(c->sock, CANDLE_NET_MSG_FILTER, filters, num_filters * sizeof(candle_net_filter_t))) {
+        c->last_error = CANDLE_ERR_NET_CLOSED;
+        return false;
+    }
+
+    c->last_error = CANDLE_ERR_OK;
+    return true;
+}
+
+DLL bool __stdcall candle_net_read(candle_net_client_handle client, candle_net_frame_t *frame, uint32_t timeout_ms)
+{
+    candle_net_client_t *c = (candle_net_client_t *)client;
+
+    while (c->buf_pos >= c->buf_frames) {
+        fd_set readable;
+        FD_ZERO(&readable);
+        FD_SET(c->sock, &readable);
+        struct timeval tv = { (long)(timeout_ms / 1000), (long)((timeout_ms % 1000) * 1000) };
+        int rc = select(0, &readable, NULL, NULL, (timeout_ms == INFINITE) ? NULL : &tv);
+        if (rc == 0) {
+            c->last_error = CANDLE_ERR_READ_TIMEOUT;
+            return false;
+        }
+        if (rc < 0) {
+            c->last_error = CANDLE_ERR_NET_CLOSED;
+            return false;
+        }
+
+        /* a message is sent in one piece, so the rest follows right away */
+        candle_net_header_t hdr;
+        if (!candle_net_client_recv(c, &hdr)) {
+            return false;
+        }
+        if ((hdr.type == CANDLE_NET_MSG_STATUS) && (hdr.length == sizeof(c->status))) {
+            memcpy(&c->status, c->buf, sizeof(c->status));
+            continue;
+        }
+        if ((hdr.type != CANDLE_NET_MSG_FRAMES) || (hdr.length % sizeof(candle_net_frame_t) != 0)) {
+            c->last_error = CANDLE_ERR_NET_PROTOCOL;
+            return false;
+        }
+
+        if (c->have_seq && (hdr.seq != c->next_seq)) {
+            c->lost += hdr.seq - c->next_seq;
+        }
+        c->have_seq = true;
+        c->next_seq = hdr.seq + 1;
+
+        c->buf_frames = hdr.length / sizeof(candle_net_frame_t);
+        c->buf_pos = 0;
+    }
+
+    memcpy(frame, c->buf + c->buf_pos * sizeof(candle_net_frame_t), sizeof(*frame));
+    c->buf_pos++;
+
+    c->last_error = CANDLE_ERR_OK;
+    return true;
+}
+
+DLL bool __stdcall candle_net_send(candle_net_client_handle client, uint8_t dev_index, uint8_t ch, const candle_frame_t *frame)
+{
+    candle_net_client_t *c = (candle_net_client_t *)client;
+
+    if (dev_index >= c->num_devices) {
+        c->last_error = CANDLE_ERR_DEV_OUT_OF_RANGE;
+        return false;
+    }
+
+    candle_net_frame_t nf;
+    nf.dev_index = dev_index;
+    nf.frame = *frame;
+    nf.frame.channel = ch;
+
+    if (!candle_net_send_msg(c->sock, CANDLE_NET_MSG_SEND, &nf, sizeof(nf))) {
+        c->last_error = CANDLE_ERR_NET_CLOSED;
+        return false;
+    }
+
+    c->last_error = CANDLE_ERR_OK;
+    return true;
+}
+
+DLL bool __stdcall candle_net_get_lost(candle_net_client_handle client, uint32_t *lost_batches)
+{
+    candle_net_client_t *c = (candle_net_client_t *)client;
+    *lost_batches = c->lost;
+    c->last_error = CANDLE_ERR_OK;
+    return true;
+}
+
+DLL bool __stdcall candle_net_get_send_failures(candle_net_client_handle client, uint32_t *failed_frames, candle_err_t *last_error)
+{
+    candle_net_client_t *c = (candle_net_client_t *)client;
+    *failed_frames = c->status.send_failed;
+    if (last_error != NULL) {
+        *last_error = (candle_err_t)c->status.last_error;
+    }
+    c->last_error = CANDLE_ERR_OK;
+    return true;
+}
+
+DLL bool __stdcall candle_net_disconnect(candle_net_client_handle client)
+{
+    candle_net_client_t *c = (candle_net_client_t *)client;
+
+    if (c->sock != INVALID_SOCKET) {
+        closesocket(c->sock);
+    }
+    free(c->buf);
+    if (c->wsa_started) {
+        WSACleanup();
+    }
+    free(c);
+    return true;
+}
+
+DLL candle_err_t __stdcall candle_net_client_last_error(candle_net_client_handle client)
+{
+    candle_net_client_t *c = (candle_net_client_t *)client;
+    return c->last_error;
+}
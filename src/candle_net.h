@@ -0,0 +1,84 @@
+/*
+
+  Copyright (c) 2016 Hubert Denkmair <hubert@denkmair.de>
+
+  This file is part of the candle windows API.
+  
+  This library is free software: you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation, either
+  version 3 of the License, or (at your option) any later version.
+ 
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+ 
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#pragma once
+#include "candle.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define CANDLE_NET_ANY 0xFF
+#define CANDLE_NET_MAX_FILTERS 32
+
+typedef void* candle_net_server_handle;
+typedef void* candle_net_client_handle;
+
+#pragma pack(push,1)
+
+typedef struct {
+    uint8_t dev_index;
+    candle_frame_t frame;
+} candle_net_frame_t;
+
+typedef struct {
+    uint8_t dev_index; /* or CANDLE_NET_ANY */
+    uint8_t channel;   /* or CANDLE_NET_ANY */
+    uint16_t reserved;
+    uint32_t can_id;   /* including the extended id, rtr and error flag bits */
+    uint32_t mask;
+} candle_net_filter_t;
+
+#pragma pack(pop)
+
+/*
+ * Streams the frames received from opened devices to TCP clients. The
+ * server reads the devices itself. Frames are collected per client into
+ * batches that are sent once max_batch_frames are pending, or once the
+ * oldest pending frame is coalesce_us old. Every batch carries a sequence
+ * number; batches that do not fit into a slow client's send buffer are
+ * dropped, which the client sees as a gap (candle_net_get_lost).
+ * Clients can set filters and send frames through the server's devices.
+ * candle_net_send returns once the frame is handed to the connection; the
+ * server reports frames it could not transmit back on the frame stream, and
+ * candle_net_get_send_failures returns the count as of the last
+ * candle_net_read.
+ */
+DLL bool __stdcall candle_net_server_create(candle_net_server_handle *server, uint16_t port, uint32_t coalesce_us, uint32_t max_batch_frames);
+DLL bool __stdcall candle_net_server_add_device(candle_net_server_handle server, candle_handle hdev, uint8_t *dev_index);
+DLL bool __stdcall candle_net_server_start(candle_net_server_handle server);
+DLL bool __stdcall candle_net_server_stop(candle_net_server_handle server);
+DLL bool __stdcall candle_net_server_free(candle_net_server_handle server);
+DLL candle_err_t __stdcall candle_net_server_last_error(candle_net_server_handle server);
+
+DLL bool __stdcall candle_net_connect(candle_net_client_handle *client, const char *host, uint16_t port);
+DLL bool __stdcall candle_net_device_count(candle_net_client_handle client, uint8_t *num_devices);
+DLL bool __stdcall candle_net_set_filters(candle_net_client_handle client, const candle_net_filter_t *filters, uint8_t num_filters);
+DLL bool __stdcall candle_net_read(candle_net_client_handle client, candle_net_frame_t *frame, uint32_t timeout_ms);
+DLL bool __stdcall candle_net_send(candle_net_client_handle client, uint8_t dev_index, uint8_t ch, const candle_frame_t *frame);
+DLL bool __stdcall candle_net_get_lost(candle_net_client_handle client, uint32_t *lost_batches);
+DLL bool __stdcall candle_net_get_send_failures(candle_net_client_handle client, uint32_t *failed_frames, candle_err_t *last_error);
+DLL bool __stdcall candle_net_disconnect(candle_net_client_handle client);
+DLL candle_err_t __stdcall candle_net_client_last_error(candle_net_client_handle client);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,194 @@
+/*
+
+  Copyright (c) 2016 Hubert Denkmair <hubert@denkmair.de>
+
+  This file is part of the candle windows API.
+  
+  This library is free software: you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation, either
+  version 3 of the License, or (at your option) any later version.
+ 
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+ 
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include "candle_reactor.h"
+#include <stdlib.h>
+
+#include "candle_defs.h"
+#include "candle_rx.h"
+
+#define CANDLE_REACTOR_MAX_BATCH 64
+
+typedef struct {
+    HANDLE port;
+    candle_err_t last_error;
+} candle_reactor_t;
+
+DLL bool __stdcall candle_reactor_create(candle_reactor_handle *reactor)
+{
+    if (reactor==NULL) {
+        return false;
+    }
+
+    candle_reactor_t *r = (candle_reactor_t *)calloc(1, sizeof(candle_reactor_t));
+    *reactor = r;
+    if (r==NULL) {
+        return false;
+    }
+
+    r->port = CreateIoCompletionPort(INVALID_HANDLE_VALUE, NULL, 0, 0);
+    if (r->port == NULL) {
+        free(r);
+        *reactor = NULL;
+        return false;
+    }
+
+    r->last_error = CANDLE_ERR_OK;
+    return true;
+}
+
+DLL bool __stdcall candle_reactor_add_device(candle_reactor_handle reactor, candle_handle hdev)
+{
+    candle_reactor_t *r = (candle_reactor_t *)reactor;
+    candle_device_t *dev = (candle_device_t *)hdev;
+    if ((r==NULL) || (dev==NULL)) {
+        return false;
+    }
+
+    /* transfers started before the association would not post to the port,
+       so cancel them, associate the handle and start them again */
+    WinUsb_AbortPipe(dev->winUSBHandle, dev->bulkInPipe);
+    for (unsigned i=0; i<CANDLE_URB_COUNT; i++) {
+        if ((dev->rx_borrowed & (1L << i)) == 0) {
+            DWORD bytes_transfered;
+            WinUsb_GetOverlappedResult(dev->winUSBHandle, &dev->rxurbs[i].ovl, &bytes_transfered, true);
+        }
+    }
+
+    if (CreateIoCompletionPort(dev->deviceHandle, r->port, (ULONG_PTR)dev, 0) == NULL) {
+        r->last_error = CANDLE_ERR_REACTOR_ASSOCIATE;
+        return false;
+    }
+
+    dev->rx_failed = 0;
+
+    for (unsigned i=0; i<CANDLE_URB_COUNT; i++) {
+        if ((dev->rx_borrowed & (1L << i)) == 0) {
+            if (!candle_prepare_read(dev, i)) {
+                r->last_error = dev->last_error;
+                return false;
+            }
+        }
+    }
+
+    r->last_error = CANDLE_ERR_OK;
+    return true;
+}
+
+DLL bool __stdcall candle_reactor_read(candle_reactor_handle reactor, candle_reactor_frame_t *frames, uint32_t max_frames, uint32_t *num_frames, uint32_t timeout_ms)
+{
+    candle_reactor_t *r = (candle_reactor_t *)reactor;
+    if ((r==NULL) || (frames==NULL) || (num_frames==NULL)) {
+        return false;
+    }
+
+    *num_frames = 0;
+
+    if (max_frames == 0) {
+        r->last_error = CANDLE_ERR_REACTOR_BATCH;
+        return false;
+    }
+
+    OVERLAPPED_ENTRY entries[CANDLE_REACTOR_MAX_BATCH];
+    ULONG num_entries = 0;
+    ULONG max_entries = (max_frames < CANDLE_REACTOR_MAX_BATCH) ? max_frames : CANDLE_REACTOR_MAX_BATCH;
+
+    if (!GetQueuedCompletionStatusEx(r->port, entries, max_entries, &num_entries, timeout_ms, false)) {
+        r->last_error = (GetLastError() == WAIT_TIMEOUT) ? CANDLE_ERR_READ_TIMEOUT : CANDLE_ERR_READ_WAIT;
+        return false;
+    }
+
+    uint32_t count = 0;
+    candle_err_t err = CANDLE_ERR_OK;
+    for (ULONG i=0; i<num_entries; i++) {
+
+        if (entries[i].lpOverlapped == NULL) {
+            continue; // posted by candle_reactor_wakeup
+        }
+
+        candle_device_t *dev = (candle_device_t *)entries[i].lpCompletionKey;
+        if (dev == NULL) {
+            continue;
+        }
+
+        /* only receive urbs are expected here, skip any other completion
+           that reaches the port instead of treating it as one */
+        ULONG_PTR offset = (ULONG_PTR)entries[i].lpOverlapped - (ULONG_PTR)&dev->rxurbs[0].ovl;
+        unsigned urb_num = (unsigned)(offset / sizeof(canlde_rx_urb));
+        if ((urb_num >= CANDLE_URB_COUNT) || (&dev->rxurbs[urb_num].ovl != entries[i].lpOverlapped)) {
+            continue;
+        }
+        canlde_rx_urb *urb = &dev->rxurbs[urb_num];
+
+        DWORD bytes_transfered;
+        if (!WinUsb_GetOverlappedResult(dev->winUSBHandle, &urb->ovl, &bytes_transfered, false)) {
+            /* aborted or unplugged, restarting the transfer would only fail again */
+            InterlockedExchange(&dev->rx_failed, 1);
+            dev->last_error = CANDLE_ERR_READ_RESULT;
+            err = CANDLE_ERR_READ_RESULT;
+            continue;
+        }
+
+        if (bytes_transfered != sizeof(candle_frame_t)) {
+            dev->last_error = CANDLE_ERR_READ_SIZE;
+            err = CANDLE_ERR_READ_SIZE;
+        } else if (candle_rx_dispatch(dev, (const candle_frame_t *)urb->buf)) {
+            frames[count].hdev = dev;
+            memcpy(&frames[count].frame, urb->buf, sizeof(candle_frame_t));
+            count++;
+        }
+
+        if (!dev->rx_failed) {
+            candle_prepare_read(dev, urb_num);
+        }
+    }
+
+    *num_frames = count;
+    r->last_error = err;
+    return err == CANDLE_ERR_OK;
+}
+
+DLL bool __stdcall candle_reactor_wakeup(candle_reactor_handle reactor)
+{
+    candle_reactor_t *r = (candle_reactor_t *)reactor;
+    if (r==NULL) {
+        return false;
+    }
+    return PostQueuedCompletionStatus(r->port, 0, 0, NULL);
+}
+
+DLL bool __stdcall candle_reactor_free(candle_reactor_handle reactor)
+{
+    candle_reactor_t *r = (candle_reactor_t *)reactor;
+    if (r==NULL) {
+        return false;
+    }
+
+    CloseHandle(r->port);
+    free(r);
+    return true;
+}
+
+DLL candle_err_t __stdcall candle_reactor_last_error(candle_reactor_handle reactor)
+{
+    candle_reactor_t *r = (candle_reactor_t *)reactor;
+    return r->last_error;
+}
@@ -0,0 +1,63 @@
+/*
+
+  Copyright (c) 2016 Hubert Denkmair <hubert@denkmair.de>
+
+  This file is part of the candle windows API.
+  
+  This library is free software: you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation, either
+  version 3 of the License, or (at your option) any later version.
+ 
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+ 
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#pragma once
+#include "candle.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef void* candle_reactor_handle;
+
+#pragma pack(push,1)
+
+typedef struct {
+    candle_handle hdev;
+    candle_frame_t frame;
+} candle_reactor_frame_t;
+
+#pragma pack(pop)
+
+/*
+ * Services the receive transfers of any number of opened devices through a
+ * single I/O completion port. candle_reactor_read may be called from several
+ * threads at once; each call returns a batch of frames tagged with the device
+ * they came from. Frames of a registered device are only delivered through
+ * the reactor, so do not call candle_frame_read on it anymore.
+ * If a transfer of the batch failed, candle_reactor_read returns false with
+ * CANDLE_ERR_READ_RESULT or CANDLE_ERR_READ_SIZE and num_frames still holds
+ * the frames received along with it. After CANDLE_ERR_READ_RESULT the
+ * device's transfers are not restarted; call candle_reactor_add_device again
+ * to resume reading it. max_frames has to be at least 1.
+ * Free the reactor before closing its devices.
+ */
+DLL bool __stdcall candle_reactor_create(candle_reactor_handle *reactor);
+DLL bool __stdcall candle_reactor_add_device(candle_reactor_handle reactor, candle_handle hdev);
+DLL bool __stdcall candle_reactor_read(candle_reactor_handle reactor, candle_reactor_frame_t *frames, uint32_t max_frames, uint32_t *num_frames, uint32_t timeout_ms);
+DLL bool __stdcall candle_reactor_wakeup(candle_reactor_handle reactor);
+DLL bool __stdcall candle_reactor_free(candle_reactor_handle reactor);
+
+DLL candle_err_t __stdcall candle_reactor_last_error(candle_reactor_handle reactor);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,463 @@
+/*
+
+  Copyright (c) 2016 Hubert Denkmair <hubert@denkmair.de>
+
+  This file is part of the candle windows API.
+  
+  This library is free software: you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation, either
+  version 3 of the License, or (at your option) any later version.
+ 
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+ 
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include "candle_recorder.h"
+#include <stdlib.h>
+#include <string.h>
+
+#include "candle_defs.h"
+#include "candle_rx.h"
+#include "candle_archive.h"
+
+#define CANDLE_RECORDER_POLL_MS 50
+#define CANDLE_RECORDER_WRITE_CHUNK 256
+
+typedef struct {
+    candle_frame_t *frames; /* num_channels rings of capacity frames */
+    uint64_t *seq;          /* arrival order, to merge the channels again */
+    uint32_t head[CANDLE_MAX_CHANNELS];
+    uint32_t count[CANDLE_MAX_CHANNELS];
+} candle_recorder_set_t;
+
+struct candle_recorder {
+    CRITICAL_SECTION lock;
+    HANDLE thread;
+    HANDLE wake_event;
+    volatile bool running;
+
+    uint8_t num_channels;
+    uint32_t capacity;
+    uint32_t pre_us;
+    uint32_t post_us;
+    wchar_t path_format[MAX_PATH];
+
+    candle_recorder_set_t sets[2];
+    candle_recorder_set_t *active;
+    candle_recorder_set_t *frozen; /* rings of the dump being completed or written, NULL if none */
+    uint64_t seq;
+    uint32_t last_ts;
+
+    bool in_post;
+    bool dump_ready;
+    uint32_t trigger_ts;
+    ULONGLONG post_deadline;
+    candle_frame_t *post;
+    uint32_t post_len;
+    uint32_t post_cap;
+
+    uint32_t num_dumps;
+    uint32_t dumps_written;
+    uint32_t triggers_dropped;
+
+    uint8_t num_triggers;
+    candle_trigger_t triggers[CANDLE_RECORDER_MAX_TRIGGERS];
+};
+
+static bool candle_recorder_matches(const candle_trigger_t *t, const candle_frame_t *frame)
+{
+    if ((t->channel != CANDLE_TRIGGER_ANY_CHANNEL) && (t->channel != frame->channel)) {
+        return false;
+    }
+
+    bool is_error = (frame->can_id & 0x20000000) != 0;
+    switch (t->type) {
+        case CANDLE_TRIGGER_ERROR_FRAME:
+            return is_error;
+
+        case CANDLE_TRIGGER_BUS_OFF:
+            return is_error && ((frame->can_id & 0x40) != 0);
+
+        case CANDLE_TRIGGER_FRAME:
+            if (is_error || (frame->echo_id != 0xFFFFFFFF) || (((frame->can_id ^ t->can_id) & t->id_mask) != 0)) {
+                return false;
+            }
+            for (unsigned i=0; i<8; i++) {
+                if (((frame->data[i] ^ t->data[i]) & t->data_mask[i]) != 0) {
+                    return false;
+                }
+            }
+            return true;
+
+        default:
+            return false;
+    }
+}
+
+/* call with lock held */
+static void candle_recorder_fire(struct candle_recorder *r, uint32_t timestamp_us)
+{
+    if (r->frozen != NULL) {
+        r->triggers_dropped++;
+        return;
+    }
+
+    r->frozen = r->active;
+    r->active = (r->frozen == &r->sets[0]) ? &r->sets[1] : &r->sets[0];
+    memset(r->active->head, 0, sizeof(r->active->head));
+    memset(r->active->count, 0, sizeof(r->active->count));
+
+    r->trigger_ts = timestamp_us;
+    r->post_len = 0;
+    r->post_deadline = GetTickCount64() + r->post_us / 1000 + 1;
+    r->in_post = (r->post_us != 0);
+    r->dump_ready = !r->in_post;
+    if (r->dump_ready) {
+        SetEvent(r->wake_event);
+    }
+}
+
+bool candle_recorder_update(struct candle_recorder *r, const candle_frame_t *frame)
+{
+    if (frame->channel >= r->num_channels) {
+        return true;
+    }
+
+    EnterCriticalSection(&r->lock);
+
+    candle_recorder_set_t *s = r->active;
+    uint32_t pos = frame->channel * r->capacity + s->head[frame->channel];
+    s->frames[pos] = *frame;
+    s->seq[pos] = r->seq++;
+    s->head[frame->channel] = (s->head[frame->channel] + 1) % r->capacity;
+    if (s->count[frame->channel] < r->capacity) {
+        s->count[frame->channel]++;
+    }
+    r->last_ts = frame->timestamp_us;
+
+    if (r->in_post) {
+        if (r->post_len < r->post_cap) {
+            r->post[r->post_len++] = *frame;
+        }
+        if ((frame->timestamp_us - r->trigger_ts >= r->post_us) || (r->post_len == r->post_cap)) {
+            r->in_post = false;
+            r->dump_ready = true;
+            SetEvent(r->wake_event);
+        }
+    } else {
+        for (unsigned i=0; i<r->num_triggers; i++) {
+            if (candle_recorder_matches(&r->triggers[i], frame)) {
+                candle_recorder_fire(r, frame->timestamp_us);
+                break;
+            }
+        }
+    }
+
+    LeaveCriticalSection(&r->lock);
+    return true;
+}
+
+static bool candle_recorder_write(struct candle_recorder *r, const wchar_t *path)
+{
+    candle_frame_t chunk[CANDLE_RECORDER_WRITE_CHUNK];
+    uint32_t n = 0;
+    uint32_t pos[CANDLE_MAX_CHANNELS];
+    uint32_t left[CANDLE_MAX_CHANNELS];
+    candle_recorder_set_t *s = r->frozen;
+
+    candle_archive_handle archive;
+    bool ok = candle_archive_create(&archive, path);
+
+    for (uint8_t ch=0; ch<r->num_channels; ch++) {
+        left[ch] = s->count[ch];
+        pos[ch] = (s->head[ch] + r->capacity - s->count[ch]) % r->capacity;
+    }
+
+    /* merge the channel rings back into arrival order */
+    while (ok) {
+        int best = -1;
+        for (uint8_t ch=0; ch<r->num_channels; ch++) {
+            if ((left[ch] > 0) && ((best < 0) || (s->seq[ch * r->capacity + pos[ch]] < s->seq[best * r->capacity + pos[best]]))) {
+                best = ch;
+            }
+        }
+        if (best < 0) {
+            break;
+        }
+
+        const candle_frame_t *f = &s->frames[best * r->capacity + pos[best]];
+        pos[best] = (pos[best] + 1) % r->capacity;
+        left[best]--;
+
+        if ((r->pre_us != 0) && (r->trigger_ts - f->timestamp_us > r->pre_us)) {
+            continue;
+        }
+
+        chunk[n++] = *f;
+        if (n == CANDLE_RECORDER_WRITE_CHUNK) {
+            ok = candle_archive_write(archive, chunk, n);
+            n = 0;
+        }
+    }
+
+    if (ok && (n > 0)) {
+        ok = candle_archive_write(archive, chunk, n);
+    }
+    if (ok && (r->post_len > 0)) {
+        ok = candle_archive_write(archive, r->post, r->post_len);
+    }
+
+    return candle_archive_close(archive) && ok;
+}
+
+static DWORD WINAPI candle_recorder_writer(LPVOID param)
+{
+    struct candle_recorder *r = (struct candle_recorder *)param;
+
+    for (;;) {
+        bool running = r->running;
+        if (running) {
+            WaitForSingleObject(r->wake_event, CANDLE_RECORDER_POLL_MS);
+        }
+
+        EnterCriticalSection(&r->lock);
+        if (r->in_post && (!running || (GetTickCount64() >= r->post_deadline))) {
+            /* the bus went quiet (or we are shutting down) before the post trigger window ended */
+            r->in_post = false;
+            r->dump_ready = true;
+        }
+        bool write = r->dump_ready;
+        uint32_t num = r->num_dumps;
+        LeaveCriticalSection(&r->lock);
+
+        if (write) {
+            /* frozen and post are not touched by the receive path until frozen is released */
+            wchar_t path[MAX_PATH];
+            bool written = SUCCEEDED(StringCchPrintf(path, MAX_PATH, r->path_format, num))
+                        && candle_recorder_write(r, path);
+
+            EnterCriticalSection(&r->lock);
+            if (written) {
+                r->dumps_written++;
+            }
+            r->num_dumps++;
+            r->dump_ready = false;
+            r->frozen = NULL;
+            LeaveCriticalSection(&r->lock);
+        }
+
+        if (!running) {
+            break;
+        }
+    }
+
+    return 0;
+}
+
+static void candle_recorder_free(struct candle_recorder *r)
+{
+    for (unsigned i=0; i<2; i++) {
+        free(r->sets[i].frames);
+        free(r->sets[i].seq);
+    }
+    free(r->post);
+    if (r->wake_event != NULL) {
+        CloseHandle(r->wake_event);
+    }
+    DeleteCriticalSection(&r->lock);
+    free(r);
+}
+
+/* path_format is used as a format string, so it may only contain %% and a
+   single unsigned conversion with optional zero padding and width */
+static bool candle_recorder_check_format(const wchar_t *fmt)
+{
+    unsigned conversions = 0;
+
+    for (const wchar_t *p = fmt; *p != 0; p++) {
+        if (*p != L'%') {
+            continue;
+        }
+        p++;
+        if (*p == L'%') {
+            continue;
+        }
+        while ((*p >= L'0') && (*p <= L'9')) {
+            p++;
+        }
+        if ((*p != L'u') && (*p != L'x') && (*p != L'X')) {
+            return false;
+        }
+        conversions++;
+    }
+
+    return conversions == 1;
+}
+
+DLL bool __stdcall candle_recorder_enable(candle_handle hdev, uint32_t frames_per_channel, uint32_t pre_trigger_us, uint32_t post_trigger_us, const wchar_t *path_format)
+{
+    candle_device_t *dev = (candle_device_t*)hdev;
+
+    if (dev->recorder != NULL) {
+        candle_recorder_disable(dev);
+    }
+
+    uint8_t num_channels = dev->dconf.icount + 1;
+    if ((frames_per_channel == 0) || (num_channels > CANDLE_MAX_CHANNELS) || (path_format == NULL)
+        || !candle_recorder_check_format(path_format))
+    {
+        dev->last_error = CANDLE_ERR_RECORDER_CONFIG;
+        return false;
+    }
+
+    struct candle_recorder *r = (struct candle_recorder *)calloc(1, sizeof(struct candle_recorder));
+    if (r == NULL) {
+        dev->last_error = CANDLE_ERR_MALLOC;
+        return false;
+    }
+
+    InitializeCriticalSection(&r->lock);
+    r->num_channels = num_channels;
+    r->capacity = frames_per_channel;
+    r->pre_us = pre_trigger_us;
+    r->post_us = post_trigger_us;
+    r->post_cap = frames_per_channel * num_channels;
+    r->active = &r->sets[0];
+
+    if (FAILED(StringCchCopy(r->path_format, MAX_PATH, path_format))) {
+        candle_recorder_free(r);
+        dev->last_error = CANDLE_ERR_RECORDER_CONFIG;
+        return false;
+    }
+
+    size_t ring_frames = (size_t)frames_per_channel * num_channels;
+    for (unsigned i=0; i<2; i++) {
+        r->sets[i].frames = (candle_frame_t *)malloc(ring_frames * sizeof(candle_frame_t));
+        r->sets[i].seq = (uint64_t *)malloc(ring_frames * sizeof(uint64_t));
+    }
+    r->post = (candle_frame_t *)malloc(r->post_cap * sizeof(candle_frame_t));
+    if ((r->sets[0].frames == NULL) || (r->sets[0].seq == NULL) || (r->sets[1].frames == NULL)
+        || (r->sets[1].seq == NULL) || (r->post == NULL))
+    {
+        candle_recorder_free(r);
+        dev->last_error = CANDLE_ERR_MALLOC;
+        return false;
+    }
+
+    r->wake_event = CreateEvent(NULL, false, false, NULL);
+    r->running = true;
+    r->thread = (r->wake_event != NULL) ? CreateThread(NULL, 0, candle_recorder_writer, r, 0, NULL) : NULL;
+    if (r->thread == NULL) {
+        candle_recorder_free(r);
+        dev->last_error = CANDLE_ERR_RECORDER_CONFIG;
+        return false;
+    }
+
+    dev->recorder = r;
+    dev->last_error = CANDLE_ERR_OK;
+    return true;
+}
+
+DLL bool __stdcall candle_recorder_add_trigger(candle_handle hdev, const candle_trigger_t *trigger)
+{
+    candle_device_t *dev = (candle_device_t*)hdev;
+    struct candle_recorder *r = dev->recorder;
+
+    if (r == NULL) {
+        dev->last_error = CANDLE_ERR_RECORDER_DISABLED;
+        return false;
+    }
+
+    EnterCriticalSection(&r->lock);
+    bool rc = (r->num_triggers < CANDLE_RECORDER_MAX_TRIGGERS);
+    if (rc) {
+        r->triggers[r->num_triggers++] = *trigger;
+    }
+    LeaveCriticalSection(&r->lock);
+
+    dev->last_error = rc ? CANDLE_ERR_OK : CANDLE_ERR_RECORDER_CONFIG;
+    return rc;
+}
+
+DLL bool __stdcall candle_recorder_clear_triggers(candle_handle hdev)
+{
+    candle_device_t *dev = (candle_device_t*)hdev;
+    struct candle_recorder *r = dev->recorder;
+
+    if (r == NULL) {
+        dev->last_error = CANDLE_ERR_RECORDER_DISABLED;
+        return false;
+    }
+
+    EnterCriticalSection(&r->lock);
+    r->num_triggers = 0;
+    LeaveCriticalSection(&r->lock);
+
+    dev->last_error = CANDLE_ERR_OK;
+    return true;
+}
+
+DLL bool __stdcall candle_recorder_trigger(candle_handle hdev)
+{
+    candle_device_t *dev = (candle_device_t*)hdev;
+    struct candle_recorder *r = dev->recorder;
+
+    if (r == NULL) {
+        dev->last_error = CANDLE_ERR_RECORDER_DISABLED;
+        return false;
+    }
+
+    /* the trigger time is that of the last frame received */
+    EnterCriticalSection(&r->lock);
+    bool rc = (r->frozen == NULL);
+    candle_recorder_fire(r, r->last_ts);
+    LeaveCriticalSection(&r->lock);
+
+    dev->last_error = rc ? CANDLE_ERR_OK : CANDLE_ERR_RECORDER_BUSY;
+    return rc;
+}
+
+DLL bool __stdcall candle_recorder_get_status(candle_handle hdev, uint32_t *dumps_written, uint32_t *triggers_dropped)
+{
+    candle_device_t *dev = (candle_device_t*)hdev;
+    struct candle_recorder *r = dev->recorder;
+
+    if (r == NULL) {
+        dev->last_error = CANDLE_ERR_RECORDER_DISABLED;
+        return false;
+    }
+
+    EnterCriticalSection(&r->lock);
+    *dumps_written = r->dumps_written;
+    *triggers_dropped = r->triggers_dropped;
+    LeaveCriticalSection(&r->lock);
+
+    dev->last_error = CANDLE_ERR_OK;
+    return true;
+}
+
+DLL bool __stdcall candle_recorder_disable(candle_handle hdev)
+{
+    candle_device_t *dev = (candle_device_t*)hdev;
+    struct candle_recorder *r = dev->recorder;
+
+    dev->recorder = NULL;
+    if (r != NULL) {
+        /* the writer finishes a pending dump before it exits */
+        r->running = false;
+        SetEvent(r->wake_event);
+        WaitForSingleObject(r->thread, INFINITE);
+        CloseHandle(r->thread);
+        candle_recorder_free(r);
+    }
+
+    dev->last_error = CANDLE_ERR_OK;
+    return true;
+}
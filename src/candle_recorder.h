@@ -0,0 +1,73 @@
+/*
+
+  Copyright (c) 2016 Hubert Denkmair <hubert@denkmair.de>
+
+  This file is part of the candle windows API.
+  
+  This library is free software: you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation, either
+  version 3 of the License, or (at your option) any later version.
+ 
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+ 
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#pragma once
+#include "candle.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define CANDLE_RECORDER_MAX_TRIGGERS 16
+#define CANDLE_TRIGGER_ANY_CHANNEL 0xFF
+
+typedef enum {
+    CANDLE_TRIGGER_FRAME       = 0, /* received frame matching can_id/id_mask and data/data_mask */
+    CANDLE_TRIGGER_ERROR_FRAME = 1, /* any error frame */
+    CANDLE_TRIGGER_BUS_OFF     = 2  /* error frame reporting bus-off */
+} candle_trigger_type_t;
+
+#pragma pack(push,1)
+
+typedef struct {
+    uint8_t type;    /* candle_trigger_type_t */
+    uint8_t channel; /* or CANDLE_TRIGGER_ANY_CHANNEL */
+    uint16_t reserved;
+    uint32_t can_id;
+    uint32_t id_mask;
+    uint8_t data[8];
+    uint8_t data_mask[8];
+} candle_trigger_t;
+
+#pragma pack(pop)
+
+/*
+ * Keeps the last frames_per_channel frames of every channel in memory. When a
+ * trigger fires, the frames of the last pre_trigger_us (0: the whole ring)
+ * and those following within post_trigger_us are written to a new archive
+ * (see candle_archive.h). path_format is a printf style path with exactly one
+ * %u, %x or %X (optionally with zero padding and width, e.g. %04u) replaced
+ * by the number of the dump; any other conversion is rejected.
+ * Triggering swaps in a second set of rings, so recording goes on while a
+ * background thread writes the dump. A trigger that fires before the
+ * previous dump is written is dropped and counted.
+ * Enable and disable the recorder while no thread is reading from the device.
+ */
+DLL bool __stdcall candle_recorder_enable(candle_handle hdev, uint32_t frames_per_channel, uint32_t pre_trigger_us, uint32_t post_trigger_us, const wchar_t *path_format);
+DLL bool __stdcall candle_recorder_add_trigger(candle_handle hdev, const candle_trigger_t *trigger);
+DLL bool __stdcall candle_recorder_clear_triggers(candle_handle hdev);
+DLL bool __stdcall candle_recorder_trigger(candle_handle hdev);
+DLL bool __stdcall candle_recorder_get_status(candle_handle hdev, uint32_t *dumps_written, uint32_t *triggers_dropped);
+DLL bool __stdcall candle_recorder_disable(candle_handle hdev);
+
+#ifdef __cplusplus
+}
+#endif
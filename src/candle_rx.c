@@ -0,0 +1,113 @@
+/*
+
+  Copyright (c) 2016 Hubert Denkmair <hubert@denkmair.de>
+
+  This file is part of the candle windows API.
+  
+  This library is free software: you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation, either
+  version 3 of the License, or (at your option) any later version.
+ 
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+ 
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include "candle_rx.h"
+
+uint32_t candle_rx_time_left(ULONGLONG start, uint32_t timeout_ms)
+{
+    if (timeout_ms == INFINITE) {
+        return INFINITE;
+    }
+
+    ULONGLONG elapsed = GetTickCount64() - start;
+    return (elapsed >= timeout_ms) ? 0 : (uint32_t)(timeout_ms - elapsed);
+}
+
+bool candle_rx_spin(candle_device_t *dev, uint32_t timeout_ms, DWORD *urb)
+{
+    LARGE_INTEGER freq, start, now;
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&start);
+
+    uint64_t budget_us = dev->rx_spin_budget_us;
+    if ((timeout_ms != INFINITE) && (budget_us > (uint64_t)timeout_ms * 1000)) {
+        budget_us = (uint64_t)timeout_ms * 1000;
+    }
+    LONGLONG budget_ticks = (LONGLONG)(budget_us * (uint64_t)freq.QuadPart / 1000000);
+
+    for (;;) {
+        LONG borrowed = dev->rx_borrowed;
+
+        /* urbs complete in the order they were queued, so start behind the last hit */
+        for (DWORD k=0; k<CANDLE_URB_COUNT; k++) {
+            DWORD i = (dev->rx_spin_next + k) % CANDLE_URB_COUNT;
+            if ((borrowed & (1L << i)) || !HasOverlappedIoCompleted(&dev->rxurbs[i].ovl)) {
+                continue;
+            }
+
+            QueryPerformanceCounter(&now);
+            uint64_t elapsed_us = (uint64_t)(now.QuadPart - start.QuadPart) * 1000000 / (uint64_t)freq.QuadPart;
+            uint64_t grown = 2 * elapsed_us;
+            if (grown > dev->rx_spin_budget_us) {
+                dev->rx_spin_budget_us = (grown < dev->rx_spin_max_us) ? (uint32_t)grown : dev->rx_spin_max_us;
+            }
+
+            dev->rx_spin_next = (i + 1) % CANDLE_URB_COUNT;
+            dev->rx_spin_hits++;
+            *urb = i;
+            return true;
+        }
+
+        QueryPerformanceCounter(&now);
+        if (now.QuadPart - start.QuadPart >= budget_ticks) {
+            break;
+        }
+        YieldProcessor();
+    }
+
+    /* nothing arrived within the budget; spin less until traffic picks up */
+    dev->rx_spin_budget_us /= 2;
+    if (dev->rx_spin_budget_us < dev->rx_spin_min_us) {
+        dev->rx_spin_budget_us = dev->rx_spin_min_us;
+    }
+    dev->rx_blocks++;
+    return false;
+}
+
+bool candle_rx_dispatch(candle_device_t *dev, const candle_frame_t *frame)
+{
+    bool deliver = true;
+
+    /* routing does not depend on what the application filters out */
+    if (dev->gateway != NULL) {
+        deliver = candle_gateway_forward(dev->gateway, frame);
+    }
+
+    if (dev->recorder != NULL) {
+        deliver = candle_recorder_update(dev->recorder, frame) && deliver;
+    }
+
+    if ((dev->txq != NULL) && (frame->echo_id != 0xFFFFFFFF)) {
+        deliver = candle_txq_on_echo(dev, frame) && deliver;
+    }
+
+    if (dev->cache != NULL) {
+        deliver = candle_cache_update(dev->cache, frame) && deliver;
+    }
+
+    if (dev->isotp != NULL) {
+        deliver = candle_isotp_on_frame(dev, frame) && deliver;
+    }
+
+    /* the receive filters only decide what the application reads, the
+       consumers above always see every frame */
+    return candle_config_filter(dev, frame) && deliver;
+}
@@ -0,0 +1,48 @@
+/*
+
+  Copyright (c) 2016 Hubert Denkmair <hubert@denkmair.de>
+
+  This file is part of the candle windows API.
+  
+  This library is free software: you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation, either
+  version 3 of the License, or (at your option) any later version.
+ 
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+ 
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#pragma once
+
+#include "candle_defs.h"
+#include "candle_txq.h"
+
+bool candle_prepare_read(candle_device_t *dev, unsigned urb_num);
+uint32_t candle_rx_time_left(ULONGLONG start, uint32_t timeout_ms);
+
+/* runs the receive hooks for a frame; returns false if it is consumed and
+   must not be handed to the application */
+bool candle_rx_dispatch(candle_device_t *dev, const candle_frame_t *frame);
+
+/* busy-polls the receive urbs for the current spin budget; returns false
+   if nothing completed and the caller has to block */
+bool candle_rx_spin(candle_device_t *dev, uint32_t timeout_ms, DWORD *urb);
+
+bool candle_gateway_forward(struct candle_gateway *gw, const candle_frame_t *frame);
+bool candle_config_filter(candle_device_t *dev, const candle_frame_t *frame);
+bool candle_cache_update(struct candle_cache *cache, const candle_frame_t *frame);
+bool candle_recorder_update(struct candle_recorder *r, const candle_frame_t *frame);
+bool candle_isotp_on_frame(candle_device_t *dev, const candle_frame_t *frame);
+void candle_isotp_free(candle_device_t *dev);
+/* candle_txq_send with the overflow policy chosen by the caller */
+bool candle_txq_push(candle_device_t *dev, uint8_t ch, const candle_frame_t *frame, uint32_t timeout_ms, candle_txq_policy_t policy);
+bool candle_txq_on_echo(candle_device_t *dev, const candle_frame_t *frame);
+void candle_txq_reset(candle_device_t *dev);
+
@@ -0,0 +1,655 @@
+/*
+
+  Copyright (c) 2016 Hubert Denkmair <hubert@denkmair.de>
+
+  This file is part of the candle windows API.
+  
+  This library is free software: you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation, either
+  version 3 of the License, or (at your option) any later version.
+ 
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+ 
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include "candle_shm.h"
+#include <stdlib.h>
+#include <string.h>
+
+#include "candle_defs.h"
+#include "candle_rx.h"
+#include "candle_txq.h"
+
+#define CANDLE_SHM_MAGIC 0x4D48534E /* "NSHM" */
+#define CANDLE_SHM_VERSION 3
+#define CANDLE_SHM_READ_TIMEOUT_MS 100
+#define CANDLE_SHM_READ_BACKOFF_MS 1000 /* longest pause after failed device reads */
+#define CANDLE_SHM_TX_PUBLISH_TIMEOUT_MS 1000 /* claimed tx entries not published by then are skipped */
+#define CANDLE_SHM_NAME_LEN 128
+#define CANDLE_SHM_BIT(slot) ((LONG)(1UL << (slot)))
+
+/* shared between 32 and 64 bit processes, so only fixed size, naturally aligned fields */
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t ring_size;
+    uint32_t tx_size;
+    uint32_t num_channels;
+    volatile LONG alive;
+    volatile LONG64 write_seq;  /* frames published so far */
+    volatile LONG64 tx_head;    /* next tx slot to claim */
+    volatile LONG64 tx_tail;    /* next tx slot the broker sends */
+    volatile LONG subscribers;  /* bitmask of used subscriber slots */
+    volatile LONG waiting;      /* bitmask of subscribers blocked on their event */
+    volatile LONG64 tx_failed[CANDLE_SHM_MAX_SUBSCRIBERS];   /* frames the broker could not send */
+    volatile LONG64 owner_start[CANDLE_SHM_MAX_SUBSCRIBERS]; /* creation time of the owning process */
+    volatile LONG owner_pid[CANDLE_SHM_MAX_SUBSCRIBERS];     /* 0 while the slot is being claimed or released */
+    volatile LONG64 broker_start; /* alive is never cleared if the broker crashes */
+    volatile LONG broker_pid;
+} candle_shm_header_t;
+
+typedef struct {
+    volatile LONG64 seq; /* the write_seq this entry holds, -1 while being written */
+    candle_frame_t frame;
+} candle_shm_entry_t;
+
+typedef struct {
+    volatile LONG64 seq; /* claim protocol of a bounded multi producer queue */
+    uint32_t channel;
+    uint32_t slot;       /* sending subscriber */
+    candle_frame_t frame;
+} candle_shm_tx_entry_t;
+
+typedef struct {
+    HANDLE mapping;
+    candle_shm_header_t *hdr;
+    candle_shm_entry_t *ring;
+    candle_shm_tx_entry_t *tx;
+} candle_shm_view_t;
+
+typedef struct {
+    candle_err_t last_error;
+    candle_device_t *dev;
+    candle_shm_view_t view;
+    volatile bool running;
+    HANDLE rx_thread;
+    HANDLE tx_thread;
+    HANDLE tx_event;
+    HANDLE sub_events[CANDLE_SHM_MAX_SUBSCRIBERS];
+    LONG64 tx_stalled; /* tx entry claimed but not published, -1 if none */
+    ULONGLONG tx_stalled_since;
+} candle_shm_broker_t;
+
+typedef struct {
+    candle_err_t last_error;
+    candle_shm_view_t view;
+    LONG slot;
+    HANDLE event;
+    HANDLE tx_event;
+    LONG64 cursor;
+    uint64_t lost;
+    ULONGLONG broker_checked;
+} candle_shm_sub_t;
+
+static uint32_t candle_shm_pow2(uint32_t n)
+{
+    uint32_t size = 16;
+    while ((size < n) && (size < 0x40000000)) {
+        size <<= 1;
+    }
+    return size;
+}
+
+static size_t candle_shm_size(uint32_t ring_size, uint32_t tx_size)
+{
+    return sizeof(candle_shm_header_t) + ring_size * sizeof(candle_shm_entry_t) + tx_size * sizeof(candle_shm_tx_entry_t);
+}
+
+static bool candle_shm_map(candle_shm_view_t *v, size_t size)
+{
+    v->hdr = (candle_shm_header_t *)MapViewOfFile(v->mapping, FILE_MAP_ALL_ACCESS, 0, 0, size);
+    if (v->hdr == NULL) {
+        return false;
+    }
+    v->ring = (candle_shm_entry_t *)(v->hdr + 1);
+    v->tx = (candle_shm_tx_entry_t *)(v->ring + v->hdr->ring_size);
+    return true;
+}
+
+static void candle_shm_unmap(candle_shm_view_t *v)
+{
+    if (v->hdr != NULL) {
+        UnmapViewOfFile(v->hdr);
+        v->hdr = NULL;
+    }
+    if (v->mapping != NULL) {
+        CloseHandle(v->mapping);
+        v->mapping = NULL;
+    }
+}
+
+static bool candle_shm_event_name(wchar_t *buf, const wchar_t *name, LONG slot)
+{
+    if (slot < 0) {
+        return SUCCEEDED(StringCchPrintf(buf, CANDLE_SHM_NAME_LEN, L"%s_tx", name));
+    }
+    return SUCCEEDED(StringCchPrintf(buf, CANDLE_SHM_NAME_LEN, L"%s_sub%u", name, (unsigned)slot));
+}
+
+static LONG64 candle_shm_process_start(HANDLE process)
+{
+    FILETIME created, exited, kernel, user;
+    if (!GetProcessTimes(process, &created, &exited, &kernel, &user)) {
+        return 0;
+    }
+    return (LONG64)(((uint64_t)created.dwHighDateTime << 32) | created.dwLowDateTime);
+}
+
+/* the pid alone could have been reused, so the creation time is compared too */
+static bool candle_shm_owner_alive(DWORD pid, LONG64 start)
+{
+    HANDLE process = OpenProcess(PROCESS_QUERY_LIMITED_INFORMATION | SYNCHRONIZE, false, pid);
+    if (process == NULL) {
+        return GetLastError() == ERROR_ACCESS_DENIED; /* exists, but is not ours to look at */
+    }
+
+    bool alive = (WaitForSingleObject(process, 0) == WAIT_TIMEOUT) && (candle_shm_process_start(process) == start);
+    CloseHandle(process);
+    return alive;
+}
+
+/* frees the slots of subscribers that exited without candle_shm_close */
+static void candle_shm_reclaim(candle_shm_header_t *hdr)
+{
+    for (LONG i=0; i<CANDLE_SHM_MAX_SUBSCRIBERS; i++) {
+        LONG pid = hdr->owner_pid[i];
+        if (((hdr->subscribers & CANDLE_SHM_BIT(i)) == 0) || (pid == 0)
+            || candle_shm_owner_alive((DWORD)pid, hdr->owner_start[i]))
+        {
+            continue;
+        }
+
+        /* only one of several subscribers opening at once releases the slot */
+        if (InterlockedCompareExchange(&hdr->owner_pid[i], 0, pid) == pid) {
+            InterlockedAnd(&hdr->waiting, ~CANDLE_SHM_BIT(i));
+            InterlockedAnd(&hdr->subscribers, ~CANDLE_SHM_BIT(i));
+        }
+    }
+}
+
+static void candle_shm_publish(candle_shm_broker_t *b, const candle_frame_t *frame)
+{
+    candle_shm_header_t *hdr = b->view.hdr;
+    LONG64 n = hdr->write_seq;
+    candle_shm_entry_t *e = &b->view.ring[n & (hdr->ring_size - 1)];
+
+    InterlockedExchange64(&e->seq, -1);
+    e->frame = *frame;
+    MemoryBarrier();
+    e->seq = n;
+    InterlockedExchange64(&hdr->write_seq, n + 1);
+
+    /* only subscribers that are about to block need a kernel call */
+    ULONG waiting = (ULONG)hdr->waiting;
+    for (unsigned i=0; waiting != 0; i++, waiting >>= 1) {
+        if (waiting & 1) {
+            SetEvent(b->sub_events[i]);
+        }
+    }
+}
+
+static DWORD WINAPI candle_shm_rx_pump(LPVOID param)
+{
+    candle_shm_broker_t *b = (candle_shm_broker_t *)param;
+    DWORD backoff_ms = 0;
+
+    while (b->running) {
+        candle_frame_t frame;
+        if (!candle_frame_read(b->dev, &frame, CANDLE_SHM_READ_TIMEOUT_MS)) {
+            candle_err_t err = b->dev->last_error;
+            if (err == CANDLE_ERR_READ_WAIT) {
+                break; // device handles are gone, nothing more to read
+            }
+            if (err != CANDLE_ERR_READ_TIMEOUT) {
+                /* failing transfers return at once, do not spin on an unplugged device */
+                backoff_ms = (backoff_ms == 0) ? 1 : backoff_ms * 2;
+                if (backoff_ms > CANDLE_SHM_READ_BACKOFF_MS) {
+                    backoff_ms = CANDLE_SHM_READ_BACKOFF_MS;
+                }
+                Sleep(backoff_ms);
+            }
+            continue;
+        }
+        backoff_ms = 0;
+        candle_shm_publish(b, &frame);
+    }
+
+    return 0;
+}
+
+static DWORD WINAPI candle_shm_tx_pump(LPVOID param)
+{
+    candle_shm_broker_t *b = (candle_shm_broker_t *)param;
+    candle_shm_header_t *hdr = b->view.hdr;
+    uint32_t mask = hdr->tx_size - 1;
+
+    while (b->running) {
+        WaitForSingleObject(b->tx_event, CANDLE_SHM_READ_TIMEOUT_MS);
+
+        for (;;) {
+            LONG64 tail = hdr->tx_tail;
+            candle_shm_tx_entry_t *e = &b->view.tx[tail & mask];
+            LONG64 seq = e->seq;
+            if (seq != tail + 1) {
+                if ((seq != tail) || (hdr->tx_head <= tail)) {
+                    break; /* empty */
+                }
+
+                /* claimed, but the producer has not finished writing */
+                ULONGLONG now = GetTickCount64();
+                if (b->tx_stalled != tail) {
+                    b->tx_stalled = tail;
+                    b->tx_stalled_since = now;
+                    break;
+                }
+                if (now - b->tx_stalled_since < CANDLE_SHM_TX_PUBLISH_TIMEOUT_MS) {
+                    break;
+                }
+
+                /* the producer died or hangs; hand the entry to the next lap so the
+                   queue keeps moving, a late publish then fails in candle_shm_send */
+                if (InterlockedCompareExchange64(&e->seq, tail + hdr->tx_size, tail) == tail) {
+                    hdr->tx_tail = tail + 1;
+                }
+                continue;
+            }
+            MemoryBarrier();
+
+            candle_frame_t frame = e->frame;
+            uint8_t ch = (uint8_t)e->channel;
+            uint32_t slot = e->slot;
+            MemoryBarrier();
+            e->seq = tail + hdr->tx_size;
+            hdr->tx_tail = tail + 1;
+
+            bool rc;
+            if (b->dev->txq != NULL) {
+                rc = candle_txq_send(b->dev, ch, &frame, CANDLE_SHM_READ_TIMEOUT_MS);
+            } else {
+                rc = candle_frame_send(b->dev, ch, &frame);
+            }
+            if (!rc && (slot < CANDLE_SHM_MAX_SUBSCRIBERS)) {
+                InterlockedIncrement64(&hdr->tx_failed[slot]);
+            }
+        }
+    }
+
+    return 0;
+}
+
+DLL bool __stdcall candle_shm_broker_create(candle_shm_broker_handle *broker, candle_handle hdev, const wchar_t *name, uint32_t ring_frames, uint32_t tx_frames)
+{
+    if (broker==NULL) {
+        return false;
+    }
+
+    candle_shm_broker_t *b = (candle_shm_broker_t *)calloc(1, sizeof(candle_shm_broker_t));
+    *broker = b;
+    if (b==NULL) {
+        return false;
+    }
+
+    b->dev = (candle_device_t *)hdev;
+    b->tx_stalled = -1;
+
+    uint32_t ring_size = candle_shm_pow2(ring_frames);
+    uint32_t tx_size = candle_shm_pow2(tx_frames);
+    size_t size = candle_shm_size(ring_size, tx_size);
+
+    b->view.mapping = CreateFileMapping(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE,
+                                        (DWORD)((uint64_t)size >> 32), (DWORD)size, name);
+    if ((b->view.mapping == NULL) || (GetLastError() == ERROR_ALREADY_EXISTS)) {
+        b->last_error = CANDLE_ERR_SHM_CREATE;
+        return false;
+    }
+
+    b->view.hdr = (candle_shm_header_t *)MapViewOfFile(b->view.mapping, FILE_MAP_ALL_ACCESS, 0, 0, size);
+    if (b->view.hdr == NULL) {
+        b->last_error = CANDLE_ERR_SHM_CREATE;
+        return false;
+    }
+
+    candle_shm_header_t *hdr = b->view.hdr;
+    hdr->ring_size = ring_size;
+    hdr->tx_size = tx_size;
+    hdr->num_channels = b->dev->dconf.icount + 1;
+    b->view.ring = (candle_shm_entry_t *)(hdr + 1);
+    b->view.tx = (candle_shm_tx_entry_t *)(b->view.ring + ring_size);
+
+    for (uint32_t i=0; i<ring_size; i++) {
+        b->view.ring[i].seq = -1;
+    }
+    for (uint32_t i=0; i<tx_size; i++) {
+        b->view.tx[i].seq = i;
+    }
+
+    wchar_t ev_name[CANDLE_SHM_NAME_LEN];
+    for (LONG i=-1; i<CANDLE_SHM_MAX_SUBSCRIBERS; i++) {
+        HANDLE ev = candle_shm_event_name(ev_name, name, i) ? CreateEvent(NULL, false, false, ev_name) : NULL;
+        if (ev == NULL) {
+            b->last_error = CANDLE_ERR_SHM_CREATE;
+            return false;
+        }
+        if (i < 0) {
+            b->tx_event = ev;
+        } else {
+            b->sub_events[i] = ev;
+        }
+    }
+
+    hdr->version = CANDLE_SHM_VERSION;
+    hdr->broker_start = candle_shm_process_start(GetCurrentProcess());
+    hdr->broker_pid = (LONG)GetCurrentProcessId();
+    hdr->alive = 1;
+    MemoryBarrier();
+    hdr->magic = CANDLE_SHM_MAGIC;
+
+    b->running = true;
+    b->rx_thread = CreateThread(NULL, 0, candle_shm_rx_pump, b, 0, NULL);
+    b->tx_thread = CreateThread(NULL, 0, candle_shm_tx_pump, b, 0, NULL);
+    if ((b->rx_thread == NULL) || (b->tx_thread == NULL)) {
+        b->last_error = CANDLE_ERR_SHM_CREATE;
+        return false;
+    }
+
+    b->last_error = CANDLE_ERR_OK;
+    return true;
+}
+
+DLL bool __stdcall candle_shm_broker_free(candle_shm_broker_handle broker)
+{
+    candle_shm_broker_t *b = (candle_shm_broker_t *)broker;
+
+    b->running = false;
+    if (b->rx_thread != NULL) {
+        WaitForSingleObject(b->rx_thread, INFINITE);
+        CloseHandle(b->rx_thread);
+    }
+    if (b->tx_thread != NULL) {
+        SetEvent(b->tx_event);
+        WaitForSingleObject(b->tx_thread, INFINITE);
+        CloseHandle(b->tx_thread);
+    }
+
+    if (b->view.hdr != NULL) {
+        /* wake every subscriber so it notices the broker is gone */
+        b->view.hdr->alive = 0;
+        for (unsigned i=0; i<CANDLE_SHM_MAX_SUBSCRIBERS; i++) {
+            if (b->sub_events[i] != NULL) {
+                SetEvent(b->sub_events[i]);
+            }
+        }
+    }
+
+    for (unsigned i=0; i<CANDLE_SHM_MAX_SUBSCRIBERS; i++) {
+        if (b->sub_events[i] != NULL) {
+            CloseHandle(b->sub_events[i]);
+        }
+    }
+    if (b->tx_event != NULL) {
+        CloseHandle(b->tx_event);
+    }
+
+    candle_shm_unmap(&b->view);
+    free(b);
+    return true;
+}
+
+DLL candle_err_t __stdcall candle_shm_broker_last_error(candle_shm_broker_handle broker)
+{
+    candle_shm_broker_t *b = (candle_shm_broker_t *)broker;
+    return b->last_error;
+}
+
+DLL bool __stdcall candle_shm_open(candle_shm_handle *shm, const wchar_t *name)
+{
+    if (shm==NULL) {
+        return false;
+    }
+
+    candle_shm_sub_t *s = (candle_shm_sub_t *)calloc(1, sizeof(candle_shm_sub_t));
+    *shm = s;
+    if (s==NULL) {
+        return false;
+    }
+    s->slot = -1;
+
+    s->view.mapping = OpenFileMapping(FILE_MAP_ALL_ACCESS, false, name);
+    if (s->view.mapping == NULL) {
+        s->last_error = CANDLE_ERR_SHM_OPEN;
+        return false;
+    }
+
+    /* map the header first to learn the size of the whole section */
+    if (!candle_shm_map(&s->view, sizeof(candle_shm_header_t))) {
+        s->last_error = CANDLE_ERR_SHM_OPEN;
+        return false;
+    }
+    candle_shm_header_t hdr = *s->view.hdr;
+    UnmapViewOfFile(s->view.hdr);
+    s->view.hdr = NULL;
+
+    if ((hdr.magic != CANDLE_SHM_MAGIC) || (hdr.version != CANDLE_SHM_VERSION)
+        || !candle_shm_map(&s->view, candle_shm_size(hdr.ring_size, hdr.tx_size)))
+    {
+        s->last_error = CANDLE_ERR_SHM_OPEN;
+        return false;
+    }
+
+    candle_shm_reclaim(s->view.hdr);
+
+    for (LONG i=0; i<CANDLE_SHM_MAX_SUBSCRIBERS; i++) {
+        LONG used = s->view.hdr->subscribers;
+        if ((used & CANDLE_SHM_BIT(i)) == 0) {
+            if (InterlockedCompareExchange(&s->view.hdr->subscribers, used | CANDLE_SHM_BIT(i), used) == used) {
+                s->slot = i;
+                break;
+            }
+            i = -1; /* someone else took a slot meanwhile, start over */
+        }
+    }
+    if (s->slot < 0) {
+        s->last_error = CANDLE_ERR_SHM_OPEN;
+        return false;
+    }
+
+    InterlockedExchange64(&s->view.hdr->tx_failed[s->slot], 0);
+    s->view.hdr->owner_start[s->slot] = candle_shm_process_start(GetCurrentProcess());
+    MemoryBarrier();
+    s->view.hdr->owner_pid[s->slot] = (LONG)GetCurrentProcessId();
+
+    wchar_t ev_name[CANDLE_SHM_NAME_LEN];
+    s->event = candle_shm_event_name(ev_name, name, s->slot) ? OpenEvent(SYNCHRONIZE, false, ev_name) : NULL;
+    s->tx_event = candle_shm_event_name(ev_name, name, -1) ? OpenEvent(EVENT_MODIFY_STATE, false, ev_name) : NULL;
+    if ((s->event == NULL) || (s->tx_event == NULL)) {
+        s->last_error = CANDLE_ERR_SHM_OPEN;
+        return false;
+    }
+
+    s->cursor = s->view.hdr->write_seq;
+    s->last_error = CANDLE_ERR_OK;
+    return true;
+}
+
+/* looks for a crashed broker at most every CANDLE_SHM_READ_TIMEOUT_MS */
+static bool candle_shm_broker_alive(candle_shm_sub_t *s)
+{
+    candle_shm_header_t *hdr = s->view.hdr;
+    if (!hdr->alive) {
+        return false;
+    }
+
+    ULONGLONG now = GetTickCount64();
+    if (now - s->broker_checked >= CANDLE_SHM_READ_TIMEOUT_MS) {
+        s->broker_checked = now;
+        if (!candle_shm_owner_alive((DWORD)hdr->broker_pid, hdr->broker_start)) {
+            InterlockedExchange(&hdr->alive, 0); /* tells the other subscribers as well */
+            return false;
+        }
+    }
+    return true;
+}
+
+DLL bool __stdcall candle_shm_channel_count(candle_shm_handle shm, uint8_t *num_channels)
+{
+    candle_shm_sub_t *s = (candle_shm_sub_t *)shm;
+    *num_channels = (uint8_t)s->view.hdr->num_channels;
+    s->last_error = CANDLE_ERR_OK;
+    return true;
+}
+
+DLL bool __stdcall candle_shm_read(candle_shm_handle shm, candle_frame_t *frame, uint32_t timeout_ms)
+{
+    candle_shm_sub_t *s = (candle_shm_sub_t *)shm;
+    candle_shm_header_t *hdr = s->view.hdr;
+    LONG64 size = hdr->ring_size;
+    ULONGLONG start = GetTickCount64();
+
+    for (;;) {
+        LONG64 w = hdr->write_seq;
+
+        if (s->cursor >= w) {
+            if (!candle_shm_broker_alive(s)) {
+                s->last_error = CANDLE_ERR_SHM_CLOSED;
+                return false;
+            }
+
+            /* a crashed broker never sets the event, so wake up to look for it */
+            uint32_t wait_ms = candle_rx_time_left(start, timeout_ms);
+            if (wait_ms > CANDLE_SHM_READ_TIMEOUT_MS) {
+                wait_ms = CANDLE_SHM_READ_TIMEOUT_MS;
+            }
+
+            /* announce that we block, then look again so no publish is missed */
+            InterlockedOr(&hdr->waiting, CANDLE_SHM_BIT(s->slot));
+            if (s->cursor >= hdr->write_seq) {
+                WaitForSingleObject(s->event, wait_ms);
+            }
+            InterlockedAnd(&hdr->waiting, ~CANDLE_SHM_BIT(s->slot));
+
+            if ((s->cursor >= hdr->write_seq) && (candle_rx_time_left(start, timeout_ms) == 0)) {
+                s->last_error = CANDLE_ERR_READ_TIMEOUT;
+                return false;
+            }
+            continue;
+        }
+
+        if (w - s->cursor > size) {
+            s->lost += (uint64_t)(w - size - s->cursor);
+            s->cursor = w - size;
+        }
+
+        candle_shm_entry_t *e = &s->view.ring[s->cursor & (size - 1)];
+        LONG64 seq1 = e->seq;
+        MemoryBarrier();
+        *frame = e->frame;
+        MemoryBarrier();
+        LONG64 seq2 = e->seq;
+
+        if ((seq1 == s->cursor) && (seq2 == s->cursor)) {
+            s->cursor++;
+            s->last_error = CANDLE_ERR_OK;
+            return true;
+        }
+        /* overwritten while copying; the next pass skips ahead */
+    }
+}
+
+DLL bool __stdcall candle_shm_send(candle_shm_handle shm, uint8_t ch, const candle_frame_t *frame)
+{
+    candle_shm_sub_t *s = (candle_shm_sub_t *)shm;
+    candle_shm_header_t *hdr = s->view.hdr;
+    uint32_t mask = hdr->tx_size - 1;
+
+    if (!candle_shm_broker_alive(s)) {
+        s->last_error = CANDLE_ERR_SHM_CLOSED;
+        return false;
+    }
+
+    LONG64 pos = hdr->tx_head;
+    for (;;) {
+        candle_shm_tx_entry_t *e = &s->view.tx[pos & mask];
+        LONG64 diff = e->seq - pos;
+
+        if (diff == 0) {
+            LONG64 prev = InterlockedCompareExchange64(&hdr->tx_head, pos + 1, pos);
+            if (prev == pos) {
+                e->channel = ch;
+                e->slot = (uint32_t)s->slot;
+                e->frame = *frame;
+                if (InterlockedCompareExchange64(&e->seq, pos + 1, pos) != pos) {
+                    s->last_error = CANDLE_ERR_SEND_FRAME; /* held up so long that the broker skipped it */
+                    return false;
+                }
+                SetEvent(s->tx_event);
+                s->last_error = CANDLE_ERR_OK;
+                return true;
+            }
+            pos = prev;
+        } else if (diff < 0) {
+            s->last_error = CANDLE_ERR_SHM_FULL;
+            return false;
+        } else {
+            pos = hdr->tx_head;
+        }
+    }
+}
+
+DLL bool __stdcall candle_shm_get_overruns(candle_shm_handle shm, uint64_t *lost_frames)
+{
+    candle_shm_sub_t *s = (candle_shm_sub_t *)shm;
+    *lost_frames = s->lost;
+    s->last_error = CANDLE_ERR_OK;
+    return true;
+}
+
+DLL bool __stdcall candle_shm_get_tx_failures(candle_shm_handle shm, uint64_t *failed_frames)
+{
+    candle_shm_sub_t *s = (candle_shm_sub_t *)shm;
+    *failed_frames = (uint64_t)InterlockedCompareExchange64(&s->view.hdr->tx_failed[s->slot], 0, 0);
+    s->last_error = CANDLE_ERR_OK;
+    return true;
+}
+
+DLL bool __stdcall candle_shm_close(candle_shm_handle shm)
+{
+    candle_shm_sub_t *s = (candle_shm_sub_t *)shm;
+
+    if ((s->view.hdr != NULL) && (s->slot >= 0)) {
+        s->view.hdr->owner_pid[s->slot] = 0;
+        InterlockedAnd(&s->view.hdr->subscribers, ~CANDLE_SHM_BIT(s->slot));
+    }
+    if (s->event != NULL) {
+        CloseHandle(s->event);
+    }
+    if (s->tx_event != NULL) {
+        CloseHandle(s->tx_event);
+    }
+    candle_shm_unmap(&s->view);
+    free(s);
+    return true;
+}
+
+DLL candle_err_t __stdcall candle_shm_last_error(candle_shm_handle shm)
+{
+    candle_shm_sub_t *s = (candle_shm_sub_t *)shm;
+    return s->last_error;
+}
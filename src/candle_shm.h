@@ -0,0 +1,63 @@
+/*
+
+  Copyright (c) 2016 Hubert Denkmair <hubert@denkmair.de>
+
+  This file is part of the candle windows API.
+  
+  This library is free software: you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation, either
+  version 3 of the License, or (at your option) any later version.
+ 
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+ 
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#pragma once
+#include "candle.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define CANDLE_SHM_MAX_SUBSCRIBERS 32
+
+typedef void* candle_shm_broker_handle;
+typedef void* candle_shm_handle;
+
+/*
+ * Shares one opened device with other processes. The broker reads the
+ * device and publishes every frame into a ring of ring_frames entries
+ * (rounded up to a power of two) in a named shared memory section.
+ * Subscribers map the section by name and read with their own cursor,
+ * starting at the newest frame; a subscriber that falls more than the ring
+ * size behind skips ahead and counts the frames it missed. Frames sent by
+ * subscribers go through a shared queue of tx_frames entries to the broker,
+ * which transmits them; frames it fails to send are counted per subscriber.
+ * Slots of subscribers that exit without candle_shm_close are reclaimed by
+ * the next candle_shm_open, and a queued frame its sender did not finish
+ * writing within a second is skipped. Subscribers notice a broker that
+ * exited without candle_shm_broker_free and fail with CANDLE_ERR_SHM_CLOSED.
+ */
+DLL bool __stdcall candle_shm_broker_create(candle_shm_broker_handle *broker, candle_handle hdev, const wchar_t *name, uint32_t ring_frames, uint32_t tx_frames);
+DLL bool __stdcall candle_shm_broker_free(candle_shm_broker_handle broker);
+DLL candle_err_t __stdcall candle_shm_broker_last_error(candle_shm_broker_handle broker);
+
+DLL bool __stdcall candle_shm_open(candle_shm_handle *shm, const wchar_t *name);
+DLL bool __stdcall candle_shm_channel_count(candle_shm_handle shm, uint8_t *num_channels);
+DLL bool __stdcall candle_shm_read(candle_shm_handle shm, candle_frame_t *frame, uint32_t timeout_ms);
+DLL bool __stdcall candle_shm_send(candle_shm_handle shm, uint8_t ch, const candle_frame_t *frame);
+DLL bool __stdcall candle_shm_get_overruns(candle_shm_handle shm, uint64_t *lost_frames);
+DLL bool __stdcall candle_shm_get_tx_failures(candle_shm_handle shm, uint64_t *failed_frames);
+DLL bool __stdcall candle_shm_close(candle_shm_handle shm);
+DLL candle_err_t __stdcall candle_shm_last_error(candle_shm_handle shm);
+
+#ifdef __cplusplus
+}
+#endif
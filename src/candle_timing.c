@@ -0,0 +1,214 @@
+/*
+
+  Copyright (c) 2016 Hubert Denkmair <hubert@denkmair.de>
+
+  This file is part of the candle windows API.
+  
+  This library is free software: you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation, either
+  version 3 of the License, or (at your option) any later version.
+ 
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+ 
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include "candle_timing.h"
+#include <string.h>
+
+#define CANDLE_TIMING_SYNC_SEG 1
+#define CANDLE_TIMING_MAX_ERROR 50 /* per mille of the bitrate */
+#define CANDLE_TIMING_CACHE_SIZE 256 /* power of two */
+
+typedef struct {
+    candle_capability_t cap;
+    uint32_t bitrate;
+    uint32_t sample_point;
+} candle_timing_key_t;
+
+typedef struct {
+    bool valid;
+    candle_timing_key_t key;
+    candle_bittiming_t timing;
+} candle_timing_cache_entry_t;
+
+/* shared by all devices, so adapters with the same clock solve every bitrate once */
+static SRWLOCK candle_timing_lock = SRWLOCK_INIT;
+static candle_timing_cache_entry_t candle_timing_cache[CANDLE_TIMING_CACHE_SIZE];
+
+static uint32_t candle_timing_hash(const candle_timing_key_t *key)
+{
+    const uint32_t *words = (const uint32_t *)key;
+    uint32_t h = 2166136261u;
+    for (unsigned i=0; i<sizeof(*key)/sizeof(uint32_t); i++) {
+        h = (h ^ words[i]) * 16777619u;
+    }
+    return h & (CANDLE_TIMING_CACHE_SIZE - 1);
+}
+
+/* the sample point of the fixed 48MHz table candle_channel_set_bitrate used before */
+#define CANDLE_TIMING_DEFAULT_SP 875
+
+/* splits tseg (time quanta without the sync segment) into tseg1 and tseg2,
+   getting as close to the sample point as possible without passing it.
+   returns UINT32_MAX if no split fits the capabilities */
+static uint32_t candle_timing_split(const candle_capability_t *cap, uint32_t sp_nominal, uint32_t tseg, uint32_t *tseg1_out, uint32_t *tseg2_out)
+{
+    uint32_t best_sp_error = UINT32_MAX;
+
+    for (unsigned i=0; i<=1; i++) {
+        int32_t tseg2 = (int32_t)(tseg + CANDLE_TIMING_SYNC_SEG) - (int32_t)((sp_nominal * (tseg + CANDLE_TIMING_SYNC_SEG)) / 1000) - (int32_t)i;
+        if (tseg2 < (int32_t)cap->tseg2_min) {
+            tseg2 = (int32_t)cap->tseg2_min;
+        }
+        if (tseg2 > (int32_t)cap->tseg2_max) {
+            tseg2 = (int32_t)cap->tseg2_max;
+        }
+
+        int32_t tseg1 = (int32_t)tseg - tseg2;
+        if (tseg1 > (int32_t)cap->tseg1_max) {
+            tseg1 = (int32_t)cap->tseg1_max;
+            tseg2 = (int32_t)tseg - tseg1;
+        }
+        if ((tseg1 < (int32_t)cap->tseg1_min) || (tseg2 > (int32_t)cap->tseg2_max)) {
+            continue;
+        }
+
+        uint32_t sp = 1000 * (tseg + CANDLE_TIMING_SYNC_SEG - (uint32_t)tseg2) / (tseg + CANDLE_TIMING_SYNC_SEG);
+        uint32_t sp_error = (sp_nominal > sp) ? (sp_nominal - sp) : (sp - sp_nominal);
+        if ((sp <= sp_nominal) && (sp_error < best_sp_error)) {
+            *tseg1_out = (uint32_t)tseg1;
+            *tseg2_out = (uint32_t)tseg2;
+            best_sp_error = sp_error;
+        }
+    }
+
+    return best_sp_error;
+}
+
+/* mirrors can_calc_bittiming() of the Linux kernel */
+bool candle_timing_solve(const candle_capability_t *cap, uint32_t bitrate, uint32_t sp_nominal, candle_bittiming_t *t)
+{
+    uint32_t best_rate_error = UINT32_MAX;
+    uint32_t best_sp_error = UINT32_MAX;
+    uint32_t best_tseg = 0;
+    uint32_t best_brp = 0;
+    uint32_t tseg1 = 0;
+    uint32_t tseg2 = 0;
+    uint32_t brp_inc = (cap->brp_inc != 0) ? cap->brp_inc : 1;
+
+    if ((bitrate == 0) || (cap->fclk_can == 0) || (sp_nominal == 0) || (sp_nominal >= 1000)) {
+        return false;
+    }
+
+    /* tseg counts half quanta here, its lowest bit rounds the prescaler */
+    for (int32_t i = (int32_t)((cap->tseg1_max + cap->tseg2_max) * 2 + 1); i >= (int32_t)((cap->tseg1_min + cap->tseg2_min) * 2); i--) {
+        uint32_t tseg = (uint32_t)i;
+        uint32_t tsegall = CANDLE_TIMING_SYNC_SEG + tseg / 2;
+
+        uint32_t brp = (uint32_t)((uint64_t)cap->fclk_can / ((uint64_t)tsegall * bitrate)) + tseg % 2;
+        brp = (brp / brp_inc) * brp_inc;
+        if ((brp < cap->brp_min) || (brp > cap->brp_max) || (brp == 0)) {
+            continue;
+        }
+
+        uint32_t rate = cap->fclk_can / (brp * tsegall);
+        uint32_t rate_error = (bitrate > rate) ? (bitrate - rate) : (rate - bitrate);
+        if (rate_error > best_rate_error) {
+            continue;
+        }
+
+        uint32_t sp_error = candle_timing_split(cap, sp_nominal, tseg / 2, &tseg1, &tseg2);
+        if (sp_error == UINT32_MAX) {
+            continue;
+        }
+        if ((rate_error == best_rate_error) && (sp_error > best_sp_error)) {
+            continue;
+        }
+
+        best_sp_error = sp_error;
+        best_rate_error = rate_error;
+        best_tseg = tseg / 2;
+        best_brp = brp;
+
+        if ((rate_error == 0) && (sp_error == 0)) {
+            break;
+        }
+    }
+
+    if ((best_brp == 0) || ((uint64_t)best_rate_error * 1000 / bitrate > CANDLE_TIMING_MAX_ERROR)) {
+        return false;
+    }
+
+    if (candle_timing_split(cap, sp_nominal, best_tseg, &tseg1, &tseg2) == UINT32_MAX) {
+        return false;
+    }
+
+    t->brp = best_brp;
+    t->prop_seg = tseg1 / 2;
+    t->phase_seg1 = tseg1 - t->prop_seg;
+    t->phase_seg2 = tseg2;
+
+    uint32_t sjw = (t->phase_seg1 < t->phase_seg2 / 2) ? t->phase_seg1 : t->phase_seg2 / 2;
+    if (sjw < 1) {
+        sjw = 1;
+    }
+    if ((cap->sjw_max != 0) && (sjw > cap->sjw_max)) {
+        sjw = cap->sjw_max;
+    }
+    t->sjw = sjw;
+
+    return true;
+}
+
+bool candle_timing_calc(candle_device_t *dev, uint32_t bitrate, uint32_t sample_point, candle_bittiming_t *t)
+{
+    candle_timing_key_t key;
+    memset(&key, 0, sizeof(key));
+    key.cap = dev->bt_const;
+    key.cap.feature = 0;
+    key.bitrate = bitrate;
+    key.sample_point = (sample_point != 0) ? sample_point : CANDLE_TIMING_DEFAULT_SP;
+
+    if (key.sample_point >= 1000) {
+        dev->last_error = CANDLE_ERR_BITRATE_UNSUPPORTED;
+        return false;
+    }
+
+    uint32_t h = candle_timing_hash(&key);
+    candle_timing_cache_entry_t *e = &candle_timing_cache[h];
+
+    AcquireSRWLockShared(&candle_timing_lock);
+    bool hit = e->valid && (memcmp(&e->key, &key, sizeof(key)) == 0);
+    if (hit) {
+        *t = e->timing;
+    }
+    ReleaseSRWLockShared(&candle_timing_lock);
+
+    if (!hit) {
+        if (!candle_timing_solve(&key.cap, bitrate, key.sample_point, t)) {
+            dev->last_error = CANDLE_ERR_BITRATE_UNSUPPORTED;
+            return false;
+        }
+
+        AcquireSRWLockExclusive(&candle_timing_lock);
+        e->key = key;
+        e->timing = *t;
+        e->valid = true;
+        ReleaseSRWLockExclusive(&candle_timing_lock);
+    }
+
+    dev->last_error = CANDLE_ERR_OK;
+    return true;
+}
+
+bool candle_timing_from_bitrate(candle_device_t *dev, uint32_t bitrate, candle_bittiming_t *t)
+{
+    return candle_timing_calc(dev, bitrate, 0, t);
+}
@@ -0,0 +1,30 @@
+/*
+
+  Copyright (c) 2016 Hubert Denkmair <hubert@denkmair.de>
+
+  This file is part of the candle windows API.
+  
+  This library is free software: you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation, either
+  version 3 of the License, or (at your option) any later version.
+ 
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+ 
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#pragma once
+
+#include "candle_defs.h"
+
+/* sample_point in per mille; candle_timing_calc caches its results and
+   takes 0 as 87.5%, the sample point of the former fixed 48MHz table */
+bool candle_timing_solve(const candle_capability_t *cap, uint32_t bitrate, uint32_t sample_point, candle_bittiming_t *t);
+bool candle_timing_calc(candle_device_t *dev, uint32_t bitrate, uint32_t sample_point, candle_bittiming_t *t);
+bool candle_timing_from_bitrate(candle_device_t *dev, uint32_t bitrate, candle_bittiming_t *t);
@@ -0,0 +1,489 @@
+/*
+
+  Copyright (c) 2016 Hubert Denkmair <hubert@denkmair.de>
+
+  This file is part of the candle windows API.
+  
+  This library is free software: you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation, either
+  version 3 of the License, or (at your option) any later version.
+ 
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+ 
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include "candle_txq.h"
+#include <stdlib.h>
+
+#include "candle_defs.h"
+#include "candle_rx.h"
+
+#define CANDLE_TXQ_MAX_SLOTS 32
+#define CANDLE_TXQ_ECHO_BASE 0x100 /* keeps queued frames apart from candle_frame_send (echo_id 0) */
+
+typedef struct {
+    uint32_t key;
+    uint64_t seq;
+    candle_frame_t frame;
+} candle_txq_entry_t;
+
+typedef struct {
+    candle_txq_entry_t *heap;
+    uint32_t len;
+    uint32_t dropped;
+} candle_txq_channel_t;
+
+typedef struct {
+    OVERLAPPED ovl;
+    candle_frame_t frame;
+    bool busy;
+} candle_txq_slot_t;
+
+struct candle_txq {
+    CRITICAL_SECTION lock;
+    CONDITION_VARIABLE space;
+    candle_txq_policy_t policy;
+    uint32_t capacity;
+    uint64_t seq;
+
+    uint8_t num_channels;
+    uint8_t next_channel;
+    candle_txq_channel_t *channels;
+
+    uint8_t num_slots;
+    uint8_t free_slots;
+    candle_txq_slot_t slots[CANDLE_TXQ_MAX_SLOTS];
+};
+
+/* arbitration order: 11bit base id, then RTR (or SRR), IDE, 18bit extension, RTR */
+static uint32_t candle_txq_key(uint32_t can_id)
+{
+    bool ext = (can_id & 0x80000000) != 0;
+    bool rtr = (can_id & 0x40000000) != 0;
+
+    if (ext) {
+        uint32_t id = can_id & 0x1FFFFFFF;
+        return ((id >> 18) << 21) | (1u << 20) | (1u << 19) | ((id & 0x3FFFF) << 1) | (rtr ? 1 : 0);
+    } else {
+        uint32_t id = can_id & 0x7FF;
+        return (id << 21) | ((rtr ? 1u : 0u) << 20);
+    }
+}
+
+static bool candle_txq_less(candle_txq_entry_t *a, candle_txq_entry_t *b)
+{
+    return (a->key != b->key) ? (a->key < b->key) : (a->seq < b->seq);
+}
+
+static void candle_txq_sift_up(candle_txq_channel_t *c, uint32_t i)
+{
+    candle_txq_entry_t e = c->heap[i];
+    while (i > 0) {
+        uint32_t parent = (i - 1) / 2;
+        if (!candle_txq_less(&e, &c->heap[parent])) {
+            break;
+        }
+        c->heap[i] = c->heap[parent];
+        i = parent;
+    }
+    c->heap[i] = e;
+}
+
+static void candle_txq_sift_down(candle_txq_channel_t *c, uint32_t i)
+{
+    candle_txq_entry_t e = c->heap[i];
+    for (;;) {
+        uint32_t child = 2 * i + 1;
+        if (child >= c->len) {
+            break;
+        }
+        if ((child + 1 < c->len) && candle_txq_less(&c->heap[child + 1], &c->heap[child])) {
+            child++;
+        }
+        if (!candle_txq_less(&c->heap[child], &e)) {
+            break;
+        }
+        c->heap[i] = c->heap[child];
+        i = child;
+    }
+    c->heap[i] = e;
+}
+
+static void candle_txq_remove(candle_txq_channel_t *c, uint32_t i)
+{
+    c->len--;
+    if (i == c->len) {
+        return;
+    }
+    c->heap[i] = c->heap[c->len];
+    candle_txq_sift_down(c, i);
+    candle_txq_sift_up(c, i);
+}
+
+static bool candle_txq_submit(candle_device_t *dev, struct candle_txq *q, uint8_t ch, candle_frame_t *frame)
+{
+    for (uint8_t i=0; i<q->num_slots; i++) {
+        candle_txq_slot_t *slot = &q->slots[i];
+        if (slot->busy) {
+            continue;
+        }
+
+        slot->frame = *frame;
+        slot->frame.echo_id = CANDLE_TXQ_ECHO_BASE + i;
+        slot->frame.channel = ch;
+        slot->busy = true;
+        q->free_slots--;
+
+        bool rc = WinUsb_WritePipe(dev->winUSBHandle, dev->bulkOutPipe, (uint8_t*)&slot->frame,
+                                   sizeof(slot->frame), NULL, &slot->ovl);
+        if (!rc && (GetLastError() != ERROR_IO_PENDING)) {
+            slot->busy = false;
+            q->free_slots++;
+            dev->last_error = CANDLE_ERR_SEND_FRAME;
+            return false;
+        }
+        return true;
+    }
+    return false;
+}
+
+/* free slots whose write failed; the device never echoes those frames */
+static void candle_txq_reap(candle_device_t *dev, struct candle_txq *q)
+{
+    for (uint8_t i=0; i<q->num_slots; i++) {
+        candle_txq_slot_t *slot = &q->slots[i];
+        if (!slot->busy || !HasOverlappedIoCompleted(&slot->ovl)) {
+            continue;
+        }
+
+        DWORD bytes_sent;
+        if (!WinUsb_GetOverlappedResult(dev->winUSBHandle, &slot->ovl, &bytes_sent, false)) {
+            slot->busy = false;
+            q->free_slots++;
+            q->channels[slot->frame.channel].dropped++;
+        }
+    }
+}
+
+/*
+ * hand queued frames to the device while transmit slots are free; call with lock held.
+ * returns false if the entry with sequence number seq could not be submitted.
+ */
+static bool candle_txq_pump(candle_device_t *dev, struct candle_txq *q, uint64_t seq)
+{
+    bool rc = true;
+    uint8_t idle = 0;
+
+    candle_txq_reap(dev, q);
+    while ((q->free_slots > 0) && (idle < q->num_channels)) {
+        uint8_t ch = q->next_channel;
+        q->next_channel = (uint8_t)((ch + 1) % q->num_channels);
+
+        candle_txq_channel_t *c = &q->channels[ch];
+        if (c->len == 0) {
+            idle++;
+            continue;
+        }
+        idle = 0;
+
+        candle_txq_entry_t e = c->heap[0];
+        candle_txq_remove(c, 0);
+        if (!candle_txq_submit(dev, q, ch, &e.frame)) {
+            c->dropped++;
+            if (e.seq == seq) {
+                rc = false;
+            }
+        }
+        WakeAllConditionVariable(&q->space);
+    }
+    return rc;
+}
+
+bool candle_txq_on_echo(candle_device_t *dev, const candle_frame_t *frame)
+{
+    struct candle_txq *q = dev->txq;
+    uint32_t slot = frame->echo_id - CANDLE_TXQ_ECHO_BASE;
+
+    if ((frame->echo_id == 0xFFFFFFFF) || (slot >= q->num_slots)) {
+        return true;
+    }
+
+    EnterCriticalSection(&q->lock);
+    if (q->slots[slot].busy) {
+        q->slots[slot].busy = false;
+        q->free_slots++;
+    }
+    candle_txq_pump(dev, q, UINT64_MAX);
+    LeaveCriticalSection(&q->lock);
+
+    return true;
+}
+
+static void candle_txq_reset_slots(candle_device_t *dev, struct candle_txq *q)
+{
+    if (dev->winUSBHandle != NULL) {
+        WinUsb_AbortPipe(dev->winUSBHandle, dev->bulkOutPipe);
+    }
+
+    for (uint8_t i=0; i<q->num_slots; i++) {
+        candle_txq_slot_t *slot = &q->slots[i];
+        if (slot->busy && (dev->winUSBHandle != NULL)) {
+            DWORD bytes_sent;
+            WinUsb_GetOverlappedResult(dev->winUSBHandle, &slot->ovl, &bytes_sent, true);
+        }
+        slot->busy = false;
+    }
+    q->free_slots = q->num_slots;
+}
+
+void candle_txq_reset(candle_device_t *dev)
+{
+    struct candle_txq *q = dev->txq;
+
+    EnterCriticalSection(&q->lock);
+    for (unsigned ch=0; ch<q->num_channels; ch++) {
+        q->channels[ch].len = 0;
+    }
+    candle_txq_reset_slots(dev, q);
+    WakeAllConditionVariable(&q->space);
+    LeaveCriticalSection(&q->lock);
+}
+
+DLL bool __stdcall candle_txq_enable(candle_handle hdev, uint32_t capacity, uint8_t num_slots, candle_txq_policy_t policy)
+{
+    candle_device_t *dev = (candle_device_t*)hdev;
+
+    if (dev->txq != NULL) {
+        candle_txq_disable(dev);
+    }
+
+    if ((capacity == 0) || (num_slots == 0) || (num_slots > CANDLE_TXQ_MAX_SLOTS)) {
+        dev->last_error = CANDLE_ERR_TXQ_CONFIG;
+        return false;
+    }
+
+    struct candle_txq *q = (struct candle_txq *)calloc(1, sizeof(struct candle_txq));
+    if (q == NULL) {
+        dev->last_error = CANDLE_ERR_MALLOC;
+        return false;
+    }
+
+    InitializeCriticalSection(&q->lock);
+    InitializeConditionVariable(&q->space);
+    q->policy = policy;
+    q->capacity = capacity;
+    q->num_slots = num_slots;
+    q->free_slots = num_slots;
+    q->num_channels = dev->dconf.icount + 1;
+    q->channels = (candle_txq_channel_t *)calloc(q->num_channels, sizeof(candle_txq_channel_t));
+    dev->txq = q;
+
+    if (q->channels == NULL) {
+        candle_txq_disable(dev);
+        dev->last_error = CANDLE_ERR_MALLOC;
+        return false;
+    }
+
+    for (unsigned ch=0; ch<q->num_channels; ch++) {
+        q->channels[ch].heap = (candle_txq_entry_t *)malloc(capacity * sizeof(candle_txq_entry_t));
+        if (q->channels[ch].heap == NULL) {
+            candle_txq_disable(dev);
+            dev->last_error = CANDLE_ERR_MALLOC;
+            return false;
+        }
+    }
+
+    for (unsigned i=0; i<num_slots; i++) {
+        /* the low bit keeps write completions away from a reactor's completion port */
+        HANDLE ev = CreateEvent(NULL, true, false, NULL);
+        q->slots[i].ovl.hEvent = (ev != NULL) ? (HANDLE)((ULONG_PTR)ev | 1) : NULL;
+        if (ev == NULL) {
+            candle_txq_disable(dev);
+            dev->last_error = CANDLE_ERR_TXQ_CONFIG;
+            return false;
+        }
+    }
+
+    dev->last_error = CANDLE_ERR_OK;
+    return true;
+}
+
+bool candle_txq_push(candle_device_t *dev, uint8_t ch, const candle_frame_t *frame, uint32_t timeout_ms, candle_txq_policy_t policy)
+{
+    struct candle_txq *q = dev->txq;
+
+    if (q == NULL) {
+        dev->last_error = CANDLE_ERR_TXQ_DISABLED;
+        return false;
+    }
+
+    if (ch >= q->num_channels) {
+        dev->last_error = CANDLE_ERR_CHANNEL_OUT_OF_RANGE;
+        return false;
+    }
+
+    candle_txq_channel_t *c = &q->channels[ch];
+    ULONGLONG start = GetTickCount64();
+
+    EnterCriticalSection(&q->lock);
+
+    while (c->len >= q->capacity) {
+
+        /* slots of failed writes may have been freed since the last pump */
+        candle_txq_pump(dev, q, UINT64_MAX);
+        if (c->len < q->capacity) {
+            break;
+        }
+
+        if (policy == CANDLE_TXQ_DROP_OLDEST) {
+            uint32_t oldest = 0;
+            for (uint32_t i=1; i<c->len; i++) {
+                if (c->heap[i].seq < c->heap[oldest].seq) {
+                    oldest = i;
+                }
+            }
+            candle_txq_remove(c, oldest);
+            c->dropped++;
+            break;
+        }
+
+        uint32_t wait_ms = candle_rx_time_left(start, timeout_ms);
+        if ((policy == CANDLE_TXQ_FAIL) || (wait_ms == 0)
+            || !SleepConditionVariableCS(&q->space, &q->lock, wait_ms))
+        {
+            LeaveCriticalSection(&q->lock);
+            dev->last_error = CANDLE_ERR_TXQ_FULL;
+            return false;
+        }
+    }
+
+    candle_txq_entry_t *e = &c->heap[c->len];
+    e->frame = *frame;
+    e->key = candle_txq_key(frame->can_id);
+    uint64_t seq = q->seq++;
+    e->seq = seq;
+    c->len++;
+    candle_txq_sift_up(c, c->len - 1);
+
+    bool rc = candle_txq_pump(dev, q, seq);
+
+    LeaveCriticalSection(&q->lock);
+
+    dev->last_error = rc ? CANDLE_ERR_OK : CANDLE_ERR_SEND_FRAME;
+    return rc;
+}
+
+DLL bool __stdcall candle_txq_send(candle_handle hdev, uint8_t ch, const candle_frame_t *frame, uint32_t timeout_ms)
+{
+    candle_device_t *dev = (candle_device_t*)hdev;
+
+    if (dev->txq == NULL) {
+        dev->last_error = CANDLE_ERR_TXQ_DISABLED;
+        return false;
+    }
+
+    return candle_txq_push(dev, ch, frame, timeout_ms, dev->txq->policy);
+}
+
+DLL bool __stdcall candle_txq_pending(candle_handle hdev, uint8_t ch, uint32_t *num_frames)
+{
+    candle_device_t *dev = (candle_device_t*)hdev;
+    struct candle_txq *q = dev->txq;
+
+    if (q == NULL) {
+        dev->last_error = CANDLE_ERR_TXQ_DISABLED;
+        return false;
+    }
+
+    if (ch >= q->num_channels) {
+        dev->last_error = CANDLE_ERR_CHANNEL_OUT_OF_RANGE;
+        return false;
+    }
+
+    EnterCriticalSection(&q->lock);
+    *num_frames = q->channels[ch].len;
+    LeaveCriticalSection(&q->lock);
+
+    dev->last_error = CANDLE_ERR_OK;
+    return true;
+}
+
+DLL bool __stdcall candle_txq_dropped(candle_handle hdev, uint8_t ch, uint32_t *num_frames)
+{
+    candle_device_t *dev = (candle_device_t*)hdev;
+    struct candle_txq *q = dev->txq;
+
+    if (q == NULL) {
+        dev->last_error = CANDLE_ERR_TXQ_DISABLED;
+        return false;
+    }
+
+    if (ch >= q->num_channels) {
+        dev->last_error = CANDLE_ERR_CHANNEL_OUT_OF_RANGE;
+        return false;
+    }
+
+    EnterCriticalSection(&q->lock);
+    *num_frames = q->channels[ch].dropped;
+    LeaveCriticalSection(&q->lock);
+
+    dev->last_error = CANDLE_ERR_OK;
+    return true;
+}
+
+DLL bool __stdcall candle_txq_flush(candle_handle hdev)
+{
+    candle_device_t *dev = (candle_device_t*)hdev;
+    struct candle_txq *q = dev->txq;
+
+    if (q == NULL) {
+        dev->last_error = CANDLE_ERR_TXQ_DISABLED;
+        return false;
+    }
+
+    /* e.g. after bus-off, when queued frames will never be echoed */
+    EnterCriticalSection(&q->lock);
+    for (unsigned ch=0; ch<q->num_channels; ch++) {
+        q->channels[ch].len = 0;
+    }
+    candle_txq_reset_slots(dev, q);
+    WakeAllConditionVariable(&q->space);
+    LeaveCriticalSection(&q->lock);
+
+    dev->last_error = CANDLE_ERR_OK;
+    return true;
+}
+
+DLL bool __stdcall candle_txq_disable(candle_handle hdev)
+{
+    candle_device_t *dev = (candle_device_t*)hdev;
+    struct candle_txq *q = dev->txq;
+
+    dev->txq = NULL;
+    if (q != NULL) {
+        candle_txq_reset_slots(dev, q);
+        for (unsigned i=0; i<q->num_slots; i++) {
+            if (q->slots[i].ovl.hEvent != NULL) {
+                CloseHandle((HANDLE)((ULONG_PTR)q->slots[i].ovl.hEvent & ~(ULONG_PTR)1));
+            }
+        }
+        if (q->channels != NULL) {
+            for (unsigned ch=0; ch<q->num_channels; ch++) {
+                free(q->channels[ch].heap);
+            }
+            free(q->channels);
+        }
+        DeleteCriticalSection(&q->lock);
+        free(q);
+    }
+
+    dev->last_error = CANDLE_ERR_OK;
+    return true;
+}
@@ -0,0 +1,55 @@
+/*
+
+  Copyright (c) 2016 Hubert Denkmair <hubert@denkmair.de>
+
+  This file is part of the candle windows API.
+  
+  This library is free software: you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation, either
+  version 3 of the License, or (at your option) any later version.
+ 
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+ 
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#pragma once
+#include "candle.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum {
+    CANDLE_TXQ_BLOCK       = 0, /* wait up to timeout_ms for space */
+    CANDLE_TXQ_DROP_OLDEST = 1, /* discard the frame that was queued first */
+    CANDLE_TXQ_FAIL        = 2  /* reject the new frame */
+} candle_txq_policy_t;
+
+/*
+ * Host side transmit queue per channel, ordered by CAN arbitration priority
+ * and first-in first-out for frames with the same id. Frames are handed to
+ * the device only while one of num_slots transmit slots is free; a slot is
+ * freed when the device echoes the frame, so the device has to be read
+ * (candle_frame_read, candle_frame_borrow or a reactor) for the queue to
+ * make progress. Slots whose write fails are freed without an echo.
+ * candle_txq_send fails with CANDLE_ERR_SEND_FRAME if the frame could not
+ * be handed to the device right away; candle_txq_dropped counts these
+ * frames together with those discarded by the policy.
+ */
+DLL bool __stdcall candle_txq_enable(candle_handle hdev, uint32_t capacity, uint8_t num_slots, candle_txq_policy_t policy);
+DLL bool __stdcall candle_txq_send(candle_handle hdev, uint8_t ch, const candle_frame_t *frame, uint32_t timeout_ms);
+DLL bool __stdcall candle_txq_pending(candle_handle hdev, uint8_t ch, uint32_t *num_frames);
+DLL bool __stdcall candle_txq_dropped(candle_handle hdev, uint8_t ch, uint32_t *num_frames);
+DLL bool __stdcall candle_txq_flush(candle_handle hdev);
+DLL bool __stdcall candle_txq_disable(candle_handle hdev);
+
+#ifdef __cplusplus
+}
+#endif
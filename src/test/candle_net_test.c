@@ -0,0 +1,288 @@
+/*
+
+  Copyright (c) 2016 Hubert Denkmair <hubert@denkmair.de>
+
+  This file is part of the candle windows API.
+  
+  This library is free software: you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation, either
+  version 3 of the License, or (at your option) any later version.
+ 
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+ 
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+/*
+ * Runs a server and clients over the loopback interface. The devices are
+ * fakes: this file provides candle_frame_read and candle_frame_send, so
+ * frames can be fed to the server's readers from the test.
+ */
+
+#include <winsock2.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "../candle_net.h"
+#include "../candle_defs.h"
+
+#define TEST_PORT 47211
+#define TEST_FAKE_SERVER_PORT 47212
+#define TEST_COALESCE_US 500000
+#define TEST_MAX_BATCH 4
+#define TEST_QUEUE_SIZE 64
+
+typedef struct {
+    candle_device_t dev;
+    CRITICAL_SECTION lock;
+    HANDLE available;
+    candle_frame_t queue[TEST_QUEUE_SIZE];
+    unsigned head;
+    unsigned tail;
+} fake_dev_t;
+
+static fake_dev_t fakes[2];
+static int failed = 0;
+
+#define CHECK(cond, ...) do { if (!(cond)) { printf(__VA_ARGS__); printf("\n"); failed++; } } while (0)
+
+static fake_dev_t *fake_of(candle_handle hdev)
+{
+    return (fake_dev_t *)hdev; /* dev is the first member */
+}
+
+DLL bool __stdcall candle_frame_read(candle_handle hdev, candle_frame_t *frame, uint32_t timeout_ms)
+{
+    fake_dev_t *f = fake_of(hdev);
+
+    if (WaitForSingleObject(f->available, timeout_ms) != WAIT_OBJECT_0) {
+        f->dev.last_error = CANDLE_ERR_READ_TIMEOUT;
+        return false;
+    }
+
+    EnterCriticalSection(&f->lock);
+    *frame = f->queue[f->tail++ % TEST_QUEUE_SIZE];
+    LeaveCriticalSection(&f->lock);
+
+    f->dev.last_error = CANDLE_ERR_OK;
+    return true;
+}
+
+DLL bool __stdcall candle_frame_send(candle_handle hdev, uint8_t ch, candle_frame_t *frame)
+{
+    fake_of(hdev)->dev.last_error = CANDLE_ERR_OK;
+    return true;
+}
+
+static void feed(unsigned dev_index, uint8_t ch, uint32_t can_id)
+{
+    fake_dev_t *f = &fakes[dev_index];
+    candle_frame_t frame;
+    memset(&frame, 0, sizeof(frame));
+    frame.echo_id = 0xFFFFFFFF;
+    frame.can_id = can_id;
+    frame.channel = ch;
+    frame.can_dlc = 1;
+    frame.data[0] = (uint8_t)dev_index;
+
+    EnterCriticalSection(&f->lock);
+    f->queue[f->head++ % TEST_QUEUE_SIZE] = frame;
+    LeaveCriticalSection(&f->lock);
+    ReleaseSemaphore(f->available, 1, NULL);
+}
+
+static uint64_t now_ms(void)
+{
+    return GetTickCount64();
+}
+
+/* full batches go out right away, a partial one once it is coalesce_us old */
+static void test_batching(candle_net_client_handle client)
+{
+    candle_net_frame_t nf;
+    uint64_t start = now_ms();
+
+    for (uint32_t i=0; i<10; i++) {
+        feed(0, 0, 0x100 + i);
+    }
+
+    for (uint32_t i=0; i<2*TEST_MAX_BATCH; i++) {
+        bool ok = candle_net_read(client, &nf, 1000);
+        CHECK(ok && (nf.dev_index == 0) && (nf.frame.can_id == 0x100 + i), "batching: frame %u missing or out of order", i);
+    }
+    uint64_t full_ms = now_ms() - start;
+    CHECK(full_ms < TEST_COALESCE_US / 2000, "batching: full batches took %u ms", (unsigned)full_ms);
+
+    for (uint32_t i=2*TEST_MAX_BATCH; i<10; i++) {
+        bool ok = candle_net_read(client, &nf, 2000);
+        CHECK(ok && (nf.frame.can_id == 0x100 + i), "coalescing: frame %u missing or out of order", i);
+    }
+    uint64_t partial_ms = now_ms() - start;
+    CHECK(partial_ms >= TEST_COALESCE_US * 8 / 10000, "coalescing: partial batch sent after %u ms", (unsigned)partial_ms);
+}
+
+static void test_filters(candle_net_client_handle client)
+{
+    candle_net_filter_t filter;
+    memset(&filter, 0, sizeof(filter));
+    filter.dev_index = 0;
+    filter.channel = CANDLE_NET_ANY;
+    filter.can_id = 0x100;
+    filter.mask = 0x7FF;
+
+    CHECK(candle_net_set_filters(client, &filter, 1), "filters: set failed");
+    Sleep(200); /* the server applies them on its receiving thread */
+
+    feed(1, 0, 0x100);
+    feed(0, 0, 0x200);
+    feed(0, 0, 0x100);
+    feed(0, 0, 0x101);
+    feed(0, 1, 0x100);
+
+    candle_net_frame_t nf;
+    bool ok = candle_net_read(client, &nf, 2000);
+    CHECK(ok && (nf.dev_index == 0) && (nf.frame.can_id == 0x100) && (nf.frame.channel == 0), "filters: first match missing");
+    ok = candle_net_read(client, &nf, 2000);
+    CHECK(ok && (nf.dev_index == 0) && (nf.frame.can_id == 0x100) && (nf.frame.channel == 1), "filters: second match missing");
+
+    ok = candle_net_read(client, &nf, 2 * TEST_COALESCE_US / 1000);
+    CHECK(!ok && (candle_net_client_last_error(client) == CANDLE_ERR_READ_TIMEOUT),
+          "filters: unexpected frame %03X from device %u", nf.frame.can_id, nf.dev_index);
+}
+
+/* wire format of candle_net.c, spoken by the fake server below */
+#pragma pack(push,1)
+typedef struct {
+    uint32_t magic;
+    uint8_t type;
+    uint8_t reserved[3];
+    uint32_t length;
+    uint32_t seq;
+} wire_header_t;
+#pragma pack(pop)
+
+static bool send_msg(SOCKET sock, uint8_t type, uint32_t seq, const void *payload, uint32_t len)
+{
+    wire_header_t hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.magic = 0x54454E43;
+    hdr.type = type;
+    hdr.length = len;
+    hdr.seq = seq;
+    return (send(sock, (const char *)&hdr, sizeof(hdr), 0) == sizeof(hdr))
+        && ((len == 0) || (send(sock, (const char *)payload, (int)len, 0) == (int)len));
+}
+
+static DWORD WINAPI fake_server(LPVOID param)
+{
+    SOCKET listen_sock = (SOCKET)(ULONG_PTR)param;
+    SOCKET sock = accept(listen_sock, NULL, NULL);
+    if (sock == INVALID_SOCKET) {
+        return 1;
+    }
+
+    uint8_t hello[2] = { 1, 1 };
+    send_msg(sock, 1, 0, hello, sizeof(hello));
+
+    /* batches 2, 3 and 6 were dropped for a slow client */
+    static const uint32_t seqs[] = { 0, 1, 4, 5, 7 };
+    for (unsigned i=0; i<sizeof(seqs)/sizeof(seqs[0]); i++) {
+        candle_net_frame_t nf;
+        memset(&nf, 0, sizeof(nf));
+        nf.frame.can_id = seqs[i];
+        send_msg(sock, 2, seqs[i], &nf, sizeof(nf));
+    }
+
+    /* wait for the client to hang up */
+    char c;
+    recv(sock, &c, 1, 0);
+    closesocket(sock);
+    return 0;
+}
+
+static void test_sequence_gaps(void)
+{
+    SOCKET listen_sock = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(TEST_FAKE_SERVER_PORT);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if ((listen_sock == INVALID_SOCKET) || (bind(listen_sock, (struct sockaddr *)&addr, sizeof(addr)) == SOCKET_ERROR)
+        || (listen(listen_sock, 1) == SOCKET_ERROR))
+    {
+        CHECK(false, "gaps: cannot listen on port %u", TEST_FAKE_SERVER_PORT);
+        return;
+    }
+
+    HANDLE thread = CreateThread(NULL, 0, fake_server, (LPVOID)(ULONG_PTR)listen_sock, 0, NULL);
+
+    candle_net_client_handle client;
+    if (candle_net_connect(&client, "127.0.0.1", TEST_FAKE_SERVER_PORT)) {
+        candle_net_frame_t nf;
+        for (unsigned i=0; i<5; i++) {
+            CHECK(candle_net_read(client, &nf, 2000), "gaps: batch %u missing", i);
+        }
+        uint32_t lost = 0;
+        candle_net_get_lost(client, &lost);
+        CHECK(lost == 3, "gaps: counted %u lost batches instead of 3", lost);
+    } else {
+        CHECK(false, "gaps: connect failed with %d", candle_net_client_last_error(client));
+    }
+    candle_net_disconnect(client);
+
+    WaitForSingleObject(thread, INFINITE);
+    CloseHandle(thread);
+    closesocket(listen_sock);
+}
+
+int main(void)
+{
+    WSADATA wsa;
+    WSAStartup(MAKEWORD(2, 2), &wsa);
+
+    for (unsigned i=0; i<2; i++) {
+        fakes[i].dev.dconf.icount = 1;
+        InitializeCriticalSection(&fakes[i].lock);
+        fakes[i].available = CreateSemaphore(NULL, 0, TEST_QUEUE_SIZE, NULL);
+    }
+
+    candle_net_server_handle server;
+    uint8_t dev_index;
+    bool ok = candle_net_server_create(&server, TEST_PORT, TEST_COALESCE_US, TEST_MAX_BATCH)
+        && candle_net_server_add_device(server, &fakes[0].dev, &dev_index)
+        && candle_net_server_add_device(server, &fakes[1].dev, &dev_index)
+        && candle_net_server_start(server);
+    CHECK(ok, "server: start failed with %d", candle_net_server_last_error(server));
+
+    candle_net_client_handle client;
+    if (ok && candle_net_connect(&client, "127.0.0.1", TEST_PORT)) {
+        uint8_t num_devices = 0;
+        candle_net_device_count(client, &num_devices);
+        CHECK(num_devices == 2, "hello: %u devices", num_devices);
+
+        test_batching(client);
+        test_filters(client);
+
+        uint32_t lost = 0;
+        candle_net_get_lost(client, &lost);
+        CHECK(lost == 0, "server: %u batches lost on loopback", lost);
+        candle_net_disconnect(client);
+    } else if (ok) {
+        CHECK(false, "client: connect failed with %d", candle_net_client_last_error(client));
+        candle_net_disconnect(client);
+    }
+    candle_net_server_free(server);
+
+    test_sequence_gaps();
+
+    WSACleanup();
+    printf("%s\n", failed ? "FAILED" : "ok");
+    return failed ? 1 : 0;
+}
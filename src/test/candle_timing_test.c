@@ -0,0 +1,109 @@
+/*
+
+  Copyright (c) 2016 Hubert Denkmair <hubert@denkmair.de>
+
+  This file is part of the candle windows API.
+  
+  This library is free software: you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation, either
+  version 3 of the License, or (at your option) any later version.
+ 
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+ 
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include <stdio.h>
+#include "../candle_timing.h"
+
+typedef struct {
+    candle_capability_t cap;
+    uint32_t bitrate;
+    uint32_t sample_point;
+    bool ok;
+    candle_bittiming_t expect;
+} timing_case_t;
+
+/* feature, fclk, tseg1 min/max, tseg2 min/max, sjw max, brp min/max/inc */
+#define CAP_CANDLELIGHT { 0, 48000000, 1, 16, 1, 8, 4, 1, 1024, 1 }
+#define CAP_SJA1000     { 0, 16000000, 1, 16, 1, 8, 4, 1, 64, 1 }
+#define CAP_FDCAN_80M   { 0, 80000000, 2, 256, 2, 128, 128, 1, 512, 1 }
+
+static const timing_case_t cases[] = {
+    /* same brp and sample point as the former fixed 48MHz table */
+    { CAP_CANDLELIGHT,   10000, 875, true, { 6, 7, 2, 1, 300 } },
+    { CAP_CANDLELIGHT,   83333, 875, true, { 6, 7, 2, 1,  36 } },
+    { CAP_CANDLELIGHT,  125000, 875, true, { 6, 7, 2, 1,  24 } },
+    { CAP_CANDLELIGHT,  500000, 875, true, { 6, 7, 2, 1,   6 } },
+    { CAP_CANDLELIGHT,  800000, 875, true, { 6, 6, 2, 1,   4 } },
+    { CAP_CANDLELIGHT, 1000000, 875, true, { 6, 7, 2, 1,   3 } },
+
+    { CAP_SJA1000,      125000, 875, true, { 6, 7, 2, 1,   8 } },
+    { CAP_SJA1000,      500000, 875, true, { 6, 7, 2, 1,   2 } },
+    { CAP_SJA1000,       10000, 875, true, { 8, 8, 8, 4,  64 } },
+
+    { CAP_FDCAN_80M,    500000, 875, true, { 69, 70, 20, 10,  1 } },
+    { CAP_FDCAN_80M,   1000000, 875, true, { 34, 35, 10,  5,  1 } },
+    { CAP_FDCAN_80M,    125000, 100, true, {  3,  4, 72,  4,  8 } },
+
+    /* tseg2_max is too small for these sample points */
+    { CAP_CANDLELIGHT,  500000, 100, false, { 0, 0, 0, 0, 0 } },
+    { CAP_SJA1000,       10000, 500, false, { 0, 0, 0, 0, 0 } },
+    /* no prescaler comes within 5% of the bitrate */
+    { CAP_SJA1000,        1000, 875, false, { 0, 0, 0, 0, 0 } },
+};
+
+static bool check_limits(const candle_capability_t *cap, uint32_t bitrate, const candle_bittiming_t *t)
+{
+    uint32_t tseg1 = t->prop_seg + t->phase_seg1;
+    uint32_t tq = 1 + tseg1 + t->phase_seg2;
+    uint32_t rate = cap->fclk_can / (t->brp * tq);
+    uint32_t rate_error = (bitrate > rate) ? (bitrate - rate) : (rate - bitrate);
+
+    return (tseg1 >= cap->tseg1_min) && (tseg1 <= cap->tseg1_max)
+        && (t->phase_seg2 >= cap->tseg2_min) && (t->phase_seg2 <= cap->tseg2_max)
+        && (t->brp >= cap->brp_min) && (t->brp <= cap->brp_max)
+        && (t->sjw >= 1) && (t->sjw <= cap->sjw_max)
+        && ((uint64_t)rate_error * 1000 / bitrate <= 50);
+}
+
+int main(void)
+{
+    int failed = 0;
+
+    for (unsigned i=0; i<sizeof(cases)/sizeof(cases[0]); i++) {
+        const timing_case_t *c = &cases[i];
+        candle_bittiming_t t = { 0, 0, 0, 0, 0 };
+        bool ok = candle_timing_solve(&c->cap, c->bitrate, c->sample_point, &t);
+
+        if ((ok != c->ok) || (ok && ((t.prop_seg != c->expect.prop_seg) || (t.phase_seg1 != c->expect.phase_seg1)
+            || (t.phase_seg2 != c->expect.phase_seg2) || (t.sjw != c->expect.sjw) || (t.brp != c->expect.brp))))
+        {
+            printf("case %u: %u Hz @ %u/%u sp: got %d brp=%u prop=%u ps1=%u ps2=%u sjw=%u\n",
+                   i, c->cap.fclk_can, c->bitrate, c->sample_point, ok, t.brp, t.prop_seg, t.phase_seg1, t.phase_seg2, t.sjw);
+            failed++;
+        }
+    }
+
+    /* whatever the solver accepts must fit the controller */
+    for (unsigned i=0; i<sizeof(cases)/sizeof(cases[0]); i++) {
+        for (uint32_t sp=50; sp<1000; sp+=25) {
+            for (uint32_t bitrate=5000; bitrate<=1000000; bitrate+=5000) {
+                candle_bittiming_t t;
+                if (candle_timing_solve(&cases[i].cap, bitrate, sp, &t) && !check_limits(&cases[i].cap, bitrate, &t)) {
+                    printf("sweep: %u Hz @ %u/%u sp out of limits\n", cases[i].cap.fclk_can, bitrate, sp);
+                    failed++;
+                }
+            }
+        }
+    }
+
+    printf("%s\n", failed ? "FAILED" : "ok");
+    return failed ? 1 : 0;
+}